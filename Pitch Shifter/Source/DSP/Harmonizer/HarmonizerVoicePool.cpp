@@ -0,0 +1,290 @@
+#include "HarmonizerVoicePool.h"
+
+dsp::HarmonizerVoicePool::HarmonizerVoicePool(std::shared_ptr<juce::dsp::ProcessSpec> procSpec)
+    : processSpec(procSpec) {
+    for (auto v = 0; v < maxVoices; v++) {
+        auto &voice = voices[v];
+        for (auto type = 0; type < static_cast<int>(SinesShiftEngine::Type::numTypes); type++) {
+            voice.sinesEngines.push_back(SinesShiftEngine::create(static_cast<SinesShiftEngine::Type>(type)));
+        }
+        voice.sinesEngine = voice.sinesEngines[static_cast<size_t>(sinesEngineType)].get();
+
+        voice.noiseMorphing = std::make_unique<NoiseMorphing>(processSpec);
+        voice.noiseMorphing->setSpectralNoise(true);
+        voice.noiseMorphing->setSeed(static_cast<std::uint64_t>(v + 1)); // uncorrelated noise between voices
+    }
+
+    const auto numWorkers = juce::jlimit(0, maxVoices - 1, juce::SystemStats::getNumCpus() - 1);
+    for (auto w = 0; w < numWorkers; w++) {
+        workers.push_back(std::make_unique<Worker>(*this));
+    }
+}
+
+dsp::HarmonizerVoicePool::~HarmonizerVoicePool() {
+    for (auto &worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->start.signal();
+    }
+    for (auto &worker : workers) {
+        worker->stopThread(1000);
+    }
+}
+
+void dsp::HarmonizerVoicePool::prepare() {
+    const auto maximumBlockSize = static_cast<int>(processSpec->maximumBlockSize);
+    for (auto &voice : voices) {
+        voice.sines.resize(maximumBlockSize);
+        voice.noise.setSize(1, maximumBlockSize);
+        voice.noiseMorphing->prepare();
+        voice.gain.reset(processSpec->sampleRate, fadeSeconds);
+        voice.gain.setCurrentAndTargetValue(0.f);
+        voice.key = -1;
+        voice.stopping = false;
+        voice.pendingKey = -1;
+    }
+    numActiveVoices = 0;
+
+    // Realtime threads, scheduled like the audio thread they help
+    const auto options = juce::Thread::RealtimeOptions{}.withApproximateAudioProcessingTime(maximumBlockSize,
+                                                                                           processSpec->sampleRate);
+    for (auto &worker : workers) {
+        if (!worker->isThreadRunning())
+            worker->startRealtimeThread(options);
+    }
+}
+
+void dsp::HarmonizerVoicePool::setAudioWorkgroup(const juce::AudioWorkgroup &newWorkgroup) {
+    const juce::SpinLock::ScopedLockType lock(workgroupLock);
+    workgroup = newWorkgroup;
+    ++workgroupGeneration;
+}
+
+void dsp::HarmonizerVoicePool::configureSinesEngines(const int blockSamples, const int intervalSamples,
+                                                     const int maximumBlockSize) {
+    for (auto &voice : voices) {
+        for (auto &engine : voice.sinesEngines) {
+            engine->configure(blockSamples, intervalSamples, maximumBlockSize);
+        }
+    }
+}
+
+void dsp::HarmonizerVoicePool::setSinesEngineType(const SinesShiftEngine::Type type) {
+    if (sinesEngineType == type)
+        return;
+
+    sinesEngineType = type;
+    for (auto &voice : voices) {
+        voice.sinesEngine = voice.sinesEngines[static_cast<size_t>(type)].get();
+        voice.sinesEngine->reset();
+        voice.sinesEngine->setPitchShiftRatio(voice.ratio);
+    }
+}
+
+void dsp::HarmonizerVoicePool::setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed) {
+    for (auto &voice : voices) {
+        voice.noiseMorphing->setNoiseMagnitudeFeed(newNoiseFeed);
+    }
+}
+
+void dsp::HarmonizerVoicePool::setNoiseFFTSize(const int newFFTSize) {
+    for (auto &voice : voices) {
+        voice.noiseMorphing->setFFTSize(newFFTSize);
+    }
+}
+
+void dsp::HarmonizerVoicePool::setNoiseMaxStretchFrames(const int newMaxStretchFrames) {
+    for (auto &voice : voices) {
+        voice.noiseMorphing->setMaxStretchFrames(newMaxStretchFrames);
+    }
+}
+
+void dsp::HarmonizerVoicePool::startVoice(const int key, const float pitchShiftRatio) {
+    jassert(key >= 0);
+    for (auto &voice : voices) {
+        if (voice.pendingKey == key) {
+            voice.pendingRatio = pitchShiftRatio; // waits for a voice to fade out
+            return;
+        }
+    }
+
+    // A voice that is taken over no longer sounds its key
+    auto it = std::find_if(voices.begin(), voices.end(),
+                           [key](const Voice &v) { return v.key == key && v.pendingKey < 0; });
+    if (it == voices.end()) {
+        // A free voice, otherwise the oldest one fades out first, cutting it would click
+        it = std::find_if(voices.begin(), voices.end(), [](const Voice &v) { return v.key < 0; });
+        if (it == voices.end()) {
+            it = std::min_element(voices.begin(), voices.end(),
+                                  [](const Voice &a, const Voice &b) { return a.startedAt < b.startedAt; });
+            it->pendingKey = key;
+            it->pendingRatio = pitchShiftRatio;
+            it->startedAt = ++voiceCounter;
+            it->stopping = true;
+            it->gain.setTargetValue(0.f);
+            return;
+        }
+        restartVoice(*it);
+        it->key = key;
+        it->startedAt = ++voiceCounter;
+    }
+
+    it->stopping = false;
+    it->gain.setTargetValue(1.f);
+    it->ratio = pitchShiftRatio;
+    it->sinesEngine->setPitchShiftRatio(pitchShiftRatio);
+    it->noiseMorphing->setPitchShiftRatio(pitchShiftRatio);
+}
+
+void dsp::HarmonizerVoicePool::stopVoice(const int key) {
+    for (auto &voice : voices) {
+        if (voice.pendingKey == key) {
+            voice.pendingKey = -1; // the voice is freed once faded out
+        } else if (voice.key == key && !voice.stopping) {
+            voice.stopping = true;
+            voice.gain.setTargetValue(0.f);
+        }
+    }
+}
+
+void dsp::HarmonizerVoicePool::stopAllVoices() {
+    for (auto &voice : voices) {
+        voice.pendingKey = -1;
+        if (voice.key >= 0)
+            stopVoice(voice.key);
+    }
+}
+
+void dsp::HarmonizerVoicePool::restartVoice(Voice &voice) {
+    jassert(voice.gain.getCurrentValue() == 0.f); // only silent voices are restarted
+    voice.sinesEngine->reset();
+    voice.noiseMorphing->reset();
+    voice.stopping = false;
+}
+
+void dsp::HarmonizerVoicePool::process(juce::AudioBuffer<float> &sines, juce::AudioBuffer<float> &noise) {
+    const auto numSamples = sines.getNumSamples();
+    jassert(noise.getNumSamples() == numSamples);
+
+    // Free voices only keep their position in the noise feed timeline
+    numJobs = 0;
+    for (auto &voice : voices) {
+        if (voice.key >= 0) jobs[numJobs++] = &voice;
+        else voice.noiseMorphing->skip(numSamples);
+    }
+    numActiveVoices = numJobs;
+    if (numJobs == 0) {
+        sines.clear();
+        noise.clear();
+        return;
+    }
+
+    // The jobs of the last block are all claimed, so workers do not read the job state until it is published
+    jobSines = sines.getReadPointer(0);
+    jobNoise = noise.getReadPointer(0);
+    jobNumSamples = numSamples;
+    jobsLeft = numJobs;
+    jobClaims.store(numJobs << 8, std::memory_order_release);
+
+    const auto numHelpers = juce::jmin(static_cast<int>(workers.size()), numJobs - 1);
+    for (auto w = 0; w < numHelpers; w++) {
+        workers[w]->start.signal();
+    }
+    processJobs();
+    while (jobsLeft.load() > 0)
+        jobsDone.wait(); // only voices a worker is processing, the others were taken here
+
+    // ===== Sum of the voices =====
+    auto *sinesData = sines.getWritePointer(0);
+    auto *noiseData = noise.getWritePointer(0);
+    juce::FloatVectorOperations::clear(sinesData, numSamples);
+    juce::FloatVectorOperations::clear(noiseData, numSamples);
+    for (auto j = 0; j < numJobs; j++) {
+        auto &voice = *jobs[j];
+        const auto *voiceNoise = voice.noise.getReadPointer(0);
+        if (voice.gain.isSmoothing()) {
+            for (auto i = 0; i < numSamples; i++) {
+                const auto gain = voice.gain.getNextValue();
+                sinesData[i] += gain * voice.sines[i];
+                noiseData[i] += gain * voiceNoise[i];
+            }
+        } else {
+            const auto gain = voice.gain.getCurrentValue();
+            juce::FloatVectorOperations::addWithMultiply(sinesData, voice.sines.data(), gain, numSamples);
+            juce::FloatVectorOperations::addWithMultiply(noiseData, voiceNoise, gain, numSamples);
+        }
+
+        if (voice.stopping && !voice.gain.isSmoothing()) {
+            voice.key = -1; // faded out
+            voice.stopping = false;
+            if (voice.pendingKey >= 0) {
+                // Taken over, the new key starts from silence with the next block
+                restartVoice(voice);
+                voice.key = voice.pendingKey;
+                voice.pendingKey = -1;
+                voice.gain.setTargetValue(1.f);
+                voice.ratio = voice.pendingRatio;
+                voice.sinesEngine->setPitchShiftRatio(voice.pendingRatio);
+                voice.noiseMorphing->setPitchShiftRatio(voice.pendingRatio);
+            }
+        }
+    }
+}
+
+void dsp::HarmonizerVoicePool::skip(const int numSamples) {
+    for (auto &voice : voices) {
+        voice.noiseMorphing->skip(numSamples);
+        voice.gain.setCurrentAndTargetValue(0.f); // not heard while skipping
+        voice.key = -1;
+        voice.stopping = false;
+        voice.pendingKey = -1;
+    }
+    numActiveVoices = 0;
+}
+
+void dsp::HarmonizerVoicePool::processJobs() {
+    juce::ScopedNoDenormals noDenormals;
+    auto claims = jobClaims.load(std::memory_order_acquire);
+    while ((claims & 0xff) < (claims >> 8)) {
+        if (!jobClaims.compare_exchange_weak(claims, claims + 1, std::memory_order_acquire))
+            continue;
+
+        processVoice(*jobs[claims & 0xff]);
+        if (jobsLeft.fetch_sub(1) == 1)
+            jobsDone.signal();
+        claims = jobClaims.load(std::memory_order_acquire);
+    }
+}
+
+void dsp::HarmonizerVoicePool::processVoice(Voice &voice) {
+    voice.sinesEngine->process(jobSines, voice.sines.data(), jobNumSamples);
+
+    voice.noise.setSize(1, jobNumSamples, false, false, true);
+    voice.noise.copyFrom(0, 0, jobNoise, jobNumSamples);
+    voice.noiseMorphing->process(voice.noise);
+}
+
+dsp::HarmonizerVoicePool::Worker::Worker(HarmonizerVoicePool &owner) : juce::Thread("Harmonizer Voice"), pool(owner) {
+}
+
+void dsp::HarmonizerVoicePool::Worker::run() {
+    while (!threadShouldExit()) {
+        start.wait();
+        if (threadShouldExit())
+            break;
+
+        updateWorkgroup();
+        pool.processJobs();
+    }
+}
+
+void dsp::HarmonizerVoicePool::Worker::updateWorkgroup() {
+    const auto generation = pool.workgroupGeneration.load();
+    if (generation == workgroupGeneration)
+        return;
+
+    workgroupGeneration = generation;
+    workgroupToken.reset();
+    const juce::SpinLock::ScopedLockType lock(pool.workgroupLock);
+    if (pool.workgroup)
+        pool.workgroup.join(workgroupToken);
+}
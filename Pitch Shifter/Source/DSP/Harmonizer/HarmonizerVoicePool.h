@@ -0,0 +1,146 @@
+#pragma once
+#include "../NM/NoiseMorphing.h"
+#include "../PS/SinesShiftEngine.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// Harmonizer voices sharing one DecomposeSTN pass. The decomposition does not depend on the pitch shift ratio, so
+/// only the sines shifting engines and the noise morphing are instantiated per voice. All voices are allocated by
+/// prepare, starting and stopping voices on the audio thread does not allocate.
+/// Voices are identified by a key, a MIDI note number or the index of an interval. Every voice fades in when started
+/// and out when stopped, a stopped voice is free again once faded out. When all voices are busy, the oldest one fades
+/// out and is then taken over by the new key.
+/// Active voices are processed in parallel, by the audio thread and a few realtime worker threads that join the audio
+/// workgroup of the host. The audio thread takes every voice no worker has claimed yet, it only waits for voices a
+/// worker is processing, never for a worker to wake up.
+class HarmonizerVoicePool {
+  public:
+    static constexpr int maxVoices{4};
+
+    HarmonizerVoicePool(std::shared_ptr<juce::dsp::ProcessSpec> procSpec);
+    ~HarmonizerVoicePool();
+
+    /// Allocates the voice buffers for the process spec and starts the worker threads. Not audio thread safe.
+    void prepare();
+
+    /// Workers join this workgroup before they process the next block, so the host schedules them with its audio
+    /// threads. Not audio thread safe.
+    /// - Parameter newWorkgroup: Workgroup of the audio thread, an invalid one to leave it.
+    void setAudioWorkgroup(const juce::AudioWorkgroup &newWorkgroup);
+
+    /// Configures the sines engines of every voice, see SinesShiftEngine::configure. Not audio thread safe.
+    void configureSinesEngines(const int blockSamples, const int intervalSamples, const int maximumBlockSize);
+
+    /// Selects the sines engine of every voice. Engines are configured in advance, switching only clears them.
+    /// - Parameter type: Algorithm.
+    void setSinesEngineType(const SinesShiftEngine::Type type);
+
+    /// - Parameter newNoiseFeed: Feed published by DecomposeSTN, read by the noise morphing of every voice.
+    void setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed);
+
+    /// See NoiseMorphing::setFFTSize.
+    void setNoiseFFTSize(const int newFFTSize);
+
+    /// See NoiseMorphing::setMaxStretchFrames.
+    void setNoiseMaxStretchFrames(const int newMaxStretchFrames);
+
+    /// Starts a voice, or changes its pitch shift ratio when one with the same key is already sounding. When all voices
+    /// are busy, the key starts once the oldest voice has faded out.
+    /// - Parameters:
+    ///   - key: MIDI note number or interval index.
+    ///   - pitchShiftRatio: Pitch shift ratio of the voice, 0.25 to 4.
+    void startVoice(const int key, const float pitchShiftRatio);
+
+    /// Fades a voice out. Does nothing when no voice has the key.
+    /// - Parameter key: MIDI note number or interval index.
+    void stopVoice(const int key);
+
+    /// Fades all voices out.
+    void stopAllVoices();
+
+    /// Shifts the sines and the noise by every active voice and sums the voices.
+    /// - Parameters:
+    ///   - sines: Sines of DecomposeSTN, replaced by the sum of the shifted sines.
+    ///   - noise: Noise of DecomposeSTN, replaced by the sum of the morphed noise.
+    void process(juce::AudioBuffer<float> &sines, juce::AudioBuffer<float> &noise);
+
+    /// Lets a block pass while the harmonizer is not used. All voices are freed at once, their noise morphing keeps its
+    /// position in the noise feed timeline, see NoiseMorphing::skip.
+    /// - Parameter numSamples: Number of skipped samples.
+    void skip(const int numSamples);
+
+    /// Number of voices sounding or fading out. Can be read from any thread.
+    int getNumActiveVoices() const { return numActiveVoices.load(); }
+
+  private:
+    struct Voice {
+        std::vector<std::unique_ptr<SinesShiftEngine>> sinesEngines; // one per SinesShiftEngine::Type
+        SinesShiftEngine *sinesEngine{nullptr};
+        std::unique_ptr<NoiseMorphing> noiseMorphing;
+
+        Vec1D sines;                     // shifted sines of the current block
+        juce::AudioBuffer<float> noise; // morphed noise of the current block
+
+        juce::SmoothedValue<float, juce::ValueSmoothingTypes::Linear> gain; // fade in and out
+        int key{-1};                    // -1 when free
+        float ratio{1.f};               // pitch shift ratio of key, given again to an engine switched in
+        bool stopping{false};           // fading out, free once the gain reaches zero
+        int pendingKey{-1};             // key taking the voice over once faded out, -1 when not taken over
+        float pendingRatio{1.f};        // pitch shift ratio of pendingKey
+        juce::uint32 startedAt{0};      // start order, the oldest voice is taken over first
+    };
+
+    /// Processes the voices of the current block until none is left unclaimed, on the audio thread and the workers.
+    void processJobs();
+
+    /// Shifts the sines and morphs the noise of one voice.
+    void processVoice(Voice &voice);
+
+    /// Clears the state of a voice that starts sounding.
+    void restartVoice(Voice &voice);
+
+    class Worker : public juce::Thread {
+      public:
+        Worker(HarmonizerVoicePool &owner);
+
+        void run() override;
+
+        juce::WaitableEvent start; // signalled by the audio thread when jobs are ready
+
+      private:
+        /// Joins the workgroup of the pool when it changed since the last block.
+        void updateWorkgroup();
+
+        HarmonizerVoicePool &pool;
+        juce::WorkgroupToken workgroupToken;
+        int workgroupGeneration{0}; // generation of the joined workgroup
+    };
+
+    std::array<Voice, maxVoices> voices;
+    std::vector<std::unique_ptr<Worker>> workers; // up to maxVoices - 1, the audio thread takes part as well
+    SinesShiftEngine::Type sinesEngineType{SinesShiftEngine::Type::signalsmith};
+
+    // Jobs of the current block, read by the workers. A job is claimed by counting up the low byte of jobClaims, the
+    // number of jobs is in the byte above, so a late worker can never claim a job of a block that is being set up.
+    std::array<Voice *, maxVoices> jobs{};
+    int numJobs{0};
+    std::atomic<int> jobClaims{0};
+    std::atomic<int> jobsLeft{0};  // jobs not finished yet
+    juce::WaitableEvent jobsDone;  // signalled when the last job is finished, may be left over from an earlier block
+    const float *jobSines{nullptr};
+    const float *jobNoise{nullptr};
+    int jobNumSamples{0};
+
+    juce::AudioWorkgroup workgroup;
+    juce::SpinLock workgroupLock;
+    std::atomic<int> workgroupGeneration{0}; // counts workgroup changes
+
+    std::atomic<int> numActiveVoices{0};
+    juce::uint32 voiceCounter{0};
+    const double fadeSeconds{0.02};
+
+    std::shared_ptr<juce::dsp::ProcessSpec> processSpec;
+};
+} // namespace dsp
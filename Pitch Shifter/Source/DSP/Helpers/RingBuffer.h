@@ -0,0 +1,133 @@
+#pragma once
+#include <JuceHeader.h>
+
+namespace dsp::helpers {
+/// Circular buffer of floats whose contents are stored twice, one copy right after the other. Every window of up to
+/// getSize() samples, wherever it starts, is then a single contiguous span, so FFT frames can be read and overlap-added
+/// with vector operations instead of unwinding copies or modulo indexing per sample.
+/// The buffer has one head position. Writers push at the head, overlap-add targets and windows are given as offsets
+/// from it.
+class RingBuffer {
+  public:
+    /// Resizes and clears the buffer. Only allocates when growing past the reserved size.
+    /// - Parameter newSize: Number of samples in the circle.
+    void setSize(const int newSize) {
+        size = newSize;
+        data.assign(static_cast<size_t>(size) * 2, 0.f);
+        head = 0;
+    }
+
+    /// Reserves memory, so setSize does not allocate up to this size. Not audio thread safe.
+    /// - Parameter maxSize: Largest number of samples in the circle.
+    void reserve(const int maxSize) { data.reserve(static_cast<size_t>(maxSize) * 2); }
+
+    /// Clears all samples and moves the head to the start.
+    void reset() {
+        std::fill(data.begin(), data.end(), 0.f);
+        head = 0;
+    }
+
+    int getSize() const { return size; }
+
+    /// Contiguous view of getSize() - offset samples starting offset samples after the head. Reading before the head
+    /// is fine with a negative offset down to -getSize().
+    /// - Parameter offset: Position relative to the head.
+    const float *window(const int offset = 0) const { return data.data() + wrap(head + offset); }
+
+    /// Writes one sample at the head and moves the head forward. Once the buffer is full, window() returns the
+    /// oldest getSize() samples in order.
+    /// - Parameter sample: New sample.
+    void push(const float sample) {
+        data[head] = sample;
+        data[head + size] = sample;
+        advance(1);
+    }
+
+    /// Writes a block of samples at the head and moves the head forward.
+    /// - Parameters:
+    ///   - src: New samples.
+    ///   - numSamples: Number of samples, at most getSize().
+    void push(const float *src, const int numSamples) {
+        copy(src, 0, numSamples);
+        advance(numSamples);
+    }
+
+    /// Returns the sample at the head, clears it and moves the head forward. Reads an overlap-add buffer.
+    float pop() {
+        const auto sample = data[head];
+        data[head] = 0.f;
+        data[head + size] = 0.f;
+        advance(1);
+        return sample;
+    }
+
+    /// Block version of pop, copies numSamples samples from the head on, clears them and moves the head forward.
+    /// - Parameters:
+    ///   - dest: Destination.
+    ///   - numSamples: Number of samples, at most getSize().
+    void pop(float *dest, const int numSamples) {
+        juce::FloatVectorOperations::copy(dest, window(), numSamples);
+        clear(0, numSamples);
+        advance(numSamples);
+    }
+
+    /// Overlap-adds a block of samples.
+    /// - Parameters:
+    ///   - src: Samples to add.
+    ///   - offset: Position of the first sample relative to the head.
+    ///   - numSamples: Number of samples, at most getSize().
+    void add(const float *src, const int offset, const int numSamples) {
+        jassert(numSamples <= size);
+        forEachCopy(offset, numSamples, [src](float *dest, const int srcPos, const int n) {
+            juce::FloatVectorOperations::add(dest, src + srcPos, n);
+        });
+    }
+
+    /// Clears a block of samples.
+    /// - Parameters:
+    ///   - offset: Position of the first sample relative to the head.
+    ///   - numSamples: Number of samples, at most getSize().
+    void clear(const int offset, const int numSamples) {
+        jassert(numSamples <= size);
+        forEachCopy(offset, numSamples,
+                    [](float *dest, const int, const int n) { juce::FloatVectorOperations::clear(dest, n); });
+    }
+
+    /// Moves the head forward without touching the samples.
+    /// - Parameter numSamples: Number of samples, at most getSize().
+    void advance(const int numSamples) {
+        head += numSamples;
+        if (head >= size) head -= size; // circular buffer
+    }
+
+  private:
+    int wrap(const int pos) const {
+        if (pos >= size) return pos - size;
+        if (pos < 0) return pos + size;
+        return pos;
+    }
+
+    void copy(const float *src, const int offset, const int numSamples) {
+        jassert(numSamples <= size);
+        forEachCopy(offset, numSamples, [src](float *dest, const int srcPos, const int n) {
+            juce::FloatVectorOperations::copy(dest, src + srcPos, n);
+        });
+    }
+
+    /// Calls op(dest, srcPos, n) for the contiguous spans covering both copies of the block.
+    template <typename Op> void forEachCopy(const int offset, const int numSamples, Op &&op) {
+        const auto start = wrap(head + offset);
+        const auto first = juce::jmin(numSamples, size - start);
+        op(data.data() + start, 0, first);
+        op(data.data() + start + size, 0, first);
+        if (numSamples > first) {
+            op(data.data(), first, numSamples - first);
+            op(data.data() + size, first, numSamples - first);
+        }
+    }
+
+    std::vector<float> data; // 2 * size samples, second half mirrors the first one
+    int size{0};
+    int head{0};
+};
+} // namespace dsp::helpers
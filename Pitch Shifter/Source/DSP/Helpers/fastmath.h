@@ -0,0 +1,97 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace dsp::helpers {
+/// Natural logarithm of a positive normal float. Branchless, so loops calling it can be vectorized. Relative error
+/// below 1e-6, no handling of zero, negative, denormal or infinite input.
+inline float fastLog(const float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(float));
+
+    // x = m * 2^e, m in [sqrt(0.5), sqrt(2))
+    const auto offset = bits - 0x3f3504f3u; // sqrt(0.5)
+    const auto e = static_cast<float>(static_cast<std::int32_t>(offset) >> 23);
+    bits -= offset & 0xff800000u;
+    float m;
+    std::memcpy(&m, &bits, sizeof(float));
+
+    // ln(m) = 2 * atanh(t), t = (m - 1) / (m + 1), |t| < 0.172
+    const auto t = (m - 1.f) / (m + 1.f);
+    const auto t2 = t * t;
+    const auto series = 1.f + t2 * (1.f / 3.f + t2 * (1.f / 5.f + t2 * (1.f / 7.f)));
+    return e * 0.69314718f + 2.f * t * series;
+}
+
+/// Base 2 logarithm of a positive normal float, same accuracy and restrictions as fastLog.
+inline float fastLog2(const float x) { return fastLog(x) * 1.44269504f; }
+
+/// Base 2 exponential. Branchless, relative error below 3e-7. Input is clamped to [-126, 126].
+inline float fastExp2(const float x) {
+    const auto clamped = x < -126.f ? -126.f : (x > 126.f ? 126.f : x);
+
+    // 2^x = 2^n * 2^f, f in [-0.5, 0.5]
+    const auto n = static_cast<float>(static_cast<std::int32_t>(clamped + (clamped >= 0.f ? 0.5f : -0.5f)));
+    const auto f = clamped - n;
+    const auto p = 1.f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f +
+                   f * (0.00133336f + f * 0.00015404f)))));
+
+    const auto bits = static_cast<std::uint32_t>(static_cast<std::int32_t>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(float));
+    return p * scale;
+}
+
+/// Sine and cosine of x in [-pi / 2, pi / 2]. Branchless, absolute error below 4e-6.
+/// - Parameters:
+///   - x: Angle in radians.
+///   - s: Resulting sine.
+///   - c: Resulting cosine.
+inline void fastSinCos(const float x, float &s, float &c) {
+    const auto x2 = x * x;
+    s = x * (1.f + x2 * (-1.f / 6.f + x2 * (1.f / 120.f + x2 * (-1.f / 5040.f + x2 * (1.f / 362880.f)))));
+    c = 1.f + x2 * (-0.5f + x2 * (1.f / 24.f + x2 * (-1.f / 720.f + x2 * (1.f / 40320.f + x2 * (-1.f / 3628800.f)))));
+}
+
+/// Sine and cosine of any angle up to about 1e4 in magnitude. Reduces x by the nearest multiple of pi into
+/// [-pi / 2, pi / 2] and flips both signs for odd multiples. Absolute error below 5e-6.
+/// - Parameters:
+///   - x: Angle in radians.
+///   - s: Resulting sine.
+///   - c: Resulting cosine.
+inline void fastSinCosAnyAngle(const float x, float &s, float &c) {
+    const auto t = x * 0.31830988f; // 1 / pi
+    const auto k = static_cast<std::int32_t>(t + (t >= 0.f ? 0.5f : -0.5f));
+    const auto kf = static_cast<float>(k);
+    const auto r = (x - kf * 3.140625f) - kf * 9.67653589e-4f; // pi split in two, the first part is exact for small k
+    fastSinCos(r, s, c);
+    const auto sign = (k & 1) ? -1.f : 1.f;
+    s *= sign;
+    c *= sign;
+}
+
+/// Angle of the point (x, y), like std::atan2 but returns 0 for the origin. Branchless, absolute error below 3e-7.
+/// - Parameters:
+///   - y: Imaginary part, or y coordinate.
+///   - x: Real part, or x coordinate.
+inline float fastAtan2(const float y, const float x) {
+    const auto ax = std::abs(x);
+    const auto ay = std::abs(y);
+    const auto hi = ax > ay ? ax : ay;
+    const auto lo = ax > ay ? ay : ax;
+    auto t = lo / (hi > std::numeric_limits<float>::min() ? hi : std::numeric_limits<float>::min()); // [0, 1]
+
+    // atan(t) = pi / 4 + atan((t - 1) / (t + 1)), keeps the series argument below tan(pi / 8)
+    const auto reduce = t > 0.41421356f;
+    const auto offset = reduce ? 0.78539816f : 0.f;
+    t = reduce ? (t - 1.f) / (t + 1.f) : t;
+    const auto z = t * t;
+    auto a = offset + t + t * z * (-0.33332949f + z * (0.19977711f + z * (-0.13877686f + z * 0.08053745f)));
+
+    a = ay > ax ? 1.57079633f - a : a;
+    a = x < 0.f ? 3.14159265f - a : a;
+    return y < 0.f ? -a : a;
+}
+} // namespace dsp::helpers
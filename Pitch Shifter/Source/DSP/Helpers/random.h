@@ -0,0 +1,119 @@
+#pragma once
+#include "fastmath.h"
+#include <JuceHeader.h>
+#include <cstdint>
+#include <random>
+
+namespace dsp::helpers {
+/// Gaussian random numbers generated a block at a time. Runs independent xoshiro128** generators in lanes laid out
+/// next to each other, so every step of the generator and of the Box-Muller transform is a loop over lanes the
+/// compiler can turn into SIMD instructions.
+class GaussianRandom {
+  public:
+    GaussianRandom() { setSeed((static_cast<std::uint64_t>(std::random_device{}()) << 32) | std::random_device{}()); }
+    explicit GaussianRandom(const std::uint64_t seed) { setSeed(seed); }
+
+    /// Restarts all lanes from a seed. The same seed always produces the same sequence.
+    /// - Parameter seed: Any value, zero included.
+    void setSeed(std::uint64_t seed) {
+        for (auto l = 0; l < lanes; l++) {
+            for (auto i = 0; i < 4; i++) {
+                // splitmix64, never leaves a lane in the all zero state
+                auto z = (seed += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                state[i][l] = static_cast<std::uint32_t>((z ^ (z >> 31)) >> 32);
+            }
+        }
+        numLeft = 0;
+    }
+
+    /// Fills a buffer with normally distributed values (mean 0, stddev 1).
+    /// - Parameters:
+    ///   - dest: Destination buffer.
+    ///   - size: Number of values.
+    /// - Returns: Maximum absolute value written, tracked while generating.
+    float fill(float *dest, const int size) {
+        auto maxAbs = 0.f;
+        auto pos = 0;
+
+        // values left over from the previous call
+        while (numLeft > 0 && pos < size) {
+            const auto value = block[blockSize - numLeft--];
+            dest[pos++] = value;
+            maxAbs = juce::jmax(maxAbs, std::abs(value));
+        }
+
+        alignas(32) float laneMax[lanes]{};
+        while (size - pos >= blockSize) {
+            generateBlock(dest + pos, laneMax);
+            pos += blockSize;
+        }
+        for (auto l = 0; l < lanes; l++)
+            maxAbs = juce::jmax(maxAbs, laneMax[l]);
+
+        // partial block, the rest is kept for the next call
+        if (pos < size) {
+            alignas(32) float blockMax[lanes]{};
+            generateBlock(block, blockMax);
+            numLeft = blockSize;
+            while (pos < size) {
+                const auto value = block[blockSize - numLeft--];
+                dest[pos++] = value;
+                maxAbs = juce::jmax(maxAbs, std::abs(value));
+            }
+        }
+        return maxAbs;
+    }
+
+  private:
+    static constexpr int lanes{8};
+    static constexpr int blockSize{lanes * 2}; // Box-Muller gives two values per lane and step
+
+    static std::uint32_t rotl(const std::uint32_t x, const int k) { return (x << k) | (x >> (32 - k)); }
+
+    /// One xoshiro128** step and Box-Muller transform in every lane.
+    void generateBlock(float *dest, float *laneMax) {
+        alignas(32) std::uint32_t u1[lanes];
+        alignas(32) std::uint32_t u2[lanes];
+        step(u1);
+        step(u2);
+
+        constexpr auto toUnit = 1.f / 16777216.f; // 2^-24
+        for (auto l = 0; l < lanes; l++) {
+            // radius from (0, 1], angle covers the right half plane, the remaining bit mirrors it to the left one
+            const auto uRadius = static_cast<float>(u1[l] >> 8) * toUnit + 0.5f * toUnit;
+            const auto uAngle = static_cast<float>(u2[l] >> 8) * toUnit - 0.5f;
+            const auto mirror = 1.f - 2.f * static_cast<float>((u2[l] >> 7) & 1u);
+
+            const auto radius = std::sqrt(-2.f * fastLog(uRadius));
+            float s, c;
+            fastSinCos(uAngle * juce::MathConstants<float>::pi, s, c);
+
+            const auto z0 = radius * c * mirror;
+            const auto z1 = radius * s;
+            dest[l] = z0;
+            dest[l + lanes] = z1;
+            laneMax[l] = juce::jmax(laneMax[l], std::abs(z0), std::abs(z1));
+        }
+    }
+
+    /// xoshiro128** step of all lanes.
+    void step(std::uint32_t *dest) {
+        for (auto l = 0; l < lanes; l++) {
+            dest[l] = rotl(state[1][l] * 5u, 7) * 9u;
+            const auto t = state[1][l] << 9;
+            state[2][l] ^= state[0][l];
+            state[3][l] ^= state[1][l];
+            state[1][l] ^= state[2][l];
+            state[0][l] ^= state[3][l];
+            state[2][l] ^= t;
+            state[3][l] = rotl(state[3][l], 11);
+        }
+    }
+
+    alignas(32) std::uint32_t state[4][lanes]{};
+    alignas(32) float block[blockSize]{}; // last generated block, used when a fill ends inside it
+    int numLeft{0};                       // values of block not handed out yet
+};
+} // namespace dsp::helpers
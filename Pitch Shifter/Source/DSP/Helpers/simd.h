@@ -0,0 +1,555 @@
+#pragma once
+#include "fastmath.h"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define DSP_HELPERS_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DSP_HELPERS_SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DSP_HELPERS_SIMD_NEON 1
+#endif
+
+// Lane wise float vectors for the complex kernels. NEON needs AArch64 for division, square root and rounding.
+#if DSP_HELPERS_SIMD_AVX || DSP_HELPERS_SIMD_SSE || (DSP_HELPERS_SIMD_NEON && (defined(__aarch64__) || defined(_M_ARM64)))
+#define DSP_HELPERS_SIMD_FLOATS 1
+#endif
+
+namespace dsp::helpers {
+/// Inner product of two float arrays. Unaligned pointers are fine. Uses AVX, SSE2 or NEON when the compiler targets
+/// them, plain loop otherwise.
+/// - Parameters:
+///   - a: First array.
+///   - b: Second array.
+///   - size: Number of elements.
+inline float dotProduct(const float *a, const float *b, const int size) {
+    auto i = 0;
+    auto sum = 0.f;
+
+#if DSP_HELPERS_SIMD_AVX
+    auto acc = _mm256_setzero_ps();
+    for (; i + 8 <= size; i += 8)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    auto acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    acc4 = _mm_add_ps(acc4, _mm_movehl_ps(acc4, acc4));
+    acc4 = _mm_add_ss(acc4, _mm_shuffle_ps(acc4, acc4, 1));
+    sum = _mm_cvtss_f32(acc4);
+#elif DSP_HELPERS_SIMD_SSE
+    auto acc = _mm_setzero_ps();
+    for (; i + 4 <= size; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#elif DSP_HELPERS_SIMD_NEON
+    auto acc = vdupq_n_f32(0.f);
+    for (; i + 4 <= size; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    const auto pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+
+    for (; i < size; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+/// Inner product of two float arrays, summed in double precision. Products of floats are exact in double, so only
+/// the sum rounds, for differences of large nearly equal sums. Uses AVX or SSE2 when the compiler targets them, plain
+/// loop otherwise.
+/// - Parameters:
+///   - a: First array.
+///   - b: Second array.
+///   - size: Number of elements.
+inline double dotProductDouble(const float *a, const float *b, const int size) {
+    auto i = 0;
+    auto sum = 0.0;
+
+#if DSP_HELPERS_SIMD_AVX
+    auto acc = _mm256_setzero_pd();
+    for (; i + 4 <= size; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i)),
+                                               _mm256_cvtps_pd(_mm_loadu_ps(b + i))));
+    auto acc2 = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    acc2 = _mm_add_sd(acc2, _mm_unpackhi_pd(acc2, acc2));
+    sum = _mm_cvtsd_f64(acc2);
+#elif DSP_HELPERS_SIMD_SSE
+    auto accLow = _mm_setzero_pd();
+    auto accHigh = _mm_setzero_pd();
+    for (; i + 4 <= size; i += 4) {
+        const auto x = _mm_loadu_ps(a + i);
+        const auto y = _mm_loadu_ps(b + i);
+        accLow = _mm_add_pd(accLow, _mm_mul_pd(_mm_cvtps_pd(x), _mm_cvtps_pd(y)));
+        accHigh = _mm_add_pd(accHigh, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), _mm_cvtps_pd(_mm_movehl_ps(y, y))));
+    }
+    auto acc2 = _mm_add_pd(accLow, accHigh);
+    acc2 = _mm_add_sd(acc2, _mm_unpackhi_pd(acc2, acc2));
+    sum = _mm_cvtsd_f64(acc2);
+#endif
+
+    for (; i < size; i++)
+        sum += static_cast<double>(a[i]) * b[i];
+    return sum;
+}
+
+#if DSP_HELPERS_SIMD_FLOATS
+/// Thin wrappers over the float vector intrinsics, so the kernels below are written once for every instruction set.
+namespace simd {
+#if DSP_HELPERS_SIMD_AVX
+using Floats = __m256;
+using Mask = __m256;
+constexpr int numLanes{8};
+inline Floats load(const float *p) { return _mm256_loadu_ps(p); }
+inline void store(float *p, const Floats x) { _mm256_storeu_ps(p, x); }
+inline Floats splat(const float x) { return _mm256_set1_ps(x); }
+inline Floats add(const Floats a, const Floats b) { return _mm256_add_ps(a, b); }
+inline Floats sub(const Floats a, const Floats b) { return _mm256_sub_ps(a, b); }
+inline Floats mul(const Floats a, const Floats b) { return _mm256_mul_ps(a, b); }
+inline Floats div(const Floats a, const Floats b) { return _mm256_div_ps(a, b); }
+inline Floats sqrt(const Floats x) { return _mm256_sqrt_ps(x); }
+inline Floats min(const Floats a, const Floats b) { return _mm256_min_ps(a, b); }
+inline Floats max(const Floats a, const Floats b) { return _mm256_max_ps(a, b); }
+inline Floats abs(const Floats x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), x); }
+inline Floats round(const Floats x) { return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+inline Mask greater(const Floats a, const Floats b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline Floats select(const Mask m, const Floats a, const Floats b) { return _mm256_blendv_ps(b, a, m); }
+inline std::uint32_t bits(const Mask m) { return static_cast<std::uint32_t>(_mm256_movemask_ps(m)); }
+inline Floats broadcastFirst(const Floats x) {
+    const auto low = _mm256_permute_ps(x, 0x00);
+    return _mm256_permute2f128_ps(low, low, 0x00);
+}
+inline Floats broadcastLast(const Floats x) {
+    const auto high = _mm256_permute_ps(x, 0xff);
+    return _mm256_permute2f128_ps(high, high, 0x11);
+}
+inline float first(const Floats x) { return _mm256_cvtss_f32(x); }
+
+/// Loads numLanes interleaved complex numbers as real and imaginary parts.
+inline void loadComplex(const float *p, Floats &re, Floats &im) {
+    const auto a = _mm256_loadu_ps(p);
+    const auto b = _mm256_loadu_ps(p + 8);
+    const auto lo = _mm256_permute2f128_ps(a, b, 0x20);
+    const auto hi = _mm256_permute2f128_ps(a, b, 0x31);
+    re = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    im = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+/// Stores real and imaginary parts as numLanes interleaved complex numbers.
+inline void storeComplex(float *p, const Floats re, const Floats im) {
+    const auto lo = _mm256_unpacklo_ps(re, im);
+    const auto hi = _mm256_unpackhi_ps(re, im);
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+#elif DSP_HELPERS_SIMD_SSE
+using Floats = __m128;
+using Mask = __m128;
+constexpr int numLanes{4};
+inline Floats load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, const Floats x) { _mm_storeu_ps(p, x); }
+inline Floats splat(const float x) { return _mm_set1_ps(x); }
+inline Floats add(const Floats a, const Floats b) { return _mm_add_ps(a, b); }
+inline Floats sub(const Floats a, const Floats b) { return _mm_sub_ps(a, b); }
+inline Floats mul(const Floats a, const Floats b) { return _mm_mul_ps(a, b); }
+inline Floats div(const Floats a, const Floats b) { return _mm_div_ps(a, b); }
+inline Floats sqrt(const Floats x) { return _mm_sqrt_ps(x); }
+inline Floats min(const Floats a, const Floats b) { return _mm_min_ps(a, b); }
+inline Floats max(const Floats a, const Floats b) { return _mm_max_ps(a, b); }
+inline Floats abs(const Floats x) { return _mm_andnot_ps(_mm_set1_ps(-0.f), x); }
+inline Floats round(const Floats x) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(x)); } // SSE2 has no round instruction
+inline Mask greater(const Floats a, const Floats b) { return _mm_cmpgt_ps(a, b); }
+inline Floats select(const Mask m, const Floats a, const Floats b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+inline std::uint32_t bits(const Mask m) { return static_cast<std::uint32_t>(_mm_movemask_ps(m)); }
+inline Floats broadcastFirst(const Floats x) { return _mm_shuffle_ps(x, x, 0x00); }
+inline Floats broadcastLast(const Floats x) { return _mm_shuffle_ps(x, x, 0xff); }
+inline float first(const Floats x) { return _mm_cvtss_f32(x); }
+
+/// Loads numLanes interleaved complex numbers as real and imaginary parts.
+inline void loadComplex(const float *p, Floats &re, Floats &im) {
+    const auto a = _mm_loadu_ps(p);
+    const auto b = _mm_loadu_ps(p + 4);
+    re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+/// Stores real and imaginary parts as numLanes interleaved complex numbers.
+inline void storeComplex(float *p, const Floats re, const Floats im) {
+    _mm_storeu_ps(p, _mm_unpacklo_ps(re, im));
+    _mm_storeu_ps(p + 4, _mm_unpackhi_ps(re, im));
+}
+#else
+using Floats = float32x4_t;
+using Mask = uint32x4_t;
+constexpr int numLanes{4};
+inline Floats load(const float *p) { return vld1q_f32(p); }
+inline void store(float *p, const Floats x) { vst1q_f32(p, x); }
+inline Floats splat(const float x) { return vdupq_n_f32(x); }
+inline Floats add(const Floats a, const Floats b) { return vaddq_f32(a, b); }
+inline Floats sub(const Floats a, const Floats b) { return vsubq_f32(a, b); }
+inline Floats mul(const Floats a, const Floats b) { return vmulq_f32(a, b); }
+inline Floats div(const Floats a, const Floats b) { return vdivq_f32(a, b); }
+inline Floats sqrt(const Floats x) { return vsqrtq_f32(x); }
+inline Floats min(const Floats a, const Floats b) { return vminq_f32(a, b); }
+inline Floats max(const Floats a, const Floats b) { return vmaxq_f32(a, b); }
+inline Floats abs(const Floats x) { return vabsq_f32(x); }
+inline Floats round(const Floats x) { return vrndnq_f32(x); }
+inline Mask greater(const Floats a, const Floats b) { return vcgtq_f32(a, b); }
+inline Floats select(const Mask m, const Floats a, const Floats b) { return vbslq_f32(m, a, b); }
+inline std::uint32_t bits(const Mask m) {
+    static const std::int32_t shifts[4]{0, 1, 2, 3};
+    return vaddvq_u32(vshlq_u32(vshrq_n_u32(m, 31), vld1q_s32(shifts)));
+}
+inline Floats broadcastFirst(const Floats x) { return vdupq_laneq_f32(x, 0); }
+inline Floats broadcastLast(const Floats x) { return vdupq_laneq_f32(x, 3); }
+inline float first(const Floats x) { return vgetq_lane_f32(x, 0); }
+
+/// Loads numLanes interleaved complex numbers as real and imaginary parts.
+inline void loadComplex(const float *p, Floats &re, Floats &im) {
+    const auto z = vld2q_f32(p);
+    re = z.val[0];
+    im = z.val[1];
+}
+
+/// Stores real and imaginary parts as numLanes interleaved complex numbers.
+inline void storeComplex(float *p, const Floats re, const Floats im) {
+    float32x4x2_t z;
+    z.val[0] = re;
+    z.val[1] = im;
+    vst2q_f32(p, z);
+}
+#endif
+
+/// Lane wise fastSinCosAnyAngle.
+inline void sinCos(const Floats x, Floats &s, Floats &c) {
+    const auto k = round(mul(x, splat(0.31830988f)));
+    const auto r = sub(sub(x, mul(k, splat(3.140625f))), mul(k, splat(9.67653589e-4f)));
+    const auto x2 = mul(r, r);
+
+    auto ps = add(splat(-1.f / 5040.f), mul(x2, splat(1.f / 362880.f)));
+    ps = add(splat(1.f / 120.f), mul(x2, ps));
+    ps = add(splat(-1.f / 6.f), mul(x2, ps));
+    ps = mul(r, add(splat(1.f), mul(x2, ps)));
+    auto pc = add(splat(1.f / 40320.f), mul(x2, splat(-1.f / 3628800.f)));
+    pc = add(splat(-1.f / 720.f), mul(x2, pc));
+    pc = add(splat(1.f / 24.f), mul(x2, pc));
+    pc = add(splat(-0.5f), mul(x2, pc));
+    pc = add(splat(1.f), mul(x2, pc));
+
+    // odd multiples of pi flip both signs, |k - 2 * round(k / 2)| is 1 for odd k and 0 for even k
+    const auto odd = abs(sub(k, mul(splat(2.f), round(mul(k, splat(0.5f))))));
+    const auto sign = sub(splat(1.f), mul(splat(2.f), odd));
+    s = mul(ps, sign);
+    c = mul(pc, sign);
+}
+
+/// Lane wise fastAtan2.
+inline Floats atan2(const Floats y, const Floats x) {
+    const auto zero = splat(0.f);
+    const auto ax = abs(x);
+    const auto ay = abs(y);
+    auto t = div(min(ax, ay), max(max(ax, ay), splat(std::numeric_limits<float>::min())));
+
+    const auto reduce = greater(t, splat(0.41421356f));
+    const auto offset = select(reduce, splat(0.78539816f), zero);
+    t = select(reduce, div(sub(t, splat(1.f)), add(t, splat(1.f))), t);
+    const auto z = mul(t, t);
+    auto p = add(splat(-0.13877686f), mul(z, splat(0.08053745f)));
+    p = add(splat(0.19977711f), mul(z, p));
+    p = add(splat(-0.33332949f), mul(z, p));
+    auto a = add(offset, add(t, mul(mul(t, z), p)));
+
+    a = select(greater(ay, ax), sub(splat(1.57079633f), a), a);
+    a = select(greater(zero, x), sub(splat(3.14159265f), a), a);
+    return select(greater(zero, y), sub(zero, a), a);
+}
+} // namespace simd
+#endif
+
+// Complex kernels work on interleaved real and imaginary floats, the layout of std::complex<float>. Outputs may alias
+// the inputs.
+
+/// Complex product a * b, element by element.
+/// - Parameters:
+///   - a: First complex array.
+///   - b: Second complex array.
+///   - out: Products.
+///   - size: Number of complex elements.
+inline void complexMultiply(const float *a, const float *b, float *out, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats aRe, aIm, bRe, bIm;
+        simd::loadComplex(a + 2 * i, aRe, aIm);
+        simd::loadComplex(b + 2 * i, bRe, bIm);
+        simd::storeComplex(out + 2 * i, simd::sub(simd::mul(aRe, bRe), simd::mul(aIm, bIm)),
+                           simd::add(simd::mul(aRe, bIm), simd::mul(aIm, bRe)));
+    }
+#endif
+    for (; i < size; i++) {
+        const auto re = a[2 * i] * b[2 * i] - a[2 * i + 1] * b[2 * i + 1];
+        const auto im = a[2 * i] * b[2 * i + 1] + a[2 * i + 1] * b[2 * i];
+        out[2 * i] = re;
+        out[2 * i + 1] = im;
+    }
+}
+
+/// Complex product with the conjugate a * conj(b), element by element. The phase difference from b to a.
+/// - Parameters:
+///   - a: First complex array.
+///   - b: Second complex array, conjugated.
+///   - out: Products.
+///   - size: Number of complex elements.
+inline void complexMultiplyConjugate(const float *a, const float *b, float *out, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats aRe, aIm, bRe, bIm;
+        simd::loadComplex(a + 2 * i, aRe, aIm);
+        simd::loadComplex(b + 2 * i, bRe, bIm);
+        simd::storeComplex(out + 2 * i, simd::add(simd::mul(aRe, bRe), simd::mul(aIm, bIm)),
+                           simd::sub(simd::mul(aIm, bRe), simd::mul(aRe, bIm)));
+    }
+#endif
+    for (; i < size; i++) {
+        const auto re = a[2 * i] * b[2 * i] + a[2 * i + 1] * b[2 * i + 1];
+        const auto im = a[2 * i + 1] * b[2 * i] - a[2 * i] * b[2 * i + 1];
+        out[2 * i] = re;
+        out[2 * i + 1] = im;
+    }
+}
+
+/// Angles of complex numbers in (-pi, pi], like std::arg, with fastAtan2 accuracy.
+/// - Parameters:
+///   - z: Complex array.
+///   - angles: Resulting angles, one float per element.
+///   - size: Number of complex elements.
+inline void complexAngles(const float *z, float *angles, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats re, im;
+        simd::loadComplex(z + 2 * i, re, im);
+        simd::store(angles + i, simd::atan2(im, re));
+    }
+#endif
+    for (; i < size; i++)
+        angles[i] = fastAtan2(z[2 * i + 1], z[2 * i]);
+}
+
+/// Complex numbers from magnitudes and angles, like std::polar, with fastSinCosAnyAngle accuracy.
+/// - Parameters:
+///   - magnitudes: Magnitudes.
+///   - angles: Angles in radians.
+///   - out: Resulting complex array.
+///   - size: Number of complex elements.
+inline void polar(const float *magnitudes, const float *angles, float *out, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats s, c;
+        simd::sinCos(simd::load(angles + i), s, c);
+        const auto magnitude = simd::load(magnitudes + i);
+        simd::storeComplex(out + 2 * i, simd::mul(magnitude, c), simd::mul(magnitude, s));
+    }
+#endif
+    for (; i < size; i++) {
+        float s, c;
+        fastSinCosAnyAngle(angles[i], s, c);
+        out[2 * i] = magnitudes[i] * c;
+        out[2 * i + 1] = magnitudes[i] * s;
+    }
+}
+
+/// Multiplies the angles of complex numbers by a factor and keeps their magnitudes. Stretches phase rotations in time.
+/// - Parameters:
+///   - z: Complex array.
+///   - out: Resulting complex array.
+///   - factor: Angle multiplier.
+///   - size: Number of complex elements.
+inline void scaleComplexAngles(const float *z, float *out, const float factor, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats re, im, s, c;
+        simd::loadComplex(z + 2 * i, re, im);
+        const auto magnitude = simd::sqrt(simd::add(simd::mul(re, re), simd::mul(im, im)));
+        simd::sinCos(simd::mul(simd::atan2(im, re), simd::splat(factor)), s, c);
+        simd::storeComplex(out + 2 * i, simd::mul(magnitude, c), simd::mul(magnitude, s));
+    }
+#endif
+    for (; i < size; i++) {
+        const auto re = z[2 * i];
+        const auto im = z[2 * i + 1];
+        const auto magnitude = std::sqrt(re * re + im * im);
+        float s, c;
+        fastSinCosAnyAngle(fastAtan2(im, re) * factor, s, c);
+        out[2 * i] = magnitude * c;
+        out[2 * i + 1] = magnitude * s;
+    }
+}
+
+/// Number of zero bits below the lowest set bit. Undefined for 0.
+inline int countTrailingZeros(const std::uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+/// Bit mask of a[i] > b[i], bit i % 32 of word i / 32. Bits past size are cleared. Lets callers find runs of matching
+/// elements with bit operations instead of a branch per element.
+/// - Parameters:
+///   - a: First array.
+///   - b: Second array.
+///   - mask: (size + 31) / 32 words.
+///   - size: Number of elements.
+inline void compareGreater(const float *a, const float *b, std::uint32_t *mask, const int size) {
+    for (auto word = 0; word * 32 < size; word++) {
+        const auto start = word * 32;
+        const auto end = start + 32 < size ? start + 32 : size;
+        std::uint32_t bits = 0;
+        auto i = start;
+#if DSP_HELPERS_SIMD_FLOATS
+        for (; i + simd::numLanes <= end; i += simd::numLanes)
+            bits |= simd::bits(simd::greater(simd::load(a + i), simd::load(b + i))) << (i - start);
+#endif
+        for (; i < end; i++)
+            bits |= static_cast<std::uint32_t>(a[i] > b[i]) << (i - start);
+        mask[word] = bits;
+    }
+}
+
+/// In place one pole lowpass, state += (x - state) * slew for every element in order. Runs a block of elements per
+/// step, with every output of the block a weighted sum of the block inputs and the incoming state, so only the state
+/// is carried from block to block.
+/// - Parameters:
+///   - data: Elements to smooth.
+///   - size: Number of elements.
+///   - slew: Smoothing coefficient in (0, 1].
+///   - state: Filter state, carried in and out.
+inline void smoothForward(float *data, const int size, const float slew, float &state) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    constexpr auto n = simd::numLanes;
+    if (size >= n) {
+        // output k of a block: decay^(k + 1) * state + sum over j <= k of slew * decay^(k - j) * input j
+        const auto decay = 1.f - slew;
+        float weights[n][n], carry[n];
+        for (auto j = 0; j < n; j++) {
+            auto w = slew;
+            for (auto k = 0; k < n; k++) {
+                weights[j][k] = k < j ? 0.f : w;
+                if (k >= j) w *= decay;
+            }
+            carry[j] = j == 0 ? decay : carry[j - 1] * decay;
+        }
+        const auto carryWeights = simd::load(carry);
+        auto carried = simd::splat(state);
+        for (; i + n <= size; i += n) {
+            auto y = simd::mul(simd::load(weights[0]), simd::splat(data[i]));
+            for (auto j = 1; j < n; j++)
+                y = simd::add(y, simd::mul(simd::load(weights[j]), simd::splat(data[i + j])));
+            y = simd::add(y, simd::mul(carryWeights, carried)); // only this depends on the previous block
+            simd::store(data + i, y);
+            carried = simd::broadcastLast(y);
+        }
+        state = simd::first(carried);
+    }
+#endif
+    for (; i < size; i++) {
+        state += (data[i] - state) * slew;
+        data[i] = state;
+    }
+}
+
+/// Same as smoothForward, running from the last element to the first.
+/// - Parameters:
+///   - data: Elements to smooth.
+///   - size: Number of elements.
+///   - slew: Smoothing coefficient in (0, 1].
+///   - state: Filter state, carried in and out.
+inline void smoothBackward(float *data, const int size, const float slew, float &state) {
+    auto i = size;
+#if DSP_HELPERS_SIMD_FLOATS
+    constexpr auto n = simd::numLanes;
+    for (; i % n != 0; i--) { // leftover elements at the top, so the blocks below start on multiples of n
+        state += (data[i - 1] - state) * slew;
+        data[i - 1] = state;
+    }
+    if (i > 0) {
+        // output k of a block: decay^(n - k) * state + sum over j >= k of slew * decay^(j - k) * input j
+        const auto decay = 1.f - slew;
+        float weights[n][n], carry[n];
+        for (auto j = n - 1; j >= 0; j--) {
+            auto w = slew;
+            for (auto k = n - 1; k >= 0; k--) {
+                weights[j][k] = k > j ? 0.f : w;
+                if (k <= j) w *= decay;
+            }
+            carry[j] = j == n - 1 ? decay : carry[j + 1] * decay;
+        }
+        const auto carryWeights = simd::load(carry);
+        auto carried = simd::splat(state);
+        for (; i > 0; i -= n) {
+            auto y = simd::mul(simd::load(weights[0]), simd::splat(data[i - n]));
+            for (auto j = 1; j < n; j++)
+                y = simd::add(y, simd::mul(simd::load(weights[j]), simd::splat(data[i - n + j])));
+            y = simd::add(y, simd::mul(carryWeights, carried)); // only this depends on the previous block
+            simd::store(data + i - n, y);
+            carried = simd::broadcastFirst(y);
+        }
+        state = simd::first(carried);
+    }
+#endif
+    for (; i > 0; i--) {
+        state += (data[i - 1] - state) * slew;
+        data[i - 1] = state;
+    }
+}
+
+/// Rescales complex numbers to the square root of the given energies, times a gain, keeping their phases. Elements
+/// with zero magnitude come out as zero, callers wanting a fallback phase patch those afterwards.
+/// - Parameters:
+///   - phases: Complex array giving the phases.
+///   - energies: Target squared magnitudes.
+///   - out: Resulting complex array.
+///   - gain: Magnitude multiplier.
+///   - size: Number of complex elements.
+inline void normaliseComplex(const float *phases, const float *energies, float *out, const float gain, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    const auto zero = simd::splat(0.f);
+    const auto tiny = simd::splat(std::numeric_limits<float>::min());
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        simd::Floats re, im;
+        simd::loadComplex(phases + 2 * i, re, im);
+        const auto norm = simd::add(simd::mul(re, re), simd::mul(im, im));
+        const auto scale = simd::mul(simd::sqrt(simd::div(simd::load(energies + i), simd::max(norm, tiny))),
+                                     simd::splat(gain));
+        const auto masked = simd::select(simd::greater(norm, zero), scale, zero);
+        simd::storeComplex(out + 2 * i, simd::mul(re, masked), simd::mul(im, masked));
+    }
+#endif
+    for (; i < size; i++) {
+        const auto re = phases[2 * i];
+        const auto im = phases[2 * i + 1];
+        const auto norm = re * re + im * im;
+        const auto scale = norm > 0.f ? std::sqrt(energies[i] / norm) * gain : 0.f;
+        out[2 * i] = re * scale;
+        out[2 * i + 1] = im * scale;
+    }
+}
+} // namespace dsp::helpers
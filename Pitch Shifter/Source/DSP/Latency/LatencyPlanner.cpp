@@ -0,0 +1,133 @@
+#include "LatencyPlanner.h"
+
+void dsp::LatencyPlanner::prepare(const double newSampleRate) {
+    sampleRate = newSampleRate;
+}
+
+void dsp::LatencyPlanner::setOverlap(const int newOverlap) {
+    overlap = newOverlap;
+}
+
+void dsp::LatencyPlanner::setFusedSines(const bool shouldUseFusedSines) {
+    fusedSines = shouldUseFusedSines;
+}
+
+void dsp::LatencyPlanner::setSinesEngine(const SinesShiftEngine::Type newSinesEngine) {
+    sinesEngine = newSinesEngine;
+}
+
+void dsp::LatencyPlanner::setNoiseFeed(const bool shouldUseNoiseFeed) {
+    noiseFeed = shouldUseNoiseFeed;
+}
+
+void dsp::LatencyPlanner::evaluate(LatencyPlan &plan) const {
+    plan.latencySTN = DecomposeSTN::getLatencyFor(plan.fftSizeS, plan.fftSizeTN, plan.parallelSTN);
+    plan.latencySines = fusedSines ? 0 : SinesShiftEngine::getLatencyFor(sinesEngine, plan.stretchBlockSamples);
+    plan.latencyNoise = NoiseMorphing::getLatencyFor(plan.noiseFFTSize, noiseFeed ? plan.fftSizeTN : 0);
+    plan.latencyTotal = plan.latencySTN + juce::jmax(plan.latencySines, plan.latencyNoise);
+
+    // Per sample cost of an FFT of size n at hop n / o is o * log2(n). Median filters cost their length per bin and
+    // frame, which is o * length per sample.
+    const auto sr = static_cast<float>(sampleRate);
+    const auto stnRound = [this, sr](const int size, const int numTransforms) {
+        const auto ovl = static_cast<float>(overlap);
+        const auto filterTime = juce::jmax(3.f, 0.05f * sr * ovl / size);
+        const auto filterFreq = juce::jmax(3.f, 500.f * size / sr);
+        return ovl * (numTransforms * std::log2(static_cast<float>(size)) + filterTime + filterFreq);
+    };
+    // Cascaded: forward and two inverse transforms in both rounds. Parallel: round 1 only analyses, round 2 synthesises
+    // S as well.
+    const auto costSTN = plan.parallelSTN ? stnRound(plan.fftSizeS, 1) + stnRound(plan.fftSizeTN, 4)
+                                          : stnRound(plan.fftSizeS, 3) + stnRound(plan.fftSizeTN, 3);
+    // Noise morphing: up to two synthesised frames per hop of fftSize / 2, noise and inverse transform each
+    const auto costNoise = 8.f * std::log2(static_cast<float>(plan.noiseFFTSize));
+    // Stretch: forward and inverse transform of a block every interval
+    const auto costSines =
+        fusedSines ? 0.f : 2.f * stretchIntervals * std::log2(static_cast<float>(plan.stretchBlockSamples));
+    plan.cost = costSTN + costNoise + costSines;
+}
+
+int dsp::LatencyPlanner::getMaxLatency() const {
+    const auto fftSizeS = fftSizesS[std::size(fftSizesS) - 1];
+    const auto blockSamples = static_cast<int>(stretchBlocksMs[std::size(stretchBlocksMs) - 1] * 0.001 * sampleRate);
+
+    auto latencySines = 0;
+    for (auto type = 0; type < static_cast<int>(SinesShiftEngine::Type::numTypes); type++) {
+        const auto engineLatency = SinesShiftEngine::getLatencyFor(static_cast<SinesShiftEngine::Type>(type), blockSamples);
+        latencySines = juce::jmax(latencySines, engineLatency);
+    }
+    const auto latencyNoise = NoiseMorphing::getLatencyFor(NoiseMorphing::maxFFTSize, 0);
+    const auto latencySTN = DecomposeSTN::getLatencyFor(fftSizeS, fftSizeS / fftSizeRatioTN, false);
+
+    return latencySTN + juce::jmax(latencySines, latencyNoise);
+}
+
+float dsp::LatencyPlanner::quality(const LatencyPlan &plan) const {
+    auto score = std::log2(static_cast<float>(plan.fftSizeS)) + std::log2(static_cast<float>(plan.noiseFFTSize));
+    if (!plan.parallelSTN)
+        score += 2.f; // cascaded separation is worth more than a doubled FFT size in parallel mode
+    if (!fusedSines)
+        score += std::log2(static_cast<float>(plan.stretchBlockSamples));
+    return score;
+}
+
+dsp::LatencyPlan dsp::LatencyPlanner::plan(const double targetMs) const {
+    const auto budget = static_cast<int>(targetMs * 0.001 * sampleRate);
+
+    LatencyPlan best;
+    LatencyPlan fastest;
+    auto bestQuality = -1.f;
+    auto found = false;
+    auto first = true;
+
+    for (const auto fftSizeS : fftSizesS) {
+        for (const auto parallelSTN : {false, true}) {
+            for (const auto blockMs : stretchBlocksMs) {
+                for (const auto noiseFFTSize : noiseFFTSizes) {
+                    LatencyPlan candidate;
+                    candidate.fftSizeS = fftSizeS;
+                    candidate.fftSizeTN = fftSizeS / fftSizeRatioTN;
+                    candidate.parallelSTN = parallelSTN;
+                    candidate.stretchBlockSamples = static_cast<int>(blockMs * 0.001 * sampleRate);
+                    candidate.stretchIntervalSamples = candidate.stretchBlockSamples / stretchIntervals;
+                    candidate.noiseFFTSize = noiseFFTSize;
+                    evaluate(candidate);
+
+                    if (first || candidate.latencyTotal < fastest.latencyTotal ||
+                        (candidate.latencyTotal == fastest.latencyTotal && candidate.cost < fastest.cost)) {
+                        fastest = candidate;
+                        first = false;
+                    }
+
+                    if (candidate.latencyTotal > budget)
+                        continue;
+
+                    const auto candidateQuality = quality(candidate);
+                    if (!found || candidateQuality > bestQuality ||
+                        (candidateQuality == bestQuality && candidate.cost < best.cost)) {
+                        best = candidate;
+                        bestQuality = candidateQuality;
+                        found = true;
+                    }
+                }
+            }
+        }
+    }
+
+    if (found)
+        return best;
+
+    fastest.withinBudget = false;
+    return fastest;
+}
+
+juce::String dsp::LatencyPlanner::describe(const LatencyPlan &plan) const {
+    const auto toMs = [this](const int samples) { return juce::String(samples * 1000. / sampleRate, 1) + " ms"; };
+
+    return "STN " + juce::String(plan.fftSizeS) + "/" + juce::String(plan.fftSizeTN) +
+           (plan.parallelSTN ? " parallel: " : " cascaded: ") + toMs(plan.latencySTN) + " | Sines " +
+           (fusedSines ? juce::String("fused") : "block " + juce::String(plan.stretchBlockSamples)) + ": " +
+           toMs(plan.latencySines) + " | Noise FFT " + juce::String(plan.noiseFFTSize) + ": " +
+           toMs(plan.latencyNoise) + " | Total: " + toMs(plan.latencyTotal) +
+           (plan.withinBudget ? "" : " (over budget)");
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "../NM/NoiseMorphing.h"
+#include "../PS/SinesShiftEngine.h"
+#include "../STN/decomposeSTN.h"
+#include <JuceHeader.h>
+
+namespace dsp {
+/// Configuration of all latency relevant stages, together with the latency it results in.
+struct LatencyPlan {
+    int fftSizeS{2048};
+    int fftSizeTN{512};
+    bool parallelSTN{false};
+    int stretchBlockSamples{2205};
+    int stretchIntervalSamples{551};
+    int noiseFFTSize{2048};
+
+    int latencySTN{0};   // decomposition
+    int latencySines{0}; // sines engine, 0 with fused sines
+    int latencyNoise{0}; // noise morphing
+    int latencyTotal{0}; // decomposition plus the slower of sines and noise
+    float cost{0.f};     // relative CPU estimate, only meaningful compared to other plans
+    bool withinBudget{true};
+
+    bool operator==(const LatencyPlan &other) const {
+        return fftSizeS == other.fftSizeS && fftSizeTN == other.fftSizeTN && parallelSTN == other.parallelSTN &&
+               stretchBlockSamples == other.stretchBlockSamples &&
+               stretchIntervalSamples == other.stretchIntervalSamples && noiseFFTSize == other.noiseFFTSize &&
+               latencyTotal == other.latencyTotal;
+    }
+    bool operator!=(const LatencyPlan &other) const { return !(*this == other); }
+};
+
+/// Picks STN FFT sizes and mode, stretch block and noise morphing FFT size for a latency budget. Of all
+/// configurations under the budget the one with the best expected quality is chosen (larger FFTs, cascaded STN,
+/// longer stretch blocks), ties go to the lower CPU estimate. If nothing fits, the lowest latency configuration is
+/// returned and marked as over budget.
+/// Quality comes first rather than CPU: the cheapest configuration is the one with the smallest FFTs and blocks for
+/// every budget, so a lowest CPU search would not use the latency it is given. CPU pressure is handled at run time by
+/// the CPU governor.
+class LatencyPlanner {
+  public:
+    LatencyPlanner() = default;
+    ~LatencyPlanner() = default;
+
+    /// - Parameter newSampleRate: Sample rate the plans are made for.
+    void prepare(const double newSampleRate);
+
+    /// - Parameter newOverlap: STN overlap, only changes the CPU estimate.
+    void setOverlap(const int newOverlap);
+
+    /// - Parameter shouldUseFusedSines: With fused sines, the stretch is not used and adds no latency.
+    void setFusedSines(const bool shouldUseFusedSines);
+
+    /// - Parameter newSinesEngine: Engine the sines are shifted with, its latency depends on the algorithm.
+    void setSinesEngine(const SinesShiftEngine::Type newSinesEngine);
+
+    /// - Parameter shouldUseNoiseFeed: True when NoiseMorphing reads the noise spectrum from DecomposeSTN.
+    void setNoiseFeed(const bool shouldUseNoiseFeed);
+
+    /// Fills latencies and CPU estimate of a configuration.
+    /// - Parameter plan: Plan with the configuration filled in.
+    void evaluate(LatencyPlan &plan) const;
+
+    /// Best configuration for a latency budget.
+    /// - Parameter targetMs: Latency budget in milliseconds.
+    LatencyPlan plan(const double targetMs) const;
+
+    /// Largest total latency of any plan, manual ones included, for sizing delay buffers: cascaded STN at the largest
+    /// FFT size, then the slowest sines engine at the longest stretch block or noise morphing without the feed.
+    int getMaxLatency() const;
+
+    /// Latency breakdown for logging and display.
+    /// - Parameter plan: Evaluated plan.
+    juce::String describe(const LatencyPlan &plan) const;
+
+  private:
+    /// Expected quality, one point per doubling of an FFT or block size, two for the cascaded STN mode.
+    float quality(const LatencyPlan &plan) const;
+
+    double sampleRate{44100.};
+    int overlap{8};
+    bool fusedSines{false};
+    SinesShiftEngine::Type sinesEngine{SinesShiftEngine::Type::signalsmith};
+    bool noiseFeed{true};
+
+    static constexpr int fftSizesS[]{512, 1024, 2048, 4096};
+    static constexpr int noiseFFTSizes[]{512, 1024, 2048};
+    static constexpr double stretchBlocksMs[]{20., 30., 40., 50.};
+    static constexpr int fftSizeRatioTN{4};   // round 2 FFT size is a quarter of round 1, as set by the processor
+    static constexpr int stretchIntervals{4}; // stretch blocks per interval
+};
+} // namespace dsp
@@ -0,0 +1,37 @@
+#pragma once
+#include "../MedianFilterBase.h"
+#include "SelectionNetwork.h"
+
+namespace dsp::medianfilter {
+/// Same result as HorizontalMedianFilter, for spectra of several streams interleaved bin by bin. Every element is
+/// filtered over time on its own, so the samples size counts the elements of all streams and the layout does not
+/// matter. Runs on a selection network instead of sorting, without a branch per value.
+class LaneHorizontalMedianFilter final : public MedianFilterBase {
+  public:
+    void prepare() override {
+        result.assign(numSamples, 0.f);
+        history.assign(static_cast<size_t>(filterSize) * numSamples, 0.f);
+        rows.resize(filterSize);
+        for (auto i = 0; i < filterSize; i++) rows[i] = history.data() + static_cast<size_t>(i) * numSamples;
+        oldest = 0;
+        network.prepare(filterSize, juce::jmax(0, pad - 1));
+    }
+
+    const Vec1D &process(const Vec1D &x) override {
+        // The selection does not depend on the order of the frames, the newest one replaces the oldest
+        juce::FloatVectorOperations::copy(history.data() + static_cast<size_t>(oldest) * numSamples, x.data(),
+                                          numSamples);
+        oldest = (oldest + 1) % filterSize;
+
+        network.process(rows.data(), result.data(), numSamples);
+        return result;
+    };
+
+  private:
+    Vec1D history; // filterSize frames
+    std::vector<const float *> rows;
+    int oldest{0};
+    SelectionNetwork network;
+};
+
+} // namespace dsp::medianfilter
@@ -0,0 +1,42 @@
+#pragma once
+#include "../MedianFilterBase.h"
+#include "SelectionNetwork.h"
+
+namespace dsp::medianfilter {
+/// Same result as VerticalMedianFilter, for spectra of several streams interleaved bin by bin (bin * numLanes + lane).
+/// Every lane is filtered over its own bins, all lanes at once. Runs on a selection network instead of sorting,
+/// without a branch per value.
+class LaneVerticalMedianFilter final : public MedianFilterBase {
+  public:
+    /// Set number of interleaved streams, the samples size counts the bins of one stream.
+    /// - Parameter newNumLanes: Number of streams.
+    void setNumLanes(const int newNumLanes) {
+        if (numLanes == newNumLanes) return;
+        numLanes = newNumLanes;
+        prepare();
+    }
+
+    void prepare() override {
+        result.assign(static_cast<size_t>(numSamples) * numLanes, 0.f);
+        filter.assign(static_cast<size_t>(numSamples + filterSize) * numLanes, 0.f);
+        rows.resize(filterSize);
+        for (auto i = 0; i < filterSize; i++) rows[i] = filter.data() + static_cast<size_t>(i) * numLanes;
+        network.prepare(filterSize, juce::jmax(0, pad - 1));
+    };
+
+    const Vec1D &process(const Vec1D &x) override {
+        // Bin h of a lane is selected from bins h - pad to h - pad + filterSize - 1, zeros outside the spectrum
+        juce::FloatVectorOperations::copy(filter.data() + static_cast<size_t>(pad) * numLanes, x.data(),
+                                          numSamples * numLanes);
+        network.process(rows.data(), result.data(), numSamples * numLanes);
+        return result;
+    };
+
+  private:
+    int numLanes{1};
+    Vec1D filter; // zero padded spectra
+    std::vector<const float *> rows;
+    SelectionNetwork network;
+};
+
+} // namespace dsp::medianfilter
@@ -0,0 +1,99 @@
+#pragma once
+#include "../../Helpers/simd.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp::medianfilter {
+/// Picks the value of one rank out of a fixed number of values with compare-exchange steps only, min and max without
+/// branches. Built from Batcher's odd-even merge sort: steps touching positions past the number of values are dropped
+/// (those hold +inf and never move), then every step the selected position does not depend on is pruned. Runs on
+/// helpers::simd::numLanes independent selections at once, exactly the value std::nth_element picks.
+class SelectionNetwork {
+  public:
+    /// Builds the steps. Not audio thread safe.
+    /// - Parameters:
+    ///   - newNumValues: Number of values per selection.
+    ///   - newRank: Rank to select, 0 is the smallest value.
+    void prepare(const int newNumValues, const int newRank) {
+        jassert(newNumValues > 0 && newRank >= 0 && newRank < newNumValues);
+        numValues = newNumValues;
+        rank = newRank;
+
+        std::vector<std::pair<int, int>> steps;
+        const auto size = juce::nextPowerOfTwo(numValues);
+        for (auto p = 1; p < size; p *= 2) {
+            for (auto k = p; k >= 1; k /= 2) {
+                for (auto j = k % p; j + k < size; j += 2 * k) {
+                    for (auto i = 0; i < juce::jmin(k, size - j - k); i++) {
+                        const auto a = i + j;
+                        const auto b = i + j + k;
+                        if (a / (2 * p) == b / (2 * p) && b < numValues) steps.emplace_back(a, b);
+                    }
+                }
+            }
+        }
+
+        // Backwards from the selected position, a step matters when it writes a position that is still read later
+        std::vector<bool> needed(static_cast<size_t>(numValues), false);
+        needed[static_cast<size_t>(rank)] = true;
+        pairs.clear();
+        for (auto step = steps.rbegin(); step != steps.rend(); ++step) {
+            if (!needed[static_cast<size_t>(step->first)] && !needed[static_cast<size_t>(step->second)]) continue;
+            needed[static_cast<size_t>(step->first)] = needed[static_cast<size_t>(step->second)] = true;
+            pairs.push_back(*step);
+        }
+        std::reverse(pairs.begin(), pairs.end());
+
+        values.resize(static_cast<size_t>(numValues));
+#if DSP_HELPERS_SIMD_FLOATS
+        lanes.resize(static_cast<size_t>(numValues) * helpers::simd::numLanes);
+#endif
+    }
+
+    int getNumValues() const { return numValues; }
+
+    /// Selects element by element: dest[i] is the value of rank among rows[0][i] ... rows[getNumValues() - 1][i].
+    /// - Parameters:
+    ///   - rows: getNumValues() arrays of size elements.
+    ///   - dest: Selected values, may alias none of the rows.
+    ///   - size: Number of elements.
+    void process(const float *const *rows, float *dest, const int size) {
+        auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+        for (; i + helpers::simd::numLanes <= size; i += helpers::simd::numLanes) {
+            for (auto j = 0; j < numValues; j++) helpers::simd::store(lane(j), helpers::simd::load(rows[j] + i));
+            for (const auto &[a, b] : pairs) {
+                const auto x = helpers::simd::load(lane(a));
+                const auto y = helpers::simd::load(lane(b));
+                helpers::simd::store(lane(a), helpers::simd::min(x, y));
+                helpers::simd::store(lane(b), helpers::simd::max(x, y));
+            }
+            helpers::simd::store(dest + i, helpers::simd::load(lane(rank)));
+        }
+#endif
+        for (; i < size; i++) {
+            for (auto j = 0; j < numValues; j++) values[j] = rows[j][i];
+            for (const auto &[a, b] : pairs) {
+                const auto low = std::min(values[a], values[b]);
+                values[b] = std::max(values[a], values[b]);
+                values[a] = low;
+            }
+            dest[i] = values[rank];
+        }
+    }
+
+  private:
+#if DSP_HELPERS_SIMD_FLOATS
+    float *lane(const int position) { return lanes.data() + static_cast<size_t>(position) * helpers::simd::numLanes; }
+#endif
+
+    int numValues{1};
+    int rank{0};
+    std::vector<std::pair<int, int>> pairs; // compare-exchange steps in order, smaller value to first
+    Vec1D values;                           // one selection, scalar tail
+#if DSP_HELPERS_SIMD_FLOATS
+    Vec1D lanes; // helpers::simd::numLanes selections, position by lane (position * numLanes + lane)
+#endif
+};
+} // namespace dsp::medianfilter
@@ -0,0 +1,96 @@
+#include "NoiseMagnitudeFeed.h"
+
+void dsp::NoiseMagnitudeFeed::prepare(const int newFrameSize, const int newHopSize, const int historySamples,
+                                      const float analysisWindowPower) {
+    frameSize = newFrameSize;
+    hopSize = juce::jmax(1, newHopSize);
+    numBins = frameSize / 2 + 1;
+    capacity = historySamples / hopSize + 2;
+    windowGain = std::sqrt(0.375f / analysisWindowPower);
+
+    power.resize(capacity);
+    for (auto &frame : power) {
+        frame.resize(numBins);
+    }
+    centres.resize(capacity);
+
+    reset();
+}
+
+void dsp::NoiseMagnitudeFeed::reset() {
+    writeIdx = 0;
+    numFrames = 0;
+}
+
+void dsp::NoiseMagnitudeFeed::push(const Vec1D &real, const Vec1D &imag, const juce::int64 startSample) {
+    jassert(real.size() >= numBins);
+    jassert(imag.size() >= numBins);
+    if (capacity == 0)
+        return;
+
+    auto &frame = power[writeIdx];
+    for (auto k = 0; k < numBins; k++) {
+        frame[k] = real[k] * real[k] + imag[k] * imag[k];
+    }
+    centres[writeIdx] = startSample + frameSize / 2;
+
+    if (++writeIdx >= capacity) writeIdx = 0; // circular buffer
+    numFrames = juce::jmin(numFrames + 1, capacity);
+}
+
+bool dsp::NoiseMagnitudeFeed::read(Vec1D &dest, Vec1D &average, const int destFFTSize, const juce::int64 fromSample,
+                                   const juce::int64 toSample) const {
+    jassert(dest.size() >= destFFTSize);
+    jassert(average.size() >= numBins);
+    if (numFrames == 0)
+        return false;
+
+    // Average power of the frames centred in the consumer hop (Welch estimate). If the hop is shorter than the
+    // producer hop, the newest frame centred before its end is used instead.
+    juce::FloatVectorOperations::fill(average.data(), 0.f, numBins);
+    auto numAveraged = 0;
+    auto newest = -1;
+    for (auto i = 1; i <= numFrames; i++) {
+        const auto idx = (writeIdx - i + capacity) % capacity;
+        const auto centre = centres[idx];
+        if (centre > toSample)
+            continue;
+        if (newest < 0)
+            newest = idx;
+        if (centre <= fromSample)
+            break;
+        juce::FloatVectorOperations::add(average.data(), power[idx].data(), numBins);
+        numAveraged++;
+    }
+
+    if (numAveraged > 0) {
+        juce::FloatVectorOperations::multiply(average.data(), 1.f / numAveraged, numBins);
+    } else {
+        const auto closest = newest < 0 ? (writeIdx - numFrames + capacity) % capacity : newest; // oldest if all are ahead
+        juce::FloatVectorOperations::copy(average.data(), power[closest].data(), numBins);
+    }
+
+    // Hann windowed noise has rms magnitude proportional to sqrt(fftSize), expected magnitude of a single frame is
+    // sqrt(pi) / 2 of the rms (Rayleigh distribution). Other producer windows are brought to the Hann level first.
+    const auto ratio = static_cast<float>(frameSize) / static_cast<float>(destFFTSize);
+    const auto scale = windowGain * std::sqrt(1.f / ratio) * std::sqrt(juce::MathConstants<float>::pi) * 0.5f;
+
+    // Linear resampling of the bins to the consumer FFT size
+    const auto destBins = destFFTSize / 2 + 1;
+    const auto lastBin = numBins - 1;
+    for (auto k = 0; k < destBins; k++) {
+        const auto pos = k * ratio;
+        const auto k0 = juce::jmin(static_cast<int>(pos), lastBin);
+        const auto k1 = juce::jmin(k0 + 1, lastBin);
+        const auto frac = pos - k0;
+        const auto pow = average[k0] + frac * (average[k1] - average[k0]);
+        dest[k] = std::sqrt(pow) * scale + magnitudeFloor;
+    }
+
+    // Rebuild negative frequencies
+    for (auto k = 1; k < destFFTSize / 2; k++) {
+        dest[destFFTSize - k] = dest[k];
+    }
+
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+using Vec2D = std::vector<std::vector<float>>;
+
+namespace dsp {
+/// Hands the noise spectrum computed by DecomposeSTN over to NoiseMorphing. DecomposeSTN pushes the N-masked spectrum
+/// of every round 2 frame together with the position of the frame in its N output, NoiseMorphing reads the magnitude
+/// envelope averaged over its own hop, so it does not have to window and FFT the noise signal again.
+/// Producer and consumers are expected to process the same number of samples. Several consumers can read at the same
+/// time, from any thread, as long as nothing is pushed meanwhile.
+class NoiseMagnitudeFeed {
+  public:
+    NoiseMagnitudeFeed() = default;
+    ~NoiseMagnitudeFeed() = default;
+
+    /// Resizes the frame storage and drops all stored frames. Not audio thread safe.
+    /// - Parameters:
+    ///   - newFrameSize: FFT size of the pushed frames.
+    ///   - newHopSize: Hop size between consecutive pushed frames.
+    ///   - historySamples: How far back (in samples) frames have to be kept for the consumer.
+    ///   - analysisWindowPower: Mean squared value of the producer analysis window, 3 / 8 for Hann.
+    void prepare(const int newFrameSize, const int newHopSize, const int historySamples,
+                 const float analysisWindowPower = 0.375f);
+
+    /// Drops all stored frames.
+    void reset();
+
+    /// Stores power spectrum of a single frame.
+    /// - Parameters:
+    ///   - real: Real part of the noise spectrum, deinterleaved full-spectrum layout.
+    ///   - imag: Imaginary part of the noise spectrum, deinterleaved full-spectrum layout.
+    ///   - startSample: Index of the first output sample the frame is overlap-added to.
+    void push(const Vec1D &real, const Vec1D &imag, const juce::int64 startSample);
+
+    /// Magnitude spectrum of the frames centred in (fromSample, toSample], resampled to another FFT size. Scaled to match
+    /// the magnitude of a single Hann windowed frame of destFFTSize samples.
+    /// - Parameters:
+    ///   - dest: Destination, destFFTSize values, upper half mirrored.
+    ///   - average: Scratch of the consumer for the averaged power spectrum, at least getNumBins() values.
+    ///   - destFFTSize: FFT size of the consumer.
+    ///   - fromSample: Start of the consumer hop (exclusive).
+    ///   - toSample: End of the consumer hop (inclusive).
+    /// - Returns: False when no frame has been pushed yet, dest is left untouched.
+    bool read(Vec1D &dest, Vec1D &average, const int destFFTSize, const juce::int64 fromSample,
+              const juce::int64 toSample) const;
+
+    int getFrameSize() const { return frameSize; }
+    int getNumBins() const { return numBins; }
+
+  private:
+    int frameSize{0};
+    int hopSize{1};
+    int numBins{0};  // frameSize / 2 + 1
+    int capacity{0}; // number of stored frames
+    float windowGain{1.f}; // magnitude scaling of the producer window relative to Hann
+
+    Vec2D power;                       // power spectrum of stored frames - circular
+    std::vector<juce::int64> centres; // centre of stored frames in the producer output
+    int writeIdx{0};
+    int numFrames{0};
+
+    const float magnitudeFloor{1e-12f}; // keeps the log-magnitude spectrum of silence finite
+};
+} // namespace dsp
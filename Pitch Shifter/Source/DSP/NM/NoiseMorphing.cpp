@@ -1,9 +1,13 @@
 #include "NoiseMorphing.h"
 
 dsp::NoiseMorphing::NoiseMorphing(std::shared_ptr<juce::dsp::ProcessSpec> procSpec)
-    : forwardFFT{10}, forwardFFTNoise{10}, inverseFFT{10}, processSpec(procSpec) {
+    : processSpec(procSpec) {
+    for (auto size = minFFTSize; size <= maxFFTSize; size *= 2) {
+        ffts.push_back(std::make_unique<juce::dsp::FFT>(static_cast<int>(std::log2(size))));
+    }
+    interpolator.setQuality(interpolatorQuality);
     setPitchShiftSemitones(0);
-    setFFTSize(2048);
+    prepare();
 };
 
 void dsp::NoiseMorphing::setPitchShiftSemitones(const int semitones) {
@@ -16,19 +20,43 @@ void dsp::NoiseMorphing::setPitchShiftRatio(const float newPitchShiftRatio) {
         return;
 
     pitchShiftRatio = newPitchShiftRatio;
-    spectrumInterpolationFrames = std::ceil(pitchShiftRatio);
-
-    hopSizeStretch = std::ceil(hopSize * pitchShiftRatio / static_cast<float>(spectrumInterpolationFrames));
-    windowCorrectionStretch = 0.5 * fftSize / hopSizeStretch;
+    updateStretch();
 
     DBG("Pitch Shift Ratio = " + juce::String(pitchShiftRatio));
     DBG("Hop Size Stretch = " + juce::String(hopSizeStretch));
     DBG("Window Correction Stretch = " + juce::String(windowCorrectionStretch));
 }
 
+void dsp::NoiseMorphing::updateStretch() {
+    stretchRatio = juce::jmin(pitchShiftRatio, static_cast<float>(maxStretchFrames));
+    envelopeWarp = pitchShiftRatio / stretchRatio;
+    spectrumInterpolationFrames = std::ceil(stretchRatio);
+
+    hopSizeStretch = std::ceil(hopSize * stretchRatio / static_cast<float>(spectrumInterpolationFrames));
+    windowCorrectionStretch = 0.5 * fftSize / hopSizeStretch;
+    updateSpectralNoiseGain();
+}
+
+void dsp::NoiseMorphing::setSpectralNoise(const bool shouldUseSpectralNoise) {
+    spectralNoise = shouldUseSpectralNoise;
+}
+
+void dsp::NoiseMorphing::setSeed(const std::uint64_t seed) {
+    random.setSeed(seed);
+}
+
+void dsp::NoiseMorphing::setMaxStretchFrames(const int newMaxStretchFrames) {
+    const auto frames = juce::jlimit(1, 2, newMaxStretchFrames);
+    if (maxStretchFrames == frames)
+        return;
+
+    maxStretchFrames = frames;
+    updateStretch();
+}
+
 void dsp::NoiseMorphing::setFFTSize(const int newFFTSize) {
-    // Assert power of two
-    const auto fftSizePow2 = newFFTSize - (newFFTSize % 2);
+    jassert(juce::isPowerOfTwo(newFFTSize));
+    const auto fftSizePow2 = juce::jlimit(minFFTSize, maxFFTSize, juce::nextPowerOfTwo(newFFTSize));
     if (fftSize == fftSizePow2)
         return;
 
@@ -36,22 +64,57 @@ void dsp::NoiseMorphing::setFFTSize(const int newFFTSize) {
     fftSize = fftSizePow2;
     hopSize = fftSize / overlap;
 
-    prepare();
+    configure();
+}
+
+void dsp::NoiseMorphing::setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed) {
+    noiseFeed = newNoiseFeed;
+}
+
+int dsp::NoiseMorphing::getLatency() const {
+    return getLatencyFor(fftSize, noiseFeed != nullptr ? noiseFeed->getFrameSize() : 0);
+}
+
+int dsp::NoiseMorphing::getLatencyFor(const int newFFTSize, const int feedFrameSize) {
+    const auto latency = newFFTSize + PolyphaseResampler::getBaseLatency(interpolatorQuality);
+    if (feedFrameSize <= 0)
+        return latency;
+
+    // Input analysis frame is centred fftSize / 2 behind the newest sample, frames read from the feed are centred
+    // half a hop behind it, minus the lookahead the feed frames have over the input
+    const auto newHopSize = newFFTSize / overlap;
+    return latency - newFFTSize / 2 + newHopSize / 2 - getFeedLookahead(newHopSize, feedFrameSize);
+}
+
+int dsp::NoiseMorphing::getFeedLookahead(const int newHopSize, const int feedFrameSize) {
+    return juce::jmin(feedFrameSize, newHopSize) / 2;
 }
 
 void dsp::NoiseMorphing::process(juce::AudioBuffer<float> &buffer) {
     const auto numSamples = buffer.getNumSamples();
     const auto data = buffer.getWritePointer(0);
+    skipping = false;
+    const auto bypassed = noiseFeed != nullptr && juce::approximatelyEqual(pitchShiftRatio, 1.f);
+    const auto bypassDelay = noiseFeed != nullptr ? getLatency() : 0;
+    jassert(hopSize + bypassDelay <= bypass.getSize());
+
+    // Runs up to the next hop boundary, a frame is processed between runs
+    for (auto i = 0; i < numSamples;) {
+        const auto run = juce::jmin(numSamples - i, hopSize - newSamplesCount);
+        auto *runData = data + i;
+
+        input.push(runData, run);
+        bypass.push(runData, run);
+        samplesProcessed += run;
+
+        if (bypassed) {
+            juce::FloatVectorOperations::copy(runData, bypass.window(-run - bypassDelay), run);
+        } else {
+            juce::FloatVectorOperations::copy(runData, output.data() + newSamplesCount, run);
+        }
 
-    for (auto i = 0; i < numSamples; i++) {
-        input[writeReadPtrInput] = data[i];
-        writeReadPtrInput++;
-        if (writeReadPtrInput >= input.size())
-            writeReadPtrInput = 0;
-
-        data[i] = output[newSamplesCount];
-
-        newSamplesCount++;
+        i += run;
+        newSamplesCount += run;
         if (newSamplesCount >= hopSize) {
             processFrame();
             newSamplesCount = 0;
@@ -59,125 +122,202 @@ void dsp::NoiseMorphing::process(juce::AudioBuffer<float> &buffer) {
     }
 }
 
-void dsp::NoiseMorphing::processFrame() {
-    // Copy new samples to FFT vector
-    juce::FloatVectorOperations::copy(fft.data(), input.data() + writeReadPtrInput, fftSize - writeReadPtrInput);
-    juce::FloatVectorOperations::copy(fft.data() + (fftSize - writeReadPtrInput), input.data(), writeReadPtrInput);
+void dsp::NoiseMorphing::skip(const int numSamples) {
+    samplesProcessed += numSamples;
+    if (skipping)
+        return;
+
+    skipping = true;
+    reset();
+}
 
-    juce::FloatVectorOperations::multiply(fft.data(), window.data(), fftSize); // windowing
-    forwardFFT.performRealOnlyForwardTransform(fft.data());                    // FFT
+void dsp::NoiseMorphing::reset() {
+    input.reset();
+    bypass.reset();
+    whiteNoise.reset();
+    stretched.reset();
+    juce::FloatVectorOperations::fill(fftAbsPrev.data(), magnitudeFloor, fftSize);
+    juce::FloatVectorOperations::clear(output.data(), hopSize);
+    newSamplesCount = 0;
+    interpolator.reset();
+}
 
-    helpers::absInterleavedFFT(fftAbs, fft, fftSize); // get abs value of noise
-    helpers::logMagnitudeSpectrum(fftAbs);            // log-magnitude spectrum ok
+void dsp::NoiseMorphing::processFrame() {
+    // Noise envelope of the last hop is already known by DecomposeSTN
+    const auto lookahead = noiseFeed != nullptr ? getFeedLookahead(hopSize, noiseFeed->getFrameSize()) : 0;
+    if (noiseFeed != nullptr && feedAverage.size() < static_cast<size_t>(noiseFeed->getNumBins()))
+        feedAverage.resize(static_cast<size_t>(noiseFeed->getNumBins())); // within the reserved size for STN frames up to maxFFTSize
+    const auto fromFeed = noiseFeed != nullptr &&
+                          noiseFeed->read(fftAbs, feedAverage, fftSize, samplesProcessed + lookahead - hopSize,
+                                          samplesProcessed + lookahead);
+    if (!fromFeed) {
+        juce::FloatVectorOperations::multiply(fft.data(), input.window(), window.data(), fftSize); // windowing
+        fftEngine->performRealOnlyForwardTransform(fft.data());                    // FFT
+
+        helpers::absInterleavedFFT(fftAbs, fft, fftSize); // get abs value of noise
+    }
+    const auto numBins = fftSize / 2 + 1;
+    juce::FloatVectorOperations::max(fftAbs.data(), fftAbs.data(), magnitudeFloor, numBins);
+    if (envelopeWarp > 1.f)
+        warpEnvelope(fftAbs);
     
     stretchSpectrum(interpolatedFrames, fftAbsPrev, fftAbs);
 
     juce::FloatVectorOperations::copy(fftAbsPrev.data(), fftAbs.data(),
-                                      fftSize); // save current frame for next interpolation
+                                      numBins); // save current frame for next interpolation
     for (auto i = 0; i < spectrumInterpolationFrames; i++) {
         auto &frame = interpolatedFrames[i];
-        helpers::inverseLogMagnitudeSpectrum(frame); // ok
         
-        generateNoise(hopSizeStretch);
+        if (!spectralNoise)
+            generateNoise(hopSizeStretch);
 
-        if (!juce::approximatelyEqual(pitchShiftRatio, 1.f)) { // if pitch shift is 0 we don't need to do noise morphing
+        // if pitch shift is 0 we don't need to do noise morphing, unless there is no analysed spectrum to resynthesize
+        const auto morph = fromFeed || !juce::approximatelyEqual(pitchShiftRatio, 1.f);
+        if (morph) {
             // Copy frame to the fft vector, both real and imag are filled with abs spectrum.
             // This will be used in noise morphing to run element-wise multiplication of abs(X)*E
             // which, for each element, expands to (X.Real * E.Real + i * X.Real * E.Imag)
-            helpers::interleaveFFT(fft, frame, frame, fftSize); // ok
+            helpers::interleaveFFT(fft, frame, frame, numBins); // inverse FFT reads the first half only
 
             noiseMorphing(fft);
         }
         
-        inverseFFT.performRealOnlyInverseTransform(fft.data()); // IFFT
-        
-        juce::FloatVectorOperations::multiply(fft.data(), 1.f / windowCorrectionStretch, fftSize); // overlap add scaling
+        fftEngine->performRealOnlyInverseTransform(fft.data()); // IFFT
         
-        for (auto j = 0; j < fftSize; j++) {
-            stretched[(writePtrStretched + j) % stretched.size()] += fft[j];
+        if (morph && spectralNoise) {
+            juce::FloatVectorOperations::multiply(fft.data(), windowSynthesis.data(), fftSize); // synthesis windowing
+            juce::FloatVectorOperations::multiply(fft.data(), spectralNoiseGain / windowCorrectionStretch,
+                                                  fftSize); // overlap add scaling
+        } else {
+            juce::FloatVectorOperations::multiply(fft.data(), 1.f / windowCorrectionStretch, fftSize); // overlap add scaling
         }
-        writePtrStretched += hopSizeStretch;
-        writePtrStretched %= stretched.size();
+        
+        stretched.add(fft.data(), i * hopSizeStretch, fftSize); // overlap add
     }
 
-    // copy contents of streched buffer to undwinded buffer - for easiness of resampling
-    const auto copyStepSamples = stretched.size() - readPtrStretched;
-    juce::FloatVectorOperations::copy(stretchedUnwinded.data(), stretched.data() + readPtrStretched, copyStepSamples);
-    juce::FloatVectorOperations::copy(stretchedUnwinded.data() + copyStepSamples, stretched.data(), readPtrStretched);
+    // resample straight from the ring, then clear the used stretched samples
+    const auto numStretched = hopSizeStretch * spectrumInterpolationFrames;
+    [[maybe_unused]] auto _ = interpolator.process(stretchRatio, stretched.window(), output.data(), hopSize,
+                                                   numStretched, 0);
+    stretched.clear(0, numStretched);
+    stretched.advance(numStretched);
+}
 
-    // clear used stretched samples (hopSizeStretch * 2)
-    for (auto i = 0; i < hopSizeStretch * spectrumInterpolationFrames; i++) {
-        stretched[readPtrStretched++] = 0;
-        if (readPtrStretched >= stretched.size())
-            readPtrStretched = 0;
+void dsp::NoiseMorphing::warpEnvelope(Vec1D &frame) {
+    const auto lastBin = fftSize / 2;
+    const auto step = 1.f / envelopeWarp;
+
+    // Top down, so every source bin (at or below the destination) is still unwarped when read
+    for (auto k = lastBin; k >= 0; k--) {
+        const auto pos = k * step;
+        const auto k0 = static_cast<int>(pos);
+        const auto k1 = juce::jmin(k0 + 1, lastBin);
+        const auto frac = pos - k0;
+        frame[k] = juce::jmax(frame[k0] + frac * (frame[k1] - frame[k0]), magnitudeFloor);
     }
-
-    [[maybe_unused]] auto _ = interpolator.process(pitchShiftRatio, stretchedUnwinded.data(), output.data(), hopSize,
-                                                   hopSizeStretch * spectrumInterpolationFrames, 0);
 }
 
 void dsp::NoiseMorphing::stretchSpectrum(Vec2D &dest, const Vec1D &frame1, const Vec1D &frame2) {
+    const auto numBins = fftSize / 2 + 1;
     const auto lastFrame = spectrumInterpolationFrames - 1;
-    juce::FloatVectorOperations::copy(dest[lastFrame].data(), frame2.data(), fftSize); // copy frame2 to the last frame
+    juce::FloatVectorOperations::copy(dest[lastFrame].data(), frame2.data(), numBins); // copy frame2 to the last frame
+    if (lastFrame == 0)
+        return;
 
-    const auto frac = 1.f / static_cast<float>(spectrumInterpolationFrames);
-    for (auto i = 0; i < spectrumInterpolationFrames; i++) {
-        interpolateFrames(dest[i], frame1, frame2, frac + i * frac);
+    // (frame2 / frame1)^(1 / frames), frame i is frame1 multiplied by it i + 1 times
+    const auto exponent = 1.f / static_cast<float>(spectrumInterpolationFrames);
+    for (auto k = 0; k < numBins; k++) {
+        binRatio[k] = helpers::fastExp2(exponent * (helpers::fastLog2(frame2[k]) - helpers::fastLog2(frame1[k])));
     }
-}
 
-void dsp::NoiseMorphing::interpolateFrames(Vec1D &dest, const Vec1D &frame1, const Vec1D &frame2, const float frac) {
-    jassert(dest.size() == frame1.size());
-    jassert(frame2.size() == frame1.size());
-    const auto prevNextDist = 1.f;
-    const auto prevDist = frac;
-    const auto nextDist = 1.f - frac;
-
-    for (auto i = 0; i < dest.size(); i++) {
-        dest[i] = frame1[i] * (nextDist / prevNextDist) + frame2[i] * (prevDist / prevNextDist);
+    juce::FloatVectorOperations::multiply(dest[0].data(), frame1.data(), binRatio.data(), numBins);
+    for (auto i = 1; i < lastFrame; i++) {
+        juce::FloatVectorOperations::multiply(dest[i].data(), dest[i - 1].data(), binRatio.data(), numBins);
     }
 }
 
 void dsp::NoiseMorphing::generateNoise(int size) {
-    // generate as much noise as we need for morphing
-    auto maxNoise = 0.f;
-    auto startPtr = writeReadPtrNoise;
-    for(auto j = 0; j < size; j++){
-        whiteNoise[writeReadPtrNoise] = dist(generator);
-        if(auto absNoise = std::abs(whiteNoise[writeReadPtrNoise]); absNoise > maxNoise){
-            maxNoise = absNoise;
-        }
-        writeReadPtrNoise++;
-        if(writeReadPtrNoise >= whiteNoise.size()) writeReadPtrNoise = 0;
-    }
+    // generate as much noise as we need for morphing, the maximum is tracked while generating
+    jassert(size <= noiseBlock.size());
+    const auto maxNoise = random.fill(noiseBlock.data(), size);
 
-    for(auto j = 0; j < size; j++){
-        whiteNoise[startPtr++] /= maxNoise;
-        if(startPtr >= whiteNoise.size()) startPtr = 0;
-    }
+    // normalise before appending to the circular noise buffer
+    juce::FloatVectorOperations::multiply(noiseBlock.data(), 1.f / maxNoise, size);
+    whiteNoise.push(noiseBlock.data(), size);
 }
 
-void dsp::NoiseMorphing::noiseMorphing(Vec1D &dest) {
+void dsp::NoiseMorphing::generateSpectralNoise() {
+    // Real and imaginary parts carry half of the power each. The inverse FFT only reads the first half.
+    const auto numValues = fftSize + 2;
+    random.fill(fftNoise.data(), numValues);
+    juce::FloatVectorOperations::multiply(fftNoise.data(), juce::MathConstants<float>::sqrt2 * 0.5f, numValues);
+
+    // DC and Nyquist are real
+    const auto nyquist = fftSize; // interleaved index of the Nyquist bin
+    fftNoise[0] *= juce::MathConstants<float>::sqrt2;
+    fftNoise[1] = 0.f;
+    fftNoise[nyquist] *= juce::MathConstants<float>::sqrt2;
+    fftNoise[nyquist + 1] = 0.f;
+}
+
+void dsp::NoiseMorphing::updateSpectralNoiseGain() {
+    // Time domain noise is normalized by its maximum, i.e. its stddev is one over the expected maximum of |x| over
+    // hopSizeStretch Gaussian samples (Gumbel approximation, within a few percent for the hop sizes used here).
+    const auto m = 2.f * static_cast<float>(hopSizeStretch);
+    const auto a = std::sqrt(2.f * std::log(m));
+    const auto logFourPi = std::log(4.f * juce::MathConstants<float>::pi);
+    const auto stddev = 1.f / (a - (std::log(std::log(m)) + logFourPi - 2.f * 0.5772f) / (2.f * a));
+
+    // Time domain: frames are copies of the same noise, windowed and scaled by 2 / windowEnergy, their overlap-add
+    // sums to the noise itself. Output power (flat unit spectrum) is 16 * stddev^2 / windowEnergy^2.
+    // Spectral: unit power bins, inverse FFT scales power by 1 / fftSize, independent frames overlap-add in power.
+    // Output power is 4 * gain^2 * windowSynthesisPower * hopSizeStretch / fftSize^2.
+    spectralNoiseGain = 2.f * stddev * fftSize / (windowEnergy * std::sqrt(windowSynthesisPower * hopSizeStretch));
+}
 
-    juce::FloatVectorOperations::copy(fftNoise.data(), whiteNoise.data() + writeReadPtrNoise,
-                                      fftSize - writeReadPtrNoise);
-    juce::FloatVectorOperations::copy(fftNoise.data() + (fftSize - writeReadPtrNoise), whiteNoise.data(),
-                                      writeReadPtrNoise);
+void dsp::NoiseMorphing::noiseMorphing(Vec1D &dest) {
 
-    juce::FloatVectorOperations::multiply(fftNoise.data(), windowNoise.data(), fftSize); // windowing
+    if (spectralNoise) {
+        generateSpectralNoise();
+    } else {
+        juce::FloatVectorOperations::multiply(fftNoise.data(), whiteNoise.window(), windowNoise.data(),
+                                              fftSize); // windowing
 
-    forwardFFTNoise.performRealOnlyForwardTransform(fftNoise.data()); // FFT
+        fftEngine->performRealOnlyForwardTransform(fftNoise.data()); // FFT
 
-    // normalize by the frame energy to ensure spectral magnitude equals 1
-    juce::FloatVectorOperations::multiply(fftNoise.data(), 2.f / windowEnergy, fftSize * 2);
+        // normalize by the frame energy to ensure spectral magnitude equals 1
+        juce::FloatVectorOperations::multiply(fftNoise.data(), 2.f / windowEnergy, fftSize * 2);
+    }
 
     // multiply each frame of the white noise by the interpolated frame of the input's noise (dest)
     juce::FloatVectorOperations::multiply(dest.data(), fftNoise.data(), fftSize * 2); // element wise multiplication
 }
 
 void dsp::NoiseMorphing::prepare() {
-    input.resize(fftSize);
-    whiteNoise.resize(fftSize);
+    // Reserve for the largest FFT size, configure only resizes within it
+    input.reserve(maxFFTSize);
+    bypass.reserve(maxFFTSize * 2);
+    whiteNoise.reserve(maxFFTSize);
+    stretched.reserve(maxFFTSize * maxPitchShiftRatio);
+    for (auto *v : {&noiseBlock, &output, &fft, &fftNoise, &fftAbs, &fftAbsPrev, &binRatio, &window, &windowNoise,
+                    &windowSynthesis}) {
+        v->reserve(maxFFTSize * 2 + 1);
+    }
+    feedAverage.reserve(maxFFTSize + 1);
+    interpolatedFrames.resize(maxPitchShiftRatio);
+    for (auto &e : interpolatedFrames) {
+        e.reserve(maxFFTSize);
+    }
+
+    configure();
+}
+
+void dsp::NoiseMorphing::configure() {
+    jassert(fftSize >= minFFTSize && fftSize <= maxFFTSize);
+    input.setSize(fftSize);
+    bypass.setSize(fftSize * 2);
+    whiteNoise.setSize(fftSize);
+    noiseBlock.resize(hopSize);
     output.resize(hopSize);
 
     fft.resize(fftSize * 2);
@@ -185,12 +325,12 @@ void dsp::NoiseMorphing::prepare() {
 
     fftAbs.resize(fftSize);
     fftAbsPrev.resize(fftSize);
+    juce::FloatVectorOperations::fill(fftAbsPrev.data(), magnitudeFloor, fftSize);
+    newSamplesCount = 0;
+    binRatio.resize(fftSize / 2 + 1);
 
-    stretched.resize(fftSize * maxPitchShiftRatio);
-    stretchedUnwinded.resize(fftSize * maxPitchShiftRatio);
-    juce::FloatVectorOperations::fill(stretched.data(), 0.f, stretched.size());
+    stretched.setSize(fftSize * maxPitchShiftRatio);
 
-    interpolatedFrames.resize(maxPitchShiftRatio);
     for (auto &e : interpolatedFrames) {
         e.resize(fftSize);
     }
@@ -208,11 +348,17 @@ void dsp::NoiseMorphing::prepare() {
         sumWindowSq += e * e;
     }
     windowEnergy = std::sqrt(sumWindowSq);
+
+    windowSynthesis.resize(fftSize + 1);
+    auto sumSynthesisSq = 0.f;
+    for (size_t i = 0; i < windowSynthesis.size(); i++) {
+        windowSynthesis[i] = std::sqrt(window[i]); // sine window, power sums to a constant when overlap-added
+        sumSynthesisSq += window[i];
+    }
+    windowSynthesisPower = sumSynthesisSq / windowSynthesis.size();
+    updateStretch(); // hop size may have changed
     
-    const auto pow2S = log2(fftSize);
-    forwardFFT = juce::dsp::FFT(pow2S);
-    inverseFFT = juce::dsp::FFT(pow2S);
-    forwardFFTNoise = juce::dsp::FFT(pow2S);
+    fftEngine = ffts[static_cast<size_t>(std::log2(fftSize / minFFTSize))].get();
 
     interpolator.reset();
     DBG("getBaseLatency: " + juce::String(interpolator.getBaseLatency()));
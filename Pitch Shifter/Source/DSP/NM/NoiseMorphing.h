@@ -1,7 +1,11 @@
 #pragma once
 #include "../Helpers/dsp.h"
+#include "../Helpers/fastmath.h"
+#include "../Helpers/random.h"
+#include "../Helpers/RingBuffer.h"
+#include "../Resampler/PolyphaseResampler.h"
+#include "NoiseMagnitudeFeed.h"
 #include <JuceHeader.h>
-#include <random>
 
 using Vec1D = std::vector<float>;
 using Vec2D = std::vector<std::vector<float>>;
@@ -21,25 +25,75 @@ class NoiseMorphing {
     /// - Parameter newPitchShiftRatio: Pitch shift ratio.
     void setPitchShiftRatio(const float newPitchShiftRatio);
 
-    /// Set FFT size. Resized all the interal storage buffers. Not audio thread safe.
-    /// - Parameter newFFTSize: New FFT size.
+    /// Spectral noise mode. Complex Gaussian noise is drawn directly for every bin instead of generating, windowing
+    /// and transforming white noise in time domain. The resynthesized frames are windowed after the inverse FFT and
+    /// scaled to the output power of the time domain mode.
+    /// - Parameter shouldUseSpectralNoise: True to generate the noise in frequency domain.
+    void setSpectralNoise(const bool shouldUseSpectralNoise);
+
+    /// Restarts the noise generator from a seed, the same seed and input give the same output.
+    /// - Parameter seed: Noise generator seed.
+    void setSeed(const std::uint64_t seed);
+
+    /// Caps the number of frames synthesised per hop, the rest of the shift is applied by warping the envelope. 1
+    /// halves the synthesis cost of upward shifts, at the price of a coarser spectrum. Does not allocate and keeps the
+    /// latency.
+    /// - Parameter newMaxStretchFrames: 1 or 2.
+    void setMaxStretchFrames(const int newMaxStretchFrames);
+
+    /// Set FFT size. Buffers and FFT engines are allocated for every supported size by prepare, so switching does not
+    /// allocate. Processing restarts from silence.
+    /// - Parameter newFFTSize: New FFT size, power of two from minFFTSize to maxFFTSize.
     void setFFTSize(const int newFFTSize);
 
-    /// Prepares and resized all internal buffers for processing. Must be called at least once before processing start.
+    /// Allocates all internal buffers for the largest FFT size and prepares processing. Must be called at least once
+    /// before processing start. Not audio thread safe.
     void prepare();
 
+    static constexpr int minFFTSize{256};
+    static constexpr int maxFFTSize{2048};
+
+    /// Set source of the noise magnitude spectrum. When set, the envelope is read from the feed instead of windowing
+    /// and transforming the input, the input is then only used as a delayed bypass at pitch shift ratio 1. Pass nullptr
+    /// to analyse the input again.
+    /// - Parameter newNoiseFeed: Feed published by DecomposeSTN, its N output has to be the input of this processor.
+    void setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed);
+
     /// Process incoming audio buffer.
     /// - Parameter buffer: Audio buffer to process.
     void process(juce::AudioBuffer<float> &buffer);
 
-    int getLatency() const { return fftSize + interpolator.getBaseLatency(); }
+    /// Lets a block of samples pass without processing it, for a processor that is currently not heard. The position
+    /// in the feed timeline keeps up with DecomposeSTN, processing restarts from silence on the next process call.
+    /// - Parameter numSamples: Number of skipped samples.
+    void skip(const int numSamples);
+
+    /// Clears the processing state, processing restarts from silence. Keeps the configuration, windows are not built
+    /// again. Audio thread safe.
+    void reset();
+
+    /// Latency in samples. With the feed, the analysed frames are centred closer to the newest input sample.
+    int getLatency() const;
+
+    /// Latency of another configuration, without changing this one.
+    /// - Parameters:
+    ///   - newFFTSize: FFT size.
+    ///   - feedFrameSize: Frame size of the noise magnitude feed, 0 without a feed.
+    static int getLatencyFor(const int newFFTSize, const int feedFrameSize);
 
   private:
     /// Process a single frame of audio. As a result output buffer gets filled with new samples.
     void processFrame();
 
+    /// Sizes buffers and windows for the current FFT size within the reserved memory and clears the processing state.
+    void configure();
+
     /// Runs frame interpolation in order to stretch the spectrum. Resulting frames are saved to dest. The number of
-    /// resulting frames depends on the current pitch shift ratio.
+    /// resulting frames depends on the current pitch shift ratio. Frames are interpolated linearly in the log-magnitude
+    /// domain, computed as geometric interpolation of the magnitudes: every frame is the previous one multiplied by a
+    /// per-bin ratio, so only one fast log2 / exp2 pair per bin is needed. Relative difference to interpolating
+    /// 10 * log10 values and converting them back with pow stays below 1e-5. Only the first fftSize / 2 + 1 bins are
+    /// computed.
     /// - Parameters:
     ///   - dest: Destination vector. Will be filled with the interpolated frames.
     ///   - frame1: Previous frame.
@@ -50,22 +104,37 @@ class NoiseMorphing {
     /// - Parameter size: Size of generated noise chunk.
     void generateNoise(int size);
 
+    /// Moves the magnitude envelope up in frequency by envelopeWarp. Per-bin magnitudes are kept, which matches the
+    /// output level of the stretched path at integer ratios.
+    /// - Parameter frame: Magnitude spectrum, first fftSize / 2 + 1 bins are warped in place.
+    void warpEnvelope(Vec1D &frame);
+
+    /// Fills the noise spectrum with complex Gaussian values of unit expected power, first half of the spectrum only.
+    void generateSpectralNoise();
+
+    /// Gain of the spectral noise synthesis window. Matches the output power of the time domain mode. There,
+    /// consecutive frames share most of their noise samples and overlap-add coherently, while spectral frames are
+    /// independent.
+    void updateSpectralNoiseGain();
+
     /// Perform noise morphing. Destination vector is modulated by the noise spectrum via element-wise multiplication.
     /// - Parameters:
     ///   - dest: Vector to be modulated.
     void noiseMorphing(Vec1D &dest);
 
-    /// Interpolates two frames of a spectrum at a given fractional point.
+    /// How far past the newest input sample the feed frames reach, at most half a hop.
     /// - Parameters:
-    ///   - dest: Resulting frame.
-    ///   - frame1: Previous frame.
-    ///   - frame2: Current frame.
-    ///   - frac: Point of interpolation.
-    static void interpolateFrames(Vec1D &dest, const Vec1D &frame1, const Vec1D &frame2, const float frac);
+    ///   - newHopSize: Hop size of this processor.
+    ///   - feedFrameSize: Frame size of the noise magnitude feed.
+    static int getFeedLookahead(const int newHopSize, const int feedFrameSize);
+
+    /// Derives stretch ratio, envelope warp, stretched hop and the scaling that depends on them from the pitch shift
+    /// ratio and hop size.
+    void updateStretch();
 
     // ===== FFT Params =====
     int fftSize{2048};
-    const int overlap{2};
+    static constexpr int overlap{2};
 
     int hopSize{fftSize / overlap};
     int hopSizeStretch{512};
@@ -79,38 +148,51 @@ class NoiseMorphing {
     float pitchShiftRatio{2.f}; // linear
     const int maxPitchShiftRatio{4};
 
+    // Above maxStretchFrames the time stretch + resampling ratio is capped, so the cost per hop stays constant. The
+    // rest of the shift is applied by warping the spectral envelope before synthesis.
+    int maxStretchFrames{2};
+    float stretchRatio{2.f};  // pitch shift applied by stretching and resampling
+    float envelopeWarp{1.f};  // pitch shift applied by warping the envelope, pitchShiftRatio / stretchRatio
+
     // ==== Noise ====
-    const float mean = 0.0f;
-    const float stddev = 1.f;
-    std::mt19937 generator{std::random_device{}()};
-    std::normal_distribution<float> dist{mean, stddev};
+    helpers::GaussianRandom random; // zero mean, unit stddev
+
+    bool spectralNoise{false};     // noise generated in frequency domain
+    float spectralNoiseGain{1.f}; // synthesis window gain for spectral noise
     
-    juce::dsp::FFT forwardFFT;
-    juce::dsp::FFT forwardFFTNoise;
-    juce::dsp::FFT inverseFFT;
+    std::vector<std::unique_ptr<juce::dsp::FFT>> ffts; // one engine per supported order, from minFFTSize up
+    juce::dsp::FFT *fftEngine{nullptr};                 // engine of the current FFT size, forward and inverse
 
     Vec1D window;            // hann window
     Vec1D windowNoise;       // normalized hann window for white noise STFT
-    Vec1D input;             // input buffer for storing incoming audio samples
-    Vec1D whiteNoise;        // generated white noise
-    Vec1D stretched;         // stretched noise - circular
-    Vec1D stretchedUnwinded; // stretched noise - when filled next sample is always at idx 0
-    Vec1D output;            // resampled output buffer
+    Vec1D windowSynthesis;   // sine window for spectral noise synthesis
+    float windowSynthesisPower{0.5f}; // mean of the squared synthesis window
+
+    const float magnitudeFloor{1e-12f}; // keeps the per-bin ratio of silent bins finite
+    helpers::RingBuffer input;      // input buffer for storing incoming audio samples, head is the oldest sample
+    helpers::RingBuffer whiteNoise; // generated white noise, head is the oldest sample
+    Vec1D noiseBlock;               // newly generated white noise before normalisation
+    helpers::RingBuffer stretched;  // stretched noise, head is the next sample to resample
+    Vec1D output;                   // resampled output buffer
 
     Vec1D fft;         // buffer for fft processing of input
     Vec1D fftAbs;      // absolute values of the fft
     Vec1D fftAbsPrev;  // previous absolute values of the fft
+    Vec1D binRatio;    // per-bin magnitude ratio between consecutive interpolated frames
     Vec1D fftNoise;    // buffer for fft processing of noise
 
     Vec2D interpolatedFrames; // interpolated spectral frames
 
-    int newSamplesCount{0};   // counter for new samples in frame processing
-    int writeReadPtrInput{0}; // input buffer write/read pointer
-    int writeReadPtrNoise{0}; // noise buffer write/read pointer
-    int writePtrStretched{0}; // stretched noise write pointer
-    int readPtrStretched{0};  // stretched noise read pointer
+    int newSamplesCount{0}; // counter for new samples in frame processing
+
+    NoiseMagnitudeFeed *noiseFeed{nullptr}; // optional, spectrum envelope published by DecomposeSTN
+    Vec1D feedAverage;                     // averaged power spectrum read from the feed
+    juce::int64 samplesProcessed{0};       // position in the feed timeline, never reset
+    bool skipping{false};                  // state already cleared by skip
+    helpers::RingBuffer bypass;            // delayed input, used with the feed at pitch shift ratio 1
 
-    juce::WindowedSincInterpolator interpolator;
+    static constexpr auto interpolatorQuality{PolyphaseResampler::Quality::high};
+    PolyphaseResampler interpolator;
 
     std::shared_ptr<juce::dsp::ProcessSpec> processSpec;
 
@@ -0,0 +1,27 @@
+#pragma once
+#include "../../External/signalsmith-stretch.h"
+#include "../Helpers/simd.h"
+
+namespace dsp {
+/// signalsmith::stretch::SignalsmithStretch with its peak detection loops on the dsp::helpers vector kernels. Keeps the
+/// vendored header free of plugin includes. The smoothing may differ from the plain loops by rounding.
+class SimdSignalsmithStretch : public signalsmith::stretch::SignalsmithStretch<float> {
+  public:
+    using SignalsmithStretch::SignalsmithStretch;
+
+  protected:
+    void smoothForward(float *data, const int size, const float slew, float &state) override {
+        helpers::smoothForward(data, size, slew, state);
+    }
+
+    void smoothBackward(float *data, const int size, const float slew, float &state) override {
+        helpers::smoothBackward(data, size, slew, state);
+    }
+
+    void compareGreater(const float *a, const float *b, std::uint32_t *mask, const int size) override {
+        helpers::compareGreater(a, b, mask, size);
+    }
+
+    float dotProduct(const float *a, const float *b, const int size) override { return helpers::dotProduct(a, b, size); }
+};
+} // namespace dsp
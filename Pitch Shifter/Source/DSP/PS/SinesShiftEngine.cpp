@@ -0,0 +1,55 @@
+#include "SinesShiftEngine.h"
+
+std::unique_ptr<dsp::SinesShiftEngine> dsp::SinesShiftEngine::create(const Type type) {
+    switch (type) {
+    case Type::signalsmith:
+        return std::make_unique<SignalsmithShiftEngine>();
+    case Type::wsola:
+        return std::make_unique<StretchResampleShiftEngine<WsolaStretch>>();
+    case Type::phaseVocoder:
+        return std::make_unique<StretchResampleShiftEngine<PhaseVocoderStretch>>(false);
+    case Type::spectralCut:
+        return std::make_unique<FreqFactorShiftEngine<SpectralCutStretch>>(false);
+    case Type::vasePhocoder:
+        return std::make_unique<FreqFactorShiftEngine<VasePhocoderStretch>>();
+    case Type::hybridPhase:
+        return std::make_unique<FreqFactorShiftEngine<HybridPhaseStretch>>();
+    case Type::paul:
+        return std::make_unique<StretchResampleShiftEngine<PaulStretch>>();
+    case Type::numTypes:
+        break;
+    }
+    jassertfalse;
+    return nullptr;
+}
+
+juce::StringArray dsp::SinesShiftEngine::getTypeNames() {
+    return {"Signalsmith", "WSOLA", "Phase Vocoder", "Spectral Cut", "Vase Phocoder", "Hybrid Phase", "Paul"};
+}
+
+int dsp::SinesShiftEngine::getLatencyFor(const Type type, const int blockSamples) {
+    switch (type) {
+    case Type::wsola:
+    case Type::phaseVocoder:
+    case Type::paul:
+        return StretchResampleShiftEngine<WsolaStretch>::getLatencyFor(blockSamples);
+    default:
+        return blockSamples; // input plus output latency of every stretch is one block
+    }
+}
+
+void dsp::SinesShiftEngine::process(const float *input, float *output, const int numSamples) {
+    const auto start = juce::Time::getMillisecondCounterHiRes();
+    processBlock(input, output, numSamples);
+    const auto elapsed = static_cast<float>(juce::Time::getMillisecondCounterHiRes() - start);
+    costMs = costMs.load() + costSmoothing * (elapsed - costMs.load());
+}
+
+void dsp::SignalsmithShiftEngine::configure(const int blockSamples, const int intervalSamples, const int) {
+    stretch.configure(1, blockSamples, intervalSamples);
+    stretch.reset();
+}
+
+void dsp::SignalsmithShiftEngine::processBlock(const float *input, float *output, const int numSamples) {
+    stretch.process(&input, numSamples, &output, numSamples);
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include "../../External/shift-stretch.h"
+#include "../Resampler/PolyphaseResampler.h"
+#include "SimdSignalsmithStretch.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// Pitch shifter for the sines stream when they are not shifted inside DecomposeSTN. Engines are configured in advance,
+/// switching between configured engines on the audio thread does not allocate. Every engine reports its latency and
+/// the measured cost of its blocks, so a cheap engine can be picked on slow machines.
+class SinesShiftEngine {
+  public:
+    enum class Type {
+        signalsmith,  // signalsmith stretch, transposes in the spectral domain
+        wsola,        // time domain WSOLA stretch, then resampled
+        phaseVocoder, // phase vocoder stretch, then resampled
+        spectralCut,  // spectral peaks moved by the frequency factor
+        vasePhocoder, // phase vocoder with frequency factor
+        hybridPhase,  // phase vocoder with phase prediction in time and frequency
+        paul,         // random phases, extreme smearing, then resampled
+        numTypes
+    };
+
+    virtual ~SinesShiftEngine() = default;
+
+    /// Creates an engine, not configured yet.
+    /// - Parameter type: Algorithm.
+    static std::unique_ptr<SinesShiftEngine> create(const Type type);
+
+    /// Display names, in Type order.
+    static juce::StringArray getTypeNames();
+
+    /// Latency of an engine for a block configuration, without configuring one. Same as getLatency once configured.
+    /// - Parameters:
+    ///   - type: Algorithm.
+    ///   - blockSamples: Analysis block length.
+    static int getLatencyFor(const Type type, const int blockSamples);
+
+    /// Allocates and clears everything for a block configuration. Not audio thread safe.
+    /// - Parameters:
+    ///   - blockSamples: Analysis block length, sets latency and frequency resolution.
+    ///   - intervalSamples: Hop between analysis blocks.
+    ///   - maximumBlockSize: Largest number of samples per process call.
+    virtual void configure(const int blockSamples, const int intervalSamples, const int maximumBlockSize) = 0;
+
+    /// Clears the processing state.
+    virtual void reset() = 0;
+
+    /// - Parameter newPitchShiftRatio: Pitch shift ratio, 0.25 to 4.
+    virtual void setPitchShiftRatio(const float newPitchShiftRatio) = 0;
+
+    /// Latency in samples, the same at every pitch shift ratio.
+    virtual int getLatency() const = 0;
+
+    /// Shifts a block of samples and measures the time it takes.
+    /// - Parameters:
+    ///   - input: Samples to shift.
+    ///   - output: Shifted samples, must not alias input.
+    ///   - numSamples: Number of samples, at most the configured maximum block size.
+    void process(const float *input, float *output, const int numSamples);
+
+    /// Smoothed time spent in process per block, in milliseconds. Can be read from any thread.
+    float getCostMs() const { return costMs.load(); }
+
+  protected:
+    virtual void processBlock(const float *input, float *output, const int numSamples) = 0;
+
+  private:
+    std::atomic<float> costMs{0.f};
+    static constexpr float costSmoothing{0.05f};
+};
+
+/// signalsmith::stretch::SignalsmithStretch, with vectorised peak detection.
+class SignalsmithShiftEngine : public SinesShiftEngine {
+  public:
+    void configure(const int blockSamples, const int intervalSamples, const int maximumBlockSize) override;
+    void reset() override { stretch.reset(); }
+    void setPitchShiftRatio(const float newPitchShiftRatio) override { stretch.setTransposeFactor(newPitchShiftRatio); }
+    int getLatency() const override { return stretch.inputLatency() + stretch.outputLatency(); }
+
+  protected:
+    void processBlock(const float *input, float *output, const int numSamples) override;
+
+  private:
+    SimdSignalsmithStretch stretch;
+};
+
+/// shift-stretch.h engines with a frequency factor, they shift in the spectral domain at time factor 1.
+/// - Stretch: SpectralCutStretch, VasePhocoderStretch or HybridPhaseStretch.
+template <typename Stretch> class FreqFactorShiftEngine : public SinesShiftEngine {
+  public:
+    template <typename... Args> explicit FreqFactorShiftEngine(Args... args) : stretch(args...) {}
+
+    void configure(const int blockSamples, const int intervalSamples, const int) override {
+        stretch.configure(1, blockSamples, intervalSamples);
+        reset();
+    }
+
+    void reset() override {
+        stretch.OverlapAddStretch::reset();
+        stretch.reset();
+    }
+
+    void setPitchShiftRatio(const float newPitchShiftRatio) override { stretch.setFreqFactor(newPitchShiftRatio); }
+
+    int getLatency() const override { return stretch.inputLatency() + stretch.outputLatency(); }
+
+  protected:
+    void processBlock(const float *input, float *output, const int numSamples) override {
+        stretch.process(&input, numSamples, &output, numSamples);
+    }
+
+  private:
+    Stretch stretch;
+};
+
+/// shift-stretch.h engines without a frequency factor. The input is stretched in time by the pitch shift ratio, then
+/// resampled back to its duration, which shifts it.
+/// The stretch output latency and the resampler latency count in stretched samples, so they are divided by the ratio.
+/// A delay after the resampler fills up to the latency at the lowest ratio, which keeps the latency constant.
+/// - Stretch: WsolaStretch, PhaseVocoderStretch or PaulStretch.
+template <typename Stretch> class StretchResampleShiftEngine : public SinesShiftEngine {
+  public:
+    template <typename... Args> explicit StretchResampleShiftEngine(Args... args) : stretch(args...) {
+        resampler.setQuality(resamplerQuality);
+    }
+
+    void configure(const int blockSamples, const int intervalSamples, const int maximumBlockSize) override {
+        if constexpr (std::is_same_v<Stretch, WsolaStretch>)
+            stretch.configure(1, blockSamples, intervalSamples, intervalSamples / 2);
+        else
+            stretch.configure(1, blockSamples, intervalSamples);
+
+        // Longest stretched block plus what the resampler may leave over
+        stretched.assign(static_cast<size_t>(maximumBlockSize) * maxPitchShiftRatio + stretchedReserve * 2, 0.f);
+
+        // Delay changes are ramped over a block, like the stretch itself moves to a new ratio
+        compensation.prepare({0., static_cast<juce::uint32>(maximumBlockSize), 1});
+        compensation.setMaximumDelayInSamples(getLatency() - static_cast<int>(getLatencyAt(maxPitchShiftRatio)) + 1);
+        compensationDelay.reset(blockSamples);
+        reset();
+    }
+
+    void reset() override {
+        stretch.OverlapAddStretch::reset();
+        stretch.reset();
+        resampler.reset();
+        numStretched = 0;
+        compensation.reset();
+        compensationDelay.setCurrentAndTargetValue(getLatency() - getLatencyAt(pitchShiftRatio));
+    }
+
+    void setPitchShiftRatio(const float newPitchShiftRatio) override {
+        pitchShiftRatio = juce::jlimit(1.f / maxPitchShiftRatio, static_cast<float>(maxPitchShiftRatio),
+                                       newPitchShiftRatio);
+        stretch.setTimeFactor(pitchShiftRatio);
+        compensationDelay.setTargetValue(getLatency() - getLatencyAt(pitchShiftRatio));
+    }
+
+    int getLatency() const override {
+        return stretch.inputLatency() +
+               (stretch.outputLatency() + resampler.getBaseLatency() + stretchedReserve) * maxPitchShiftRatio;
+    }
+
+    /// See SinesShiftEngine::getLatencyFor, the same for every Stretch.
+    static int getLatencyFor(const int blockSamples) {
+        const auto inputLatency = blockSamples / 2; // as OverlapAddStretch
+        return inputLatency + (blockSamples - inputLatency + PolyphaseResampler::getBaseLatency(resamplerQuality) +
+                               stretchedReserve) * maxPitchShiftRatio;
+    }
+
+  protected:
+    void processBlock(const float *input, float *output, const int numSamples) override {
+        // Stretch enough to resample numSamples, plus a few samples so the resampler never runs dry
+        const auto toStretch =
+            static_cast<int>(std::ceil(numSamples * pitchShiftRatio)) + stretchedReserve - numStretched;
+        auto *stretchedEnd = stretched.data() + numStretched;
+        stretch.process(&input, numSamples, &stretchedEnd, juce::jmax(0, toStretch));
+        numStretched += juce::jmax(0, toStretch);
+
+        const auto used = resampler.process(pitchShiftRatio, stretched.data(), output, numSamples, numStretched, 0);
+        jassert(used <= numStretched);
+
+        numStretched -= juce::jmin(used, numStretched);
+        if (used > 0) std::memmove(stretched.data(), stretched.data() + used, sizeof(float) * numStretched);
+
+        for (int i = 0; i < numSamples; ++i) {
+            compensation.pushSample(0, output[i]);
+            output[i] = compensation.popSample(0, compensationDelay.getNextValue());
+        }
+    }
+
+  private:
+    /// Latency without the compensation delay.
+    /// - Parameter ratio: Pitch shift ratio.
+    float getLatencyAt(const float ratio) const {
+        return stretch.inputLatency() +
+               (stretch.outputLatency() + resampler.getBaseLatency() + stretchedReserve) / ratio;
+    }
+
+    static constexpr int maxPitchShiftRatio{4};
+    static constexpr int stretchedReserve{4};
+    static constexpr auto resamplerQuality{PolyphaseResampler::Quality::high};
+
+    Stretch stretch;
+    PolyphaseResampler resampler;
+
+    Vec1D stretched;     // stretched samples not resampled yet
+    int numStretched{0}; // number of valid samples in stretched
+    float pitchShiftRatio{1.f};
+
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::Linear> compensation;
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Linear> compensationDelay; // getLatency() - getLatencyAt(ratio)
+};
+} // namespace dsp
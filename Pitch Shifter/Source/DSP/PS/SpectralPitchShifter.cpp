@@ -0,0 +1,146 @@
+#include "SpectralPitchShifter.h"
+
+void dsp::SpectralPitchShifter::setPitchShiftRatio(const float newPitchShiftRatio) {
+    pitchShiftRatio = juce::jlimit(0.25f, 4.f, newPitchShiftRatio);
+}
+
+void dsp::SpectralPitchShifter::prepare(const int newFFTSize, const int newHopSize) {
+    fftSize = newFFTSize;
+    hopSize = newHopSize;
+    numBins = fftSize / 2 + 1;
+
+    magnitude.resize(numBins);
+    phase.resize(numBins);
+    prevPhase.resize(numBins);
+    trueFreq.resize(numBins);
+    peakPhase.resize(numBins);
+    peakShift.resize(numBins);
+    outPhase.resize(numBins);
+    outReal.resize(numBins);
+    outImag.resize(numBins);
+    outStrongest.resize(numBins);
+    peakOf.resize(numBins);
+
+    reset();
+}
+
+void dsp::SpectralPitchShifter::reset() {
+    std::fill(prevPhase.begin(), prevPhase.end(), 0.f);
+    std::fill(outPhase.begin(), outPhase.end(), 0.f);
+    firstFrame = true;
+}
+
+void dsp::SpectralPitchShifter::processFrame(Vec1D &real, Vec1D &imag) {
+    jassert(real.size() >= fftSize);
+    jassert(imag.size() >= fftSize);
+    if (fftSize == 0)
+        return;
+
+    constexpr auto twoPi = juce::MathConstants<float>::twoPi;
+    const auto binToFreq = twoPi / static_cast<float>(fftSize);
+
+    // Analysis - magnitude, phase and instantaneous frequency of every bin
+    for (auto k = 0; k < numBins; k++) {
+        magnitude[k] = std::hypot(real[k], imag[k]);
+        phase[k] = std::atan2(imag[k], real[k]);
+
+        const auto binFreq = binToFreq * k;
+        const auto delta = std::remainder(phase[k] - prevPhase[k] - binFreq * hopSize, twoPi);
+        trueFreq[k] = binFreq + delta / hopSize;
+        prevPhase[k] = phase[k];
+    }
+
+    // Nothing to shift, output is the masked spectrum. Phases get re-initialised once the ratio moves away from 1.
+    if (juce::approximatelyEqual(pitchShiftRatio, 1.f)) {
+        firstFrame = true;
+        return;
+    }
+
+    findPeaks();
+
+    // Peaks - shift follows the instantaneous frequency, so the moved kernel is centred (to the nearest bin) on the
+    // shifted sinusoid. The synthesis phase advances by the shifted instantaneous frequency.
+    const auto lastBin = numBins - 1;
+    for (auto kp = 0; kp < numBins; kp++) {
+        if (peakOf[kp] != kp)
+            continue;
+        peakShift[kp] = std::round(trueFreq[kp] / binToFreq * (pitchShiftRatio - 1.f));
+        const auto dest = kp + static_cast<int>(peakShift[kp]);
+        if (firstFrame || dest < 0 || dest > lastBin) {
+            peakPhase[kp] = phase[kp];
+        } else {
+            peakPhase[kp] = std::remainder(outPhase[dest] + hopSize * pitchShiftRatio * trueFreq[kp], twoPi);
+        }
+    }
+    firstFrame = false;
+
+    // Move every region by the shift of its peak, keeping the analysis phase relation to the peak (identity phase
+    // locking). DC is left untouched.
+    std::fill(outReal.begin(), outReal.end(), 0.f);
+    std::fill(outImag.begin(), outImag.end(), 0.f);
+    std::fill(outStrongest.begin(), outStrongest.end(), 0.f);
+    for (auto k = 1; k < numBins; k++) {
+        const auto kp = peakOf[k];
+        const auto dest = k + static_cast<int>(peakShift[kp]);
+        if (dest < 1 || dest > lastBin)
+            continue;
+
+        const auto ph = peakPhase[kp] + phase[k] - phase[kp];
+        outReal[dest] += magnitude[k] * std::cos(ph);
+        outImag[dest] += magnitude[k] * std::sin(ph);
+        if (magnitude[k] >= outStrongest[dest]) { // colliding regions - next frame continues the strongest one
+            outStrongest[dest] = magnitude[k];
+            outPhase[dest] = ph;
+        }
+    }
+
+    // Synthesis - Nyquist has to stay real
+    juce::FloatVectorOperations::copy(real.data() + 1, outReal.data() + 1, lastBin);
+    juce::FloatVectorOperations::copy(imag.data() + 1, outImag.data() + 1, lastBin);
+    imag[lastBin] = 0.f;
+
+    // Rebuild negative frequencies
+    for (auto j = 1; j < lastBin; j++) {
+        real[fftSize - j] = real[j];
+        imag[fftSize - j] = -imag[j];
+    }
+}
+
+void dsp::SpectralPitchShifter::findPeaks() {
+    const auto lastBin = numBins - 1;
+    auto prevPeak = -1;
+    for (auto j = 0; j < numBins; j++) {
+        const auto m = magnitude[j];
+        const auto isPeak = m > 0.f && (j < 1 || m > magnitude[j - 1]) && (j < 2 || m > magnitude[j - 2]) &&
+                            (j + 1 > lastBin || m >= magnitude[j + 1]) && (j + 2 > lastBin || m >= magnitude[j + 2]);
+        if (!isPeak)
+            continue;
+
+        if (prevPeak < 0) {
+            // everything below the first peak belongs to it
+            for (auto i = 0; i <= j; i++)
+                peakOf[i] = j;
+        } else {
+            // split the region between two peaks at the magnitude minimum
+            auto boundary = prevPeak;
+            for (auto i = prevPeak + 1; i < j; i++) {
+                if (magnitude[i] < magnitude[boundary])
+                    boundary = i;
+            }
+            for (auto i = prevPeak + 1; i <= boundary; i++)
+                peakOf[i] = prevPeak;
+            for (auto i = boundary + 1; i <= j; i++)
+                peakOf[i] = j;
+        }
+        prevPeak = j;
+    }
+
+    if (prevPeak < 0) {
+        // no peaks at all, every bin follows its own phase
+        for (auto j = 0; j < numBins; j++)
+            peakOf[j] = j;
+        return;
+    }
+    for (auto i = prevPeak + 1; i < numBins; i++)
+        peakOf[i] = prevPeak;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "../Helpers/dsp.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// Phase vocoder pitch shifter working directly on STFT frames. Used by DecomposeSTN to shift the masked sines
+/// spectrum before its inverse FFT, so the sines path does not need a second analysis / synthesis round trip.
+/// Frames are expected in the deinterleaved full-spectrum layout used by DecomposeSTN (fftSize real and fftSize
+/// imaginary values, Hann analysis and synthesis window).
+/// Shifting moves whole peak regions in frequency (so the window kernel around each sinusoid keeps its shape) and
+/// locks the phases of a region to its peak, whose phase advances with the shifted instantaneous frequency.
+class SpectralPitchShifter {
+  public:
+    SpectralPitchShifter() = default;
+    ~SpectralPitchShifter() = default;
+
+    /// Set pitch shift ratio. Supported range is 0.25 to 4.
+    /// - Parameter newPitchShiftRatio: Pitch shift ratio.
+    void setPitchShiftRatio(const float newPitchShiftRatio);
+
+    /// Resizes internal buffers for the given STFT configuration and resets the phase state.
+    /// - Parameters:
+    ///   - newFFTSize: FFT size of the frames passed to processFrame.
+    ///   - newHopSize: Hop size between consecutive frames.
+    void prepare(const int newFFTSize, const int newHopSize);
+
+    /// Clears the phase history, next frame starts with the analysis phases.
+    void reset();
+
+    /// Shifts a single frame in place. Upper half of the spectrum is rebuilt as the complex conjugate of the lower one.
+    /// - Parameters:
+    ///   - real: Real part of the spectrum, fftSize values.
+    ///   - imag: Imaginary part of the spectrum, fftSize values.
+    void processFrame(Vec1D &real, Vec1D &imag);
+
+  private:
+    /// Finds local maxima of the analysis magnitude spectrum and assigns every bin to the closest peak region.
+    void findPeaks();
+
+    int fftSize{0};
+    int hopSize{0};
+    int numBins{0}; // fftSize / 2 + 1
+
+    float pitchShiftRatio{1.f};
+
+    Vec1D magnitude;      // analysis magnitude
+    Vec1D phase;          // analysis phase
+    Vec1D prevPhase;      // analysis phase of the previous frame
+    Vec1D trueFreq;       // instantaneous frequency of each analysis bin [rad / sample]
+    Vec1D peakPhase;      // synthesis phase of every peak in this frame, indexed by the analysis bin
+    Vec1D peakShift;      // shift of every peak region in whole bins, indexed by the analysis bin
+    Vec1D outPhase;       // synthesis phase of every output bin in the previous frame
+    Vec1D outReal;        // shifted spectrum real
+    Vec1D outImag;        // shifted spectrum imag
+    Vec1D outStrongest;   // magnitude of the strongest bin moved to each output bin
+    std::vector<int> peakOf; // index of the peak each analysis bin is locked to
+
+    bool firstFrame{true};
+};
+} // namespace dsp
@@ -0,0 +1,140 @@
+#include "PolyphaseResampler.h"
+
+dsp::PolyphaseResampler::PolyphaseResampler() {
+    buildBanks();
+}
+
+void dsp::PolyphaseResampler::setQuality(const Quality newQuality) {
+    if (quality == newQuality && !coefficients.empty())
+        return;
+
+    quality = newQuality;
+    numTaps = getNumTaps(quality);
+    switch (quality) {
+    case Quality::low:
+        kaiserBeta = 5.f;
+        passband = 0.8f;
+        break;
+    case Quality::medium:
+        kaiserBeta = 7.f;
+        passband = 0.88f;
+        break;
+    case Quality::high:
+        kaiserBeta = 9.f;
+        passband = 0.92f;
+        break;
+    }
+
+    buildBanks();
+}
+
+int dsp::PolyphaseResampler::getNumTaps(const Quality tier) {
+    switch (tier) {
+    case Quality::low:
+        return 8;
+    case Quality::medium:
+        return 16;
+    case Quality::high:
+        return 32;
+    }
+    return 32;
+}
+
+void dsp::PolyphaseResampler::reset() {
+    std::fill(history.begin(), history.end(), 0.f);
+    historyPos = 0;
+    subSamplePos = 1.0;
+}
+
+void dsp::PolyphaseResampler::buildBanks() {
+    // Zeroth order modified Bessel function of the first kind, for the Kaiser window
+    const auto besselI0 = [](const double x) {
+        auto sum = 1.0;
+        auto term = 1.0;
+        for (auto k = 1; k < 32; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    };
+
+    const auto halfTaps = numTaps / 2;
+    const auto windowNorm = besselI0(kaiserBeta);
+    coefficients.resize(static_cast<size_t>(numBanks) * (numPhases + 1) * numTaps);
+
+    for (auto bank = 0; bank < numBanks; bank++) {
+        const auto speed = std::pow(2.0, static_cast<double>(bank) / banksPerOctave);
+        const auto cutoff = passband / speed; // relative to Nyquist
+
+        for (auto phase = 0; phase <= numPhases; phase++) {
+            const auto frac = static_cast<double>(phase) / numPhases;
+            auto *taps = coefficients.data() + (static_cast<size_t>(bank) * (numPhases + 1) + phase) * numTaps;
+
+            auto sum = 0.0;
+            for (auto i = 0; i < numTaps; i++) {
+                // tap i holds the input sample j = numTaps - 1 - i samples before the newest one, output time is
+                // halfTaps - frac samples before the newest one
+                const auto distance = static_cast<double>(numTaps - 1 - i - halfTaps) + frac;
+                const auto x = distance / halfTaps;
+                const auto window = std::abs(x) < 1.0 ? besselI0(kaiserBeta * std::sqrt(1.0 - x * x)) / windowNorm : 0.0;
+                const auto arg = juce::MathConstants<double>::pi * cutoff * distance;
+                const auto sinc = std::abs(arg) < 1e-9 ? 1.0 : std::sin(arg) / arg;
+                const auto tap = cutoff * sinc * window;
+                taps[i] = static_cast<float>(tap);
+                sum += tap;
+            }
+
+            // unity gain at DC for every phase
+            for (auto i = 0; i < numTaps; i++)
+                taps[i] = static_cast<float>(taps[i] / sum);
+        }
+    }
+
+    history.assign(numTaps * 2, 0.f);
+    reset();
+}
+
+void dsp::PolyphaseResampler::pushSample(const float sample) {
+    history[historyPos] = sample;
+    history[historyPos + numTaps] = sample;
+    if (++historyPos >= numTaps) historyPos = 0; // circular buffer
+}
+
+int dsp::PolyphaseResampler::process(const double speedRatio, const float *input, float *output,
+                                     const int numOutputSamplesToProduce, const int numInputSamplesAvailable,
+                                     const int wrapAround) {
+    jassert(speedRatio > 0.0);
+
+    // Lowest cutoff that still covers the speed ratio, no aliasing when reading faster than real time
+    const auto octaves = speedRatio > 1.0 ? std::log2(speedRatio) : 0.0;
+    const auto bank = juce::jmin(static_cast<int>(std::ceil(octaves * banksPerOctave - 1e-6)), numBanks - 1);
+    const auto *bankTaps = coefficients.data() + static_cast<size_t>(bank) * (numPhases + 1) * numTaps;
+
+    auto numUsed = 0;
+    auto inputPos = 0;
+    for (auto i = 0; i < numOutputSamplesToProduce; i++) {
+        while (subSamplePos >= 1.0) {
+            if (inputPos >= numInputSamplesAvailable && wrapAround > 0)
+                inputPos -= wrapAround;
+            pushSample(inputPos < numInputSamplesAvailable ? input[inputPos] : 0.f);
+            inputPos++;
+            numUsed++;
+            subSamplePos -= 1.0;
+        }
+
+        // Linear interpolation between the two closest tabulated phases
+        const auto phasePos = static_cast<float>(subSamplePos * numPhases);
+        const auto phase = juce::jmin(static_cast<int>(phasePos), numPhases - 1);
+        const auto alpha = phasePos - static_cast<float>(phase);
+        const auto *taps = bankTaps + static_cast<size_t>(phase) * numTaps;
+        const auto *window = history.data() + historyPos;
+
+        const auto y0 = helpers::dotProduct(taps, window, numTaps);
+        const auto y1 = helpers::dotProduct(taps + numTaps, window, numTaps);
+        output[i] = y0 + alpha * (y1 - y0);
+
+        subSamplePos += speedRatio;
+    }
+
+    return numUsed;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "../Helpers/simd.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// Windowed sinc resampler with precomputed polyphase filter banks. Drop-in replacement for
+/// juce::WindowedSincInterpolator: same streaming process() call, but every output sample is two SIMD inner products
+/// of the input history with tabulated taps instead of evaluating sinc per tap.
+/// When reading the input faster than real time (speed ratio above 1), a bank with a lowered cutoff is selected, so the
+/// result does not alias. Banks are built for speed ratios up to maxSpeedRatio.
+class PolyphaseResampler {
+  public:
+    /// Filter length tiers. Latency is half of the filter length.
+    enum class Quality {
+        low,    // 8 taps, 4 samples latency
+        medium, // 16 taps, 8 samples latency
+        high    // 32 taps, 16 samples latency
+    };
+
+    PolyphaseResampler();
+    ~PolyphaseResampler() = default;
+
+    /// Rebuilds the filter banks. Not audio thread safe.
+    /// - Parameter newQuality: Filter length tier.
+    void setQuality(const Quality newQuality);
+
+    /// Clears the input history.
+    void reset();
+
+    /// Resamples a stream of samples. Same semantics as juce::WindowedSincInterpolator::process.
+    /// - Parameters:
+    ///   - speedRatio: Number of input samples consumed per output sample.
+    ///   - input: Input samples.
+    ///   - output: Output samples.
+    ///   - numOutputSamplesToProduce: Number of output samples.
+    ///   - numInputSamplesAvailable: Number of readable input samples. When exceeded, input wraps back by wrapAround
+    ///     samples, or is read as zeros when wrapAround is 0.
+    ///   - wrapAround: See numInputSamplesAvailable.
+    /// - Returns: Number of input samples consumed.
+    int process(const double speedRatio, const float *input, float *output, const int numOutputSamplesToProduce,
+                const int numInputSamplesAvailable, const int wrapAround);
+
+    /// Exact latency in samples, input sample n comes out at time n + getBaseLatency() (in input samples).
+    int getBaseLatency() const { return numTaps / 2; }
+
+    /// Latency of a quality tier, without building its filter banks.
+    /// - Parameter tier: Filter length tier.
+    static int getBaseLatency(const Quality tier) { return getNumTaps(tier) / 2; }
+
+    /// Filter length of a quality tier.
+    /// - Parameter tier: Filter length tier.
+    static int getNumTaps(const Quality tier);
+
+  private:
+    /// Tabulates numPhases + 1 fractional delays of a Kaiser windowed sinc for every bank cutoff.
+    void buildBanks();
+
+    void pushSample(const float sample);
+
+    Quality quality{Quality::high};
+    int numTaps{32};
+    float kaiserBeta{9.f};
+    float passband{0.92f}; // cutoff relative to Nyquist of the slower rate
+
+    static constexpr int numPhases{128};
+    static constexpr int banksPerOctave{4};
+    static constexpr int maxSpeedRatio{4};
+    static constexpr int numBanks{banksPerOctave * 2 + 1}; // speed ratios 1 to maxSpeedRatio
+
+    Vec1D coefficients; // [bank][phase][tap], taps ordered oldest to newest input sample
+    Vec1D history;      // last numTaps input samples, stored twice so any window is contiguous
+    int historyPos{0};  // next write position, also the start of the contiguous window
+    double subSamplePos{1.0};
+};
+} // namespace dsp
@@ -0,0 +1,137 @@
+#include "RateReducer.h"
+
+int dsp::RateReducer::getFactorFor(const double sampleRate) {
+    auto newFactor = 1;
+    while (newFactor < maxFactor && sampleRate / (newFactor * 2) >= 44100.0)
+        newFactor *= 2;
+    return newFactor;
+}
+
+void dsp::RateReducer::prepare(const int newFactor, const int maximumBlockSize, const int maxPipelineLatency) {
+    jassert(juce::isPowerOfTwo(newFactor) && newFactor <= maxFactor);
+    factor = juce::jlimit(1, maxFactor, newFactor);
+    maxBlockSize = maximumBlockSize;
+    numTaps = tapsPerFactor * factor;
+    phaseTaps = numTaps / factor;
+
+    buildFilter();
+
+    inputHistory.setSize(numTaps);
+    lowHistory.setSize(phaseTaps);
+    processedHistory.setSize(phaseTaps);
+    highBand.setSize(maxBlockSize + maxPipelineLatency * factor);
+    lowBandGroup.assign(factor, 0.f);
+    processedGroup.assign(factor, 0.f);
+
+    reset();
+}
+
+void dsp::RateReducer::reset() {
+    inputHistory.reset();
+    lowHistory.reset();
+    processedHistory.reset();
+    highBand.reset();
+    std::fill(lowBandGroup.begin(), lowBandGroup.end(), 0.f);
+    std::fill(processedGroup.begin(), processedGroup.end(), 0.f);
+    lowBandPos = 0;
+    processedPos = 0;
+    downsamplePhase = 0;
+    upsamplePhase = 0;
+}
+
+void dsp::RateReducer::setPipelineLatency(const int lowSamples) {
+    jassert(maxBlockSize + lowSamples * factor <= highBand.getSize());
+    pipelineLatency = juce::jmin(lowSamples, (highBand.getSize() - maxBlockSize) / factor);
+}
+
+void dsp::RateReducer::buildFilter() {
+    // Zeroth order modified Bessel function of the first kind, for the Kaiser window
+    const auto besselI0 = [](const double x) {
+        auto sum = 1.0;
+        auto term = 1.0;
+        for (auto k = 1; k < 32; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    };
+
+    const auto cutoff = static_cast<double>(passband) / factor; // relative to the host Nyquist frequency
+    const auto centre = (numTaps - 1) * 0.5;
+    const auto windowNorm = besselI0(kaiserBeta);
+
+    std::vector<double> taps(numTaps);
+    auto sum = 0.0;
+    for (auto i = 0; i < numTaps; i++) {
+        const auto distance = i - centre;
+        const auto x = distance / (centre + 1.0);
+        const auto window = besselI0(kaiserBeta * std::sqrt(1.0 - x * x)) / windowNorm;
+        const auto arg = juce::MathConstants<double>::pi * cutoff * distance;
+        const auto sinc = std::abs(arg) < 1e-9 ? 1.0 : std::sin(arg) / arg;
+        taps[i] = cutoff * sinc * window;
+        sum += taps[i];
+    }
+
+    // Symmetric, so the order does not matter for decimation, unity gain at DC
+    decimationTaps.resize(numTaps);
+    for (auto i = 0; i < numTaps; i++)
+        decimationTaps[i] = static_cast<float>(taps[i] / sum);
+
+    // Host rate sample m * factor + phase is the sum of taps phase + k * factor times low rate sample m - k
+    interpolationTaps.resize(static_cast<size_t>(factor) * phaseTaps);
+    for (auto phase = 0; phase < factor; phase++) {
+        auto *phaseTapsPtr = interpolationTaps.data() + static_cast<size_t>(phase) * phaseTaps;
+        auto phaseSum = 0.0;
+        for (auto k = 0; k < phaseTaps; k++)
+            phaseSum += taps[phase + k * factor];
+        for (auto k = 0; k < phaseTaps; k++)
+            phaseTapsPtr[phaseTaps - 1 - k] = static_cast<float>(taps[phase + k * factor] / phaseSum);
+    }
+}
+
+void dsp::RateReducer::interpolate(const helpers::RingBuffer &history, Vec1D &dest) const {
+    for (auto phase = 0; phase < factor; phase++)
+        dest[phase] = helpers::dotProduct(interpolationTaps.data() + static_cast<size_t>(phase) * phaseTaps,
+                                          history.window(), phaseTaps);
+}
+
+int dsp::RateReducer::downsample(const float *input, const int numSamples, float *lowOutput) {
+    jassert(numSamples <= maxBlockSize);
+
+    auto numLowSamples = 0;
+    for (auto i = 0; i < numSamples; i++) {
+        inputHistory.push(input[i]);
+
+        if (++downsamplePhase >= factor) {
+            downsamplePhase = 0;
+            const auto low = helpers::dotProduct(decimationTaps.data(), inputHistory.window(), numTaps);
+            lowOutput[numLowSamples++] = low;
+
+            lowHistory.push(low);
+            interpolate(lowHistory, lowBandGroup);
+            lowBandPos = 0;
+        }
+
+        // Both bands are numTaps - 1 samples late, the interpolated one is read factor - 1 samples after the group
+        // of its low rate sample is complete
+        highBand.push(*inputHistory.window() - lowBandGroup[lowBandPos++]);
+    }
+    return numLowSamples;
+}
+
+void dsp::RateReducer::upsample(const float *lowInput, const int numLowSamples, float *output, const int numSamples) {
+    auto lowPos = 0;
+    const auto highBandDelay = pipelineLatency * factor;
+    for (auto i = 0; i < numSamples; i++) {
+        // Same grouping as downsample, every low rate sample is taken at the same position it was made
+        if (++upsamplePhase >= factor) {
+            upsamplePhase = 0;
+            jassert(lowPos < numLowSamples);
+            processedHistory.push(lowPos < numLowSamples ? lowInput[lowPos++] : 0.f);
+            interpolate(processedHistory, processedGroup);
+            processedPos = 0;
+        }
+
+        output[i] = processedGroup[processedPos++] + *highBand.window(i - numSamples - highBandDelay);
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "../Helpers/RingBuffer.h"
+#include "../Helpers/simd.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// Runs a mono pipeline at an integer fraction of the host sample rate. The input is low pass filtered and decimated,
+/// the pipeline output is interpolated back with the same Kaiser windowed sinc, both in polyphase form. The band above
+/// the internal Nyquist frequency is split off the input and added back unprocessed, delayed by the pipeline latency,
+/// so nothing is lost when the pipeline passes its input through.
+/// Usage per block: downsample, run the pipeline on the returned number of samples, upsample its output.
+class RateReducer {
+  public:
+    RateReducer() = default;
+    ~RateReducer() = default;
+
+    /// Builds the filters and sizes all buffers. Not audio thread safe.
+    /// - Parameters:
+    ///   - newFactor: Decimation factor, 1, 2 or 4.
+    ///   - maximumBlockSize: Largest host block.
+    ///   - maxPipelineLatency: Largest pipeline latency, in low rate samples.
+    void prepare(const int newFactor, const int maximumBlockSize, const int maxPipelineLatency);
+
+    /// Clears the filter histories and the delayed high band.
+    void reset();
+
+    /// Largest power of two factor, at most maxFactor, that keeps the internal rate at 44.1 kHz or above.
+    /// - Parameter sampleRate: Host sample rate.
+    static int getFactorFor(const double sampleRate);
+
+    int getFactor() const { return factor; }
+
+    /// Most low rate samples one call to downsample can return.
+    int getMaxLowBlockSize() const { return maxBlockSize / factor + 1; }
+
+    /// Latency of decimation and interpolation together, in host rate samples, pipeline not included.
+    int getLatency() const { return numTaps - 1; }
+
+    /// Delays the high band by the pipeline latency, so it lines up with the interpolated pipeline output.
+    /// - Parameter lowSamples: Pipeline latency in low rate samples.
+    void setPipelineLatency(const int lowSamples);
+
+    /// Decimates a block of host rate samples.
+    /// - Parameters:
+    ///   - input: Host rate samples.
+    ///   - numSamples: Number of host rate samples, at most the maximum block size.
+    ///   - lowOutput: Low rate samples, getMaxLowBlockSize() at most.
+    /// - Returns: Number of low rate samples written.
+    int downsample(const float *input, const int numSamples, float *lowOutput);
+
+    /// Interpolates the pipeline output of the block and adds the delayed high band. A reducer that never downsamples
+    /// has a silent high band and only interpolates, for further outputs of the same pipeline.
+    /// - Parameters:
+    ///   - lowInput: Pipeline output, as many samples as downsample returned for this block.
+    ///   - numLowSamples: Number of low rate samples.
+    ///   - output: Host rate samples.
+    ///   - numSamples: Number of host rate samples, same as given to downsample.
+    void upsample(const float *lowInput, const int numLowSamples, float *output, const int numSamples);
+
+    static constexpr int maxFactor{4};
+
+  private:
+    /// Tabulates the low pass at the host rate and its polyphase components for interpolation.
+    void buildFilter();
+
+    /// Interpolates the newest low rate sample of history into factor host rate samples.
+    void interpolate(const helpers::RingBuffer &history, Vec1D &dest) const;
+
+    int factor{1};
+    int maxBlockSize{0};
+    int numTaps{1};   // low pass length at the host rate, a multiple of factor
+    int phaseTaps{1}; // numTaps / factor, low rate samples per interpolated sample
+    int pipelineLatency{0};
+
+    static constexpr int tapsPerFactor{64};
+    static constexpr float passband{0.9f}; // cutoff relative to the internal Nyquist frequency
+    static constexpr float kaiserBeta{8.f};
+
+    Vec1D decimationTaps;    // oldest to newest input sample
+    Vec1D interpolationTaps; // [phase][tap], oldest to newest low rate sample, unity gain per phase
+
+    helpers::RingBuffer inputHistory;     // last numTaps input samples, head is the oldest
+    helpers::RingBuffer lowHistory;       // unprocessed low rate samples, for the high band
+    helpers::RingBuffer processedHistory; // pipeline output
+    helpers::RingBuffer highBand;         // input minus its low band, read pipelineLatency * factor later
+
+    Vec1D lowBandGroup;   // interpolated unprocessed samples of the newest low rate sample
+    Vec1D processedGroup; // interpolated pipeline output of the newest low rate sample
+    int lowBandPos{0};
+    int processedPos{0};
+    int downsamplePhase{0};
+    int upsamplePhase{0};
+};
+} // namespace dsp
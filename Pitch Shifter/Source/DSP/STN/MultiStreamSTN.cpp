@@ -0,0 +1,405 @@
+#include "MultiStreamSTN.h"
+#include "../Helpers/simd.h"
+
+namespace {
+/// Magnitudes of complex numbers stored as separate real and imaginary arrays.
+void magnitudes(float *dest, const float *real, const float *imag, const int size) {
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    namespace simd = dsp::helpers::simd;
+    for (; i + simd::numLanes <= size; i += simd::numLanes) {
+        const auto re = simd::load(real + i);
+        const auto im = simd::load(imag + i);
+        simd::store(dest + i, simd::sqrt(simd::add(simd::mul(re, re), simd::mul(im, im))));
+    }
+#endif
+    for (; i < size; i++) dest[i] = std::sqrt(real[i] * real[i] + imag[i] * imag[i]);
+}
+} // namespace
+
+dsp::MultiStreamSTN::MultiStreamSTN(std::shared_ptr<juce::dsp::ProcessSpec> procSpec, const int newNumStreams)
+    : processSpec(procSpec), numStreams(newNumStreams), noiseFeeds(static_cast<size_t>(newNumStreams), nullptr) {
+    jassert(numStreams == 4 || numStreams == 8 || numStreams == 16);
+    medianFilterVerS.setNumLanes(numStreams);
+    medianFilterVerTN.setNumLanes(numStreams);
+}
+
+void dsp::MultiStreamSTN::setWindowS(const int newWindowSizeS) {
+    const auto winSize = newWindowSizeS - (newWindowSizeS % 2);
+    if (fftSizeS == winSize) return;
+    fftSizeS = winSize;
+
+    prepare();
+}
+
+void dsp::MultiStreamSTN::setWindowTN(const int newWindowSizeTN) {
+    const auto winSize = newWindowSizeTN - (newWindowSizeTN % 2);
+    if (fftSizeTN == winSize) return;
+    fftSizeTN = winSize;
+
+    prepare();
+}
+
+void dsp::MultiStreamSTN::setOverlap(const int newOverlap) {
+    jassert(newOverlap == 2 || newOverlap == 4 || newOverlap == 8);
+    const auto ovl = juce::jlimit(2, 8, juce::nextPowerOfTwo(newOverlap));
+    if (overlap == ovl) return;
+    overlap = ovl;
+
+    prepare();
+}
+
+void dsp::MultiStreamSTN::setParallel(const bool shouldBeParallel) {
+    if (parallel == shouldBeParallel) return;
+    parallel = shouldBeParallel;
+
+    prepare();
+}
+
+void dsp::MultiStreamSTN::setThresholdSines(const float thresholdLow) {
+    threshold_s_2 = thresholdLow;
+    threshold_s_1 = thresholdLow + 0.1f;
+}
+
+void dsp::MultiStreamSTN::setThresholdTransients(const float thresholdLow) {
+    threshold_tn_2 = thresholdLow;
+    threshold_tn_1 = thresholdLow + 0.1f;
+}
+
+void dsp::MultiStreamSTN::setNoiseMagnitudeFeed(const int stream, NoiseMagnitudeFeed *newNoiseFeed) {
+    jassert(stream >= 0 && stream < numStreams);
+    auto &noiseFeed = noiseFeeds[static_cast<size_t>(stream)];
+    if (noiseFeed == newNoiseFeed) return;
+
+    noiseFeed = newNoiseFeed;
+    if (noiseFeed != nullptr) noiseFeed->prepare(fftSizeTN, hopSizeTN, processSpec->maximumBlockSize + noiseFeedHistory,
+                                                  windowPower);
+}
+
+void dsp::MultiStreamSTN::process(const juce::AudioBuffer<float> &buffer, juce::AudioBuffer<float> &S,
+                                  juce::AudioBuffer<float> &T, juce::AudioBuffer<float> &N) {
+    jassert(buffer.getNumChannels() >= numStreams && S.getNumChannels() >= numStreams &&
+            T.getNumChannels() >= numStreams && N.getNumChannels() >= numStreams);
+    const auto numSamples = buffer.getNumSamples();
+    const auto sinesDelaySamples = parallel ? 0 : fftSizeTN; // T and N are ready fftSizeTN samples after S
+
+    // Runs end on every hop, so the frames see the same samples as in DecomposeSTN
+    for (auto pos = 0; pos < numSamples;) {
+        const auto run = juce::jmin(numSamples - pos, hopSizeS - newSamplesCount, hopSizeTN - newSamplesCount2);
+        const auto numValues = run * numStreams;
+
+        for (auto s = 0; s < numStreams; s++) {
+            const auto *src = buffer.getReadPointer(s, pos);
+            for (auto i = 0; i < run; i++) laneInput[i * numStreams + s] = src[i];
+        }
+        bufferInput.push(laneInput.data(), numValues);
+
+        bufferS.pop(laneS.data(), numValues);
+        sinesDelay.push(laneS.data(), numValues);
+        const auto *delayedS = sinesDelay.window(-(run + sinesDelaySamples) * numStreams);
+        bufferT.pop(laneT.data(), numValues);
+        bufferN.pop(laneN.data(), numValues);
+
+        bufferTN.pop(laneResidual.data(), numValues);
+        inputTN.push(parallel ? laneInput.data() : laneResidual.data(), numValues); // round 2 input
+
+        for (auto s = 0; s < numStreams; s++) {
+            auto *dataS = S.getWritePointer(s, pos);
+            auto *dataT = T.getWritePointer(s, pos);
+            auto *dataN = N.getWritePointer(s, pos);
+            for (auto i = 0; i < run; i++) {
+                dataS[i] = delayedS[i * numStreams + s];
+                dataT[i] = laneT[i * numStreams + s];
+                dataN[i] = laneN[i * numStreams + s];
+            }
+        }
+        samplesProcessed += run;
+        pos += run;
+
+        newSamplesCount += run;
+        if (newSamplesCount >= hopSizeS) {
+            decompose_1();
+            newSamplesCount = 0;
+        }
+
+        newSamplesCount2 += run;
+        if (newSamplesCount2 >= hopSizeTN) {
+            decompose_2();
+            newSamplesCount2 = 0;
+        }
+    }
+}
+
+void dsp::MultiStreamSTN::forwardFrames(const helpers::RingBuffer &input, juce::dsp::FFT &fft, const Vec1D &window,
+                                        Vec1D &real, Vec1D &imag) {
+    const auto size = fft.getSize();
+    const auto *samples = input.window();
+    for (auto s = 0; s < numStreams; s++) {
+        for (auto i = 0; i < size; i++) frame[i] = samples[i * numStreams + s] * window[i]; // windowing
+        fft.performRealOnlyForwardTransform(frame.data());
+        for (auto k = 0; k < size; k++) {
+            real[k * numStreams + s] = frame[2 * k];
+            imag[k * numStreams + s] = frame[2 * k + 1];
+        }
+    }
+}
+
+void dsp::MultiStreamSTN::inverseFrames(const Vec1D &real, const Vec1D &imag, juce::dsp::FFT &fft,
+                                        const Vec1D &window, const float windowCorrection,
+                                        helpers::RingBuffer &output) {
+    const auto size = fft.getSize();
+    for (auto s = 0; s < numStreams; s++) {
+        for (auto k = 0; k < size; k++) {
+            frame[2 * k] = real[k * numStreams + s];
+            frame[2 * k + 1] = imag[k * numStreams + s];
+        }
+        fft.performRealOnlyInverseTransform(frame.data());
+        for (auto i = 0; i < size; i++) overlapAdd[i * numStreams + s] = frame[i] * window[i] * windowCorrection;
+    }
+    output.add(overlapAdd.data(), 0, size * numStreams); // overlap add
+}
+
+void dsp::MultiStreamSTN::fuzzySTN(Vec1D &S, Vec1D &T, Vec1D &N, Vec1D &rt, const float G1, const float G2,
+                                   medianfilter::LaneHorizontalMedianFilter &filterH,
+                                   medianfilter::LaneVerticalMedianFilter &filterV) {
+    const auto len = static_cast<int>(rt.size());
+
+    const auto &xHorizontal = filterH.process(rt);
+    const auto &xVertical = filterV.process(rt);
+
+    const auto tmp = juce::MathConstants<float>::pi / (2 * (G1 - G2));
+    auto i = 0;
+#if DSP_HELPERS_SIMD_FLOATS
+    namespace simd = helpers::simd;
+    const auto one = simd::splat(1.f);
+    const auto zero = simd::splat(0.f);
+    const auto upper = simd::splat(G1);
+    const auto lower = simd::splat(G2);
+    const auto width = simd::splat(G1 - G2);
+    const auto scale = simd::splat(tmp);
+    const auto epsilon = simd::splat(std::numeric_limits<float>::epsilon());
+
+    // 1 from G1 up, sin^2 ramp down to 0 at G2, the clamp makes the sine 0 below G2
+    const auto ramp = [&](const simd::Floats x) {
+        simd::Floats sin, cos;
+        simd::sinCos(simd::mul(scale, simd::min(simd::max(simd::sub(x, lower), zero), width)), sin, cos);
+        return simd::select(simd::greater(upper, x), simd::mul(sin, sin), one);
+    };
+
+    for (; i + simd::numLanes <= len; i += simd::numLanes) {
+        const auto vertical = simd::load(xVertical.data() + i);
+        const auto transientness =
+            simd::div(vertical, simd::add(simd::add(vertical, simd::load(xHorizontal.data() + i)), epsilon));
+        const auto sines = ramp(simd::sub(one, transientness));
+        const auto transients = ramp(transientness);
+        simd::store(rt.data() + i, transientness);
+        simd::store(S.data() + i, sines);
+        simd::store(T.data() + i, transients);
+        simd::store(N.data() + i, simd::sub(simd::sub(one, sines), transients));
+    }
+#endif
+    for (; i < len; i++) {
+        rt[i] = xVertical[i] / (xVertical[i] + xHorizontal[i] + std::numeric_limits<float>::epsilon());
+        const auto rs = 1 - rt[i];
+
+        if (rs >= G1) {
+            S[i] = 1;
+        } else if (rs >= G2) {
+            const auto sinRs = std::sin(tmp * (rs - G2));
+            S[i] = sinRs * sinRs;
+        } else {
+            S[i] = 0.f;
+        }
+
+        if (rt[i] >= G1) {
+            T[i] = 1;
+        } else if (rt[i] >= G2) {
+            const auto sinRt = std::sin(tmp * (rt[i] - G2));
+            T[i] = sinRt * sinRt;
+        } else {
+            T[i] = 0.f;
+        }
+
+        N[i] = 1 - S[i] - T[i];
+    }
+}
+
+void dsp::MultiStreamSTN::decompose_1() {
+    // Round 1
+    const auto len = fftSizeS * numStreams;
+    forwardFrames(bufferInput, *fftS, windowS, real1, imag1);
+    magnitudes(rt1.data(), real1.data(), imag1.data(), len);
+    juce::FloatVectorOperations::copy(real1TN.data(), real1.data(), len);
+    juce::FloatVectorOperations::copy(imag1TN.data(), imag1.data(), len);
+
+    fuzzySTN(mask1S, mask1T, mask1N, rt1, threshold_s_1, threshold_s_2, medianFilterHorS, medianFilterVerS);
+
+    // Parallel mode, only the mask is needed, round 2 splits the input
+    if (parallel) {
+        decimateSinesMask();
+        return;
+    }
+
+    juce::FloatVectorOperations::multiply(real1.data(), mask1S.data(), len); // Apply sines mask
+    juce::FloatVectorOperations::multiply(imag1.data(), mask1S.data(), len);
+
+    juce::FloatVectorOperations::add(mask1T.data(), mask1N.data(), len); // Add transients and noise masks
+    juce::FloatVectorOperations::multiply(real1TN.data(), mask1T.data(), len); // Apply summed mask
+    juce::FloatVectorOperations::multiply(imag1TN.data(), mask1T.data(), len);
+
+    inverseFrames(real1, imag1, *fftS, windowS, windowCorrectionS, bufferS);
+    inverseFrames(real1TN, imag1TN, *fftS, windowS, windowCorrectionS, bufferTN);
+}
+
+void dsp::MultiStreamSTN::decompose_2() {
+    // Round 2
+    const auto len = fftSizeTN * numStreams;
+    forwardFrames(inputTN, *fftTN, windowTN, real2T, imag2T);
+    if (!skipRound2) magnitudes(rt2.data(), real2T.data(), imag2T.data(), len);
+
+    if (parallel) {
+        // Sines are split off by the round 1 mask, the residual magnitude is analysed for T and N
+        juce::FloatVectorOperations::multiply(real2S.data(), real2T.data(), sinesMaskTN.data(), len);
+        juce::FloatVectorOperations::multiply(imag2S.data(), imag2T.data(), sinesMaskTN.data(), len);
+        juce::FloatVectorOperations::multiply(real2T.data(), residualMaskTN.data(), len);
+        juce::FloatVectorOperations::multiply(imag2T.data(), residualMaskTN.data(), len);
+        if (!skipRound2) juce::FloatVectorOperations::multiply(rt2.data(), residualMaskTN.data(), len);
+    }
+
+    juce::FloatVectorOperations::copy(real2NS.data(), real2T.data(), len);
+    juce::FloatVectorOperations::copy(imag2NS.data(), imag2T.data(), len);
+
+    // Skipped round 2, the residual is left unmasked as noise and T gets nothing
+    if (!skipRound2) {
+        fuzzySTN(mask2S, mask2T, mask2N, rt2, threshold_tn_1, threshold_tn_2, medianFilterHorTN, medianFilterVerTN);
+
+        juce::FloatVectorOperations::multiply(real2T.data(), mask2T.data(), len); // Apply transients mask
+        juce::FloatVectorOperations::multiply(imag2T.data(), mask2T.data(), len);
+
+        juce::FloatVectorOperations::add(mask2N.data(), mask2S.data(), len); // Add noise and sines masks
+        juce::FloatVectorOperations::multiply(real2NS.data(), mask2N.data(), len); // Apply summed mask
+        juce::FloatVectorOperations::multiply(imag2NS.data(), mask2N.data(), len);
+    }
+
+    // Noise envelope for NoiseMorphing, frame starts at the next output sample
+    for (auto s = 0; s < numStreams; s++) {
+        auto *noiseFeed = noiseFeeds[static_cast<size_t>(s)];
+        if (noiseFeed == nullptr) continue;
+
+        for (auto k = 0; k < fftSizeTN; k++) {
+            feedReal[k] = real2NS[k * numStreams + s];
+            feedImag[k] = imag2NS[k * numStreams + s];
+        }
+        noiseFeed->push(feedReal, feedImag, samplesProcessed);
+    }
+
+    inverseFrames(real2NS, imag2NS, *fftTN, windowTN, windowCorrectionTN, bufferN);
+    if (!skipRound2) inverseFrames(real2T, imag2T, *fftTN, windowTN, windowCorrectionTN, bufferT);
+
+    // No sines delay, S and T+N come from the same frame
+    if (parallel) inverseFrames(real2S, imag2S, *fftTN, windowTN, windowCorrectionTN, bufferS);
+}
+
+void dsp::MultiStreamSTN::prepare() {
+    const auto sizeS = static_cast<size_t>(fftSizeS * numStreams);
+    const auto sizeTN = static_cast<size_t>(fftSizeTN * numStreams);
+
+    hopSizeS = fftSizeS / overlap;
+    hopSizeTN = fftSizeTN / overlap;
+
+    bufferInput.setSize(fftSizeS * numStreams);
+    bufferS.setSize(fftSizeS * numStreams);
+    bufferTN.setSize(fftSizeS * numStreams);
+
+    inputTN.setSize(fftSizeTN * numStreams);
+    bufferT.setSize(fftSizeTN * numStreams);
+    bufferN.setSize(fftSizeTN * numStreams);
+    sinesDelay.setSize((fftSizeTN + hopSizeTN) * numStreams); // delay plus one run, runs never pass a hop
+
+    fftS = std::make_unique<juce::dsp::FFT>(static_cast<int>(log2(fftSizeS)));
+    fftTN = std::make_unique<juce::dsp::FFT>(static_cast<int>(log2(fftSizeTN)));
+    frame.resize(static_cast<size_t>(juce::jmax(fftSizeS, fftSizeTN)) * 2);
+    overlapAdd.resize(juce::jmax(sizeS, sizeTN));
+
+    for (auto *v : {&real1, &imag1, &real1TN, &imag1TN, &rt1, &mask1S, &mask1T, &mask1N}) v->assign(sizeS, 0.f);
+    for (auto *v : {&real2T, &imag2T, &real2NS, &imag2NS, &real2S, &imag2S, &rt2, &mask2S, &mask2T, &mask2N})
+        v->assign(sizeTN, 0.f);
+    sinesMaskTN.assign(sizeTN, 0.f);
+    residualMaskTN.assign(sizeTN, 1.f);
+
+    const auto runSize = static_cast<size_t>(juce::jmin(hopSizeS, hopSizeTN) * numStreams);
+    for (auto *v : {&laneInput, &laneS, &laneT, &laneN, &laneResidual}) v->assign(runSize, 0.f);
+    feedReal.resize(static_cast<size_t>(fftSizeTN));
+    feedImag.resize(static_cast<size_t>(fftSizeTN));
+
+    windowS.resize(fftSizeS + 1);
+    windowTN.resize(fftSizeTN + 1);
+    windowCorrectionS = fillWindow(windowS, fftSizeS);
+    windowCorrectionTN = fillWindow(windowTN, fftSizeTN);
+    windowPower = 1.f / (overlap * windowCorrectionTN);
+
+    // Time filters see every element on its own, frequency filters the bins of each stream
+    const auto sampleRate = static_cast<float>(processSpec->sampleRate);
+    medianFilterHorS.setFilterSize(medianFilterSize(filterLengthTime, hopSizeS / sampleRate));
+    medianFilterHorS.setSamplesSize(fftSizeS * numStreams);
+    medianFilterVerS.setFilterSize(medianFilterSize(filterLengthFreq, sampleRate / fftSizeS));
+    medianFilterVerS.setSamplesSize(fftSizeS);
+
+    medianFilterHorTN.setFilterSize(medianFilterSize(filterLengthTime, hopSizeTN / sampleRate));
+    medianFilterHorTN.setSamplesSize(fftSizeTN * numStreams);
+    medianFilterVerTN.setFilterSize(medianFilterSize(filterLengthFreq, sampleRate / fftSizeTN));
+    medianFilterVerTN.setSamplesSize(fftSizeTN);
+
+    newSamplesCount = 0;
+    newSamplesCount2 = 0;
+
+    for (auto *noiseFeed : noiseFeeds) {
+        if (noiseFeed != nullptr) noiseFeed->prepare(fftSizeTN, hopSizeTN, processSpec->maximumBlockSize + noiseFeedHistory,
+                                                      windowPower);
+    }
+}
+
+float dsp::MultiStreamSTN::fillWindow(Vec1D &window, const int size) const {
+    juce::dsp::WindowingFunction<float>::fillWindowingTables(
+        window.data(), size + 1, juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false);
+
+    // Window is applied twice, Hann^2 only sums to a constant from overlap 4 up. Sine window squared is Hann.
+    if (overlap < 4) {
+        for (auto &w : window) w = std::sqrt(w);
+    }
+
+    auto sumSq = 0.0;
+    for (auto i = 0; i < size; i++) sumSq += static_cast<double>(window[i]) * window[i];
+    return static_cast<float>((size / overlap) / sumSq);
+}
+
+void dsp::MultiStreamSTN::decimateSinesMask() {
+    jassert(fftSizeS % fftSizeTN == 0);
+    const auto ratio = fftSizeS / fftSizeTN;
+    const auto lastBinS = fftSizeS / 2;
+    const auto lastBinTN = fftSizeTN / 2;
+
+    // Largest value of the round 1 bins covering each round 2 bin, positive frequencies only, all streams at once
+    for (auto k = 0; k <= lastBinTN; k++) {
+        const auto first = juce::jmax(0, k * ratio - ratio / 2);
+        const auto last = juce::jmin(lastBinS, k * ratio + ratio / 2);
+        auto *peak = sinesMaskTN.data() + k * numStreams;
+        juce::FloatVectorOperations::clear(peak, numStreams);
+        for (auto j = first; j <= last; j++)
+            juce::FloatVectorOperations::max(peak, peak, mask1S.data() + j * numStreams, numStreams);
+    }
+
+    // Rebuild negative frequencies
+    for (auto k = 1; k < lastBinTN; k++) {
+        juce::FloatVectorOperations::copy(sinesMaskTN.data() + (fftSizeTN - k) * numStreams,
+                                          sinesMaskTN.data() + k * numStreams, numStreams);
+    }
+
+    const auto len = fftSizeTN * numStreams;
+    juce::FloatVectorOperations::fill(residualMaskTN.data(), 1.f, len);
+    juce::FloatVectorOperations::subtract(residualMaskTN.data(), sinesMaskTN.data(), len);
+}
+
+int dsp::MultiStreamSTN::medianFilterSize(const float length, const float resolution) {
+    return juce::jmax(3, static_cast<int>(length / resolution));
+}
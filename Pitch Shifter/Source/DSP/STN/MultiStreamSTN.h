@@ -0,0 +1,181 @@
+#pragma once
+#include "../Helpers/RingBuffer.h"
+#include "../MedianFilter/Lanes/LaneHorizontalMedianFilter.h"
+#include "../MedianFilter/Lanes/LaneVerticalMedianFilter.h"
+#include "../NM/NoiseMagnitudeFeed.h"
+#include <JuceHeader.h>
+
+using Vec1D = std::vector<float>;
+
+namespace dsp {
+/// DecomposeSTN for several independent mono streams with the same configuration, for batch processing. All streams
+/// run in lockstep: hops fall on the same samples, so the bookkeeping runs once per hop for all of them instead of
+/// once per sample and stream. State is stored structure of arrays, sample or bin by stream
+/// (index * getNumStreams() + stream), so masks, median filters, windowing and overlap-add handle one stream per SIMD
+/// lane. The FFTs stay per stream, on one plan per size. Outputs match a DecomposeSTN per stream up to float rounding.
+/// Fused sines are not supported, every stream would need its own shifter state.
+class MultiStreamSTN {
+  public:
+    /// - Parameters:
+    ///   - procSpec: Sample rate and largest block, shared by all streams.
+    ///   - newNumStreams: Number of streams, 4, 8 or 16.
+    MultiStreamSTN(std::shared_ptr<juce::dsp::ProcessSpec> procSpec, const int newNumStreams);
+    ~MultiStreamSTN() = default;
+
+    /// See DecomposeSTN::setWindowS. Not audio thread safe.
+    void setWindowS(const int newWindowSizeS);
+
+    /// See DecomposeSTN::setWindowTN. Not audio thread safe.
+    void setWindowTN(const int newWindowSizeTN);
+
+    /// See DecomposeSTN::setOverlap. Not audio thread safe.
+    void setOverlap(const int newOverlap);
+
+    /// See DecomposeSTN::setParallel. Not audio thread safe.
+    void setParallel(const bool shouldBeParallel);
+
+    /// See DecomposeSTN::setSkipRound2.
+    void setSkipRound2(const bool shouldSkip) { skipRound2 = shouldSkip; }
+
+    void setThresholdSines(const float thresholdLow);
+    void setThresholdTransients(const float thresholdLow);
+
+    /// When a feed is set, the N spectrum of every round 2 frame of the stream is published to it, like
+    /// DecomposeSTN::setNoiseMagnitudeFeed. Pass nullptr to stop publishing.
+    /// - Parameters:
+    ///   - stream: Stream index.
+    ///   - newNoiseFeed: Feed of the stream, read by the NoiseMorphing of that stream.
+    void setNoiseMagnitudeFeed(const int stream, NoiseMagnitudeFeed *newNoiseFeed);
+
+    /// Decomposes a block of every stream.
+    /// - Parameters:
+    ///   - buffer: One channel per stream.
+    ///   - S: Sines, one channel per stream.
+    ///   - T: Transients, one channel per stream.
+    ///   - N: Noise, one channel per stream.
+    void process(const juce::AudioBuffer<float> &buffer, juce::AudioBuffer<float> &S, juce::AudioBuffer<float> &T,
+                 juce::AudioBuffer<float> &N);
+
+    /// Allocates all buffers for the current configuration and clears the streams. Not audio thread safe.
+    void prepare();
+
+    int getNumStreams() const { return numStreams; }
+
+    /// Same as DecomposeSTN::getLatency.
+    int getLatency() const { return parallel ? fftSizeTN : fftSizeS + fftSizeTN; }
+
+  private:
+    /// Round 1 frame of every stream, see DecomposeSTN.
+    void decompose_1();
+
+    /// Round 2 frame of every stream, see DecomposeSTN.
+    void decompose_2();
+
+    /// Sines, transients and noise masks of every stream from the magnitudes, as DecomposeSTN::fuzzySTN.
+    /// - Parameters:
+    ///   - S: Sines mask.
+    ///   - T: Transients mask.
+    ///   - N: Noise mask.
+    ///   - rt: Magnitudes, overwritten by the transientness.
+    ///   - G1: Upper threshold.
+    ///   - G2: Lower threshold.
+    ///   - filterH: Median filter over time.
+    ///   - filterV: Median filter over frequency.
+    void fuzzySTN(Vec1D &S, Vec1D &T, Vec1D &N, Vec1D &rt, const float G1, const float G2,
+                  medianfilter::LaneHorizontalMedianFilter &filterH, medianfilter::LaneVerticalMedianFilter &filterV);
+
+    /// Windowed FFT of the newest fftSize samples of every stream, deinterleaved into lane spectra.
+    /// - Parameters:
+    ///   - input: Lane ring of fftSize samples.
+    ///   - fft: FFT of fftSize.
+    ///   - window: Analysis window.
+    ///   - real: Real parts, fftSize bins per stream.
+    ///   - imag: Imaginary parts, fftSize bins per stream.
+    void forwardFrames(const helpers::RingBuffer &input, juce::dsp::FFT &fft, const Vec1D &window, Vec1D &real,
+                       Vec1D &imag);
+
+    /// Inverse FFT of lane spectra, windowed, scaled and overlap-added to a lane ring.
+    /// - Parameters:
+    ///   - real: Real parts, fftSize bins per stream.
+    ///   - imag: Imaginary parts, fftSize bins per stream.
+    ///   - fft: FFT of fftSize.
+    ///   - window: Synthesis window.
+    ///   - windowCorrection: Overlap-add scaling.
+    ///   - output: Lane ring of fftSize samples.
+    void inverseFrames(const Vec1D &real, const Vec1D &imag, juce::dsp::FFT &fft, const Vec1D &window,
+                       const float windowCorrection, helpers::RingBuffer &output);
+
+    /// Reduces the round 1 sines mask to the round 2 resolution, parallel mode only.
+    void decimateSinesMask();
+
+    /// See DecomposeSTN::fillWindow.
+    float fillWindow(Vec1D &window, const int size) const;
+
+    /// See DecomposeSTN::medianFilterSize.
+    static int medianFilterSize(const float length, const float resolution);
+
+    std::shared_ptr<juce::dsp::ProcessSpec> processSpec;
+    const int numStreams;
+
+    // Lane rings, getNumStreams() floats per sample. Input rings have the oldest sample at the head, overlap-add rings
+    // the next output sample.
+    helpers::RingBuffer bufferInput; // input of round 1
+    helpers::RingBuffer bufferS;     // sines of round 1
+    helpers::RingBuffer bufferTN;    // transients and noise of round 1
+    helpers::RingBuffer inputTN;     // input of round 2
+    helpers::RingBuffer bufferT;     // transients of round 2
+    helpers::RingBuffer bufferN;     // noise of round 2
+    helpers::RingBuffer sinesDelay;  // sines wait fftSizeTN samples for T and N, cascaded mode only
+
+    std::vector<NoiseMagnitudeFeed *> noiseFeeds; // optional, one per stream
+    Vec1D feedReal; // N spectrum of one stream, for its feed
+    Vec1D feedImag;
+    juce::int64 samplesProcessed{0}; // number of output samples so far, never reset
+    const int noiseFeedHistory{4096}; // samples kept in the noise feeds on top of a block, longest consumer hop
+
+    int newSamplesCount{0};  // new samples since the last round 1 frame
+    int newSamplesCount2{0}; // new samples since the last round 2 frame
+
+    std::unique_ptr<juce::dsp::FFT> fftS;  // round 1, forward and inverse
+    std::unique_ptr<juce::dsp::FFT> fftTN; // round 2, forward and inverse
+    Vec1D frame; // one stream, interleaved complex FFT buffer
+
+    // Lane spectra, full spectrum of every stream
+    Vec1D real1, imag1, real1TN, imag1TN, rt1, mask1S, mask1T, mask1N;
+    Vec1D real2T, imag2T, real2NS, imag2NS, real2S, imag2S, rt2, mask2S, mask2T, mask2N;
+    Vec1D sinesMaskTN;    // round 1 sines mask at round 2 resolution, parallel mode
+    Vec1D residualMaskTN; // 1 - sinesMaskTN, parallel mode
+    Vec1D overlapAdd;     // windowed frame of every stream, lane layout
+
+    // One block of lane samples, up to a hop
+    Vec1D laneInput, laneS, laneT, laneN, laneResidual;
+
+    Vec1D windowS;
+    Vec1D windowTN;
+
+    int fftSizeS{2048};
+    int fftSizeTN{512};
+    int overlap{8};
+    bool parallel{false};
+    bool skipRound2{false};
+    int hopSizeS{fftSizeS / overlap};
+    int hopSizeTN{fftSizeTN / overlap};
+
+    const float filterLengthTime{0.05f}; // 50ms
+    const float filterLengthFreq{500.f}; // 500Hz
+
+    medianfilter::LaneHorizontalMedianFilter medianFilterHorS;
+    medianfilter::LaneHorizontalMedianFilter medianFilterHorTN;
+    medianfilter::LaneVerticalMedianFilter medianFilterVerS;
+    medianfilter::LaneVerticalMedianFilter medianFilterVerTN;
+
+    float threshold_s_1{0.8f};
+    float threshold_s_2{0.7f};
+    float threshold_tn_1{0.85f};
+    float threshold_tn_2{0.75f};
+
+    float windowCorrectionS{1.f / 3.0f};
+    float windowCorrectionTN{1.f / 3.0f};
+    float windowPower{0.375f};
+};
+} // namespace dsp
@@ -3,7 +3,7 @@
 dsp::DecomposeSTN::DecomposeSTN(
     std::shared_ptr<juce::dsp::ProcessSpec> procSpec)
     : processSpec(procSpec), sinesDelayLine(1024), forwardFFT(13), inverseFFTS(13), inverseFFTTN(13), forwardFFTTN(9),
-inverseFFTT(9), inverseFFTN(9) {};
+inverseFFTT(9), inverseFFTN(9), inverseFFTS2(9) {};
 
 void dsp::DecomposeSTN::setWindowS(const int newWindowSizeS) {
     // Assert power of two
@@ -27,6 +27,26 @@ void dsp::DecomposeSTN::setWindowTN(const int newWindowSizeTN) {
     prepare();
 }
 
+void dsp::DecomposeSTN::setOverlap(const int newOverlap) {
+    jassert(newOverlap == 2 || newOverlap == 4 || newOverlap == 8);
+    const auto ovl = juce::jlimit(2, 8, juce::nextPowerOfTwo(newOverlap));
+    if(overlap == ovl) return;
+    
+    DBG("New Overlap = " + juce::String(ovl));
+    overlap = ovl;
+
+    prepare();
+}
+
+void dsp::DecomposeSTN::setParallel(const bool shouldBeParallel) {
+    if(parallel == shouldBeParallel) return;
+    
+    DBG("Parallel STN = " + juce::String(shouldBeParallel ? "on" : "off"));
+    parallel = shouldBeParallel;
+
+    prepare();
+}
+
 void dsp::DecomposeSTN::setThresholdSines(const float thresholdLow) {
     threshold_s_2 = thresholdLow;
     threshold_s_1 = thresholdLow + 0.1f;
@@ -37,6 +57,35 @@ void dsp::DecomposeSTN::setThresholdTransients(const float thresholdLow) {
     threshold_tn_1 = thresholdLow + 0.1f;
 }
 
+void dsp::DecomposeSTN::setSinesShifter(SpectralPitchShifter *newSinesShifter) {
+    if (sinesShifter == newSinesShifter) return;
+
+    sinesShifter = newSinesShifter;
+    prepareSinesShifter();
+}
+
+void dsp::DecomposeSTN::setSinesShifterEnabled(const bool shouldBeEnabled) {
+    if (sinesShifterEnabled == shouldBeEnabled) return;
+
+    sinesShifterEnabled = shouldBeEnabled;
+    if (sinesShifterEnabled && sinesShifter != nullptr) sinesShifter->reset();
+}
+
+void dsp::DecomposeSTN::prepareSinesShifter() {
+    if (sinesShifter == nullptr) return;
+    
+    if (parallel) sinesShifter->prepare(fftSizeTN, hopSizeTN);
+    else sinesShifter->prepare(fftSizeS, hopSizeS);
+}
+
+void dsp::DecomposeSTN::setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed) {
+    if (noiseFeed == newNoiseFeed) return;
+
+    noiseFeed = newNoiseFeed;
+    if (noiseFeed != nullptr) noiseFeed->prepare(fftSizeTN, hopSizeTN, processSpec->maximumBlockSize + noiseFeedHistory,
+                                                  windowPower);
+}
+
 void dsp::DecomposeSTN::fuzzySTN(STN& stn, Vec1D& rt,
                                  const float G1, const float G2,
                                  medianfilter::HorizontalMedianFilter& filterH,
@@ -106,48 +155,49 @@ void dsp::DecomposeSTN::process(const juce::AudioBuffer<float> &buffer,
     auto dataN = N.getWritePointer(0);
     
     for(auto i = 0; i < numSamples; i++){
-        bufferInput[inputWritePtr] = data[i];
+        bufferInput.push(data[i]);
     
-        sinesDelayLine.pushSample(0, bufferS[bufferSTN1ReadWritePtr]);
+        sinesDelayLine.pushSample(0, bufferS.pop());
         
         dataS[i] = sinesDelayLine.popSample(0);
-        dataT[i] = bufferT[bufferSTN2ReadWritePtr];
-        dataN[i] = bufferN[bufferSTN2ReadWritePtr];
+        dataT[i] = bufferT.pop();
+        dataN[i] = bufferN.pop();
         
-        inputTN[inputTNWritePtr] = bufferTN[bufferSTN1ReadWritePtr];
-        
-        bufferS[bufferSTN1ReadWritePtr] =  0;
-        bufferTN[bufferSTN1ReadWritePtr] = 0;
-        bufferT[bufferSTN2ReadWritePtr] = 0;
-        bufferN[bufferSTN2ReadWritePtr] = 0;
-        
-        if(++inputWritePtr >= bufferInput.size()) inputWritePtr = 0; // circular buffer
-        if(++bufferSTN1ReadWritePtr >= bufferS.size()) bufferSTN1ReadWritePtr = 0; // circular buffer
-        if(++inputTNWritePtr >= inputTN.size()) inputTNWritePtr = 0; // circular buffer
-        if(++bufferSTN2ReadWritePtr >= bufferT.size()) bufferSTN2ReadWritePtr = 0; // circular buffer
+        const auto residual = bufferTN.pop();
+        inputTN.push(parallel ? data[i] : residual); // round 2 input
+        samplesProcessed++;
         
         newSamplesCount++;
         if(newSamplesCount >= hopSizeS){
-            decompose_1(inputWritePtr);
+            frameWeight1 = nextFrameWeight(reduction1, oddFrame1, !parallel);
+            if(frameWeight1 > 0.f) decompose_1();
             newSamplesCount = 0;
         }
         
         newSamplesCount2++;
         if(newSamplesCount2 >= hopSizeTN){
-            decompose_2(inputTNWritePtr);
+            frameWeight2 = nextFrameWeight(reduction2, oddFrame2, parallel);
+            if(frameWeight2 > 0.f) decompose_2();
             newSamplesCount2 = 0;
         }
          
     }
 }
 
-void dsp::DecomposeSTN::decompose_1(const int ptr){
-    // Copy new samples to FFT vector
-    juce::FloatVectorOperations::copy(fft_1.data(), bufferInput.data() + ptr, fftSizeS - ptr);
-    juce::FloatVectorOperations::copy(fft_1.data() + (fftSizeS - ptr), bufferInput.data(), ptr);
-    
+float dsp::DecomposeSTN::nextFrameWeight(int &reduction, bool &oddFrame, const bool feedsShifter) const {
+    const auto shifting = sinesShifter != nullptr && sinesShifterEnabled;
+    const auto reduce = reducedOverlap && overlap >= 8 && !(feedsShifter && shifting);
+    reduction = juce::jlimit(0, reductionFrames, reduction + (reduce ? 1 : -1));
+    oddFrame = !oddFrame;
+
+    // Odd frames fade out while even frames fade up to twice the weight, both at the same step
+    const auto amount = static_cast<float>(reduction) / reductionFrames;
+    return oddFrame ? 1.f - amount : 1.f + amount;
+}
+
+void dsp::DecomposeSTN::decompose_1(){
     // Round 1
-    juce::FloatVectorOperations::multiply(fft_1.data(), windowS.data(), fftSizeS); // windowing
+    juce::FloatVectorOperations::multiply(fft_1.data(), bufferInput.window(), windowS.data(), fftSizeS); // windowing
     forwardFFT.performRealOnlyForwardTransform(fft_1.data()); // FFT
     
     helpers::absInterleavedFFT(rtS, fft_1, fftSizeS); // abs of complex vector
@@ -160,9 +210,17 @@ void dsp::DecomposeSTN::decompose_1(const int ptr){
              threshold_s_1, threshold_s_2,
              medianFilterHorS, medianFilterVerS);
     
+    // Parallel mode, only the mask is needed, round 2 splits the input
+    if (parallel) {
+        decimateSinesMask();
+        return;
+    }
+    
     juce::FloatVectorOperations::multiply(real_fft_1_s.data(), stn1.S.data(),  fftSizeS); // Apply sines mask real
     juce::FloatVectorOperations::multiply(imag_fft_1_s.data(), stn1.S.data(),  fftSizeS); // Apply sines mask imag
     
+    if (sinesShifter != nullptr && sinesShifterEnabled) sinesShifter->processFrame(real_fft_1_s, imag_fft_1_s); // Fused sines pitch shifting
+    
     juce::FloatVectorOperations::add(stn1.T.data(), stn1.N.data(), fftSizeS); // Add transients and noise masks
     juce::FloatVectorOperations::multiply(real_fft_1_tn.data(), stn1.T.data(), fftSizeS); // Apply summed mask real
     juce::FloatVectorOperations::multiply(imag_fft_1_tn.data(), stn1.T.data(), fftSizeS); // Apply summed mask imag
@@ -177,70 +235,88 @@ void dsp::DecomposeSTN::decompose_1(const int ptr){
     juce::FloatVectorOperations::multiply(fft_1.data(), windowS.data(), fftSizeS); // windowing
     juce::FloatVectorOperations::multiply(fft_1_tn.data(), windowS.data(), fftSizeS); // windowing
     
-    juce::FloatVectorOperations::multiply(fft_1.data(), windowCorrection, fftSizeS); // overlap add scaling
-    juce::FloatVectorOperations::multiply(fft_1_tn.data(), windowCorrection, fftSizeS); // overlap add scaling
+    const auto correctionS = windowCorrectionS * frameWeight1;
+    juce::FloatVectorOperations::multiply(fft_1.data(), correctionS, fftSizeS); // overlap add scaling
+    juce::FloatVectorOperations::multiply(fft_1_tn.data(), correctionS, fftSizeS); // overlap add scaling
     
-    for (auto j = 0; j < fftSizeS; j++) {
-        bufferS[(bufferSTN1ReadWritePtr + j) % bufferS.size()] += fft_1[j];
-        bufferTN[(bufferSTN1ReadWritePtr + j) % bufferTN.size()] += fft_1_tn[j];
-    }
+    bufferS.add(fft_1.data(), 0, fftSizeS); // overlap add
+    bufferTN.add(fft_1_tn.data(), 0, fftSizeS);
 }
 
-void dsp::DecomposeSTN::decompose_2(const int ptr){
+void dsp::DecomposeSTN::decompose_2(){
+    const auto correctionTN = windowCorrectionTN * frameWeight2;
     
     // Round 2
-    // Copy new samples to FFT vector
-    juce::FloatVectorOperations::copy(fft_2.data(), inputTN.data() + ptr, fftSizeTN - ptr);
-    juce::FloatVectorOperations::copy(fft_2.data() + (fftSizeTN - ptr), inputTN.data(), ptr);
-
-    juce::FloatVectorOperations::multiply(fft_2.data(), windowTN.data(), fftSizeTN); // windowing
+    juce::FloatVectorOperations::multiply(fft_2.data(), inputTN.window(), windowTN.data(), fftSizeTN); // windowing
     forwardFFTTN.performRealOnlyForwardTransform(fft_2.data());
     
-    helpers::absInterleavedFFT(rtTN, fft_2, fftSizeTN); // abs of complex vector
+    if (!skipRound2) helpers::absInterleavedFFT(rtTN, fft_2, fftSizeTN); // abs of complex vector
     // deinterleaving for easiness of calcs
     helpers::deinterleaveFFT(real_fft_2_t, imag_fft_2_t, fft_2, fftSizeTN);
+    
+    if (parallel) {
+        // Sines are split off by the round 1 mask, the residual magnitude is analysed for T and N
+        juce::FloatVectorOperations::multiply(real_fft_2_s.data(), real_fft_2_t.data(), sinesMaskTN.data(), fftSizeTN);
+        juce::FloatVectorOperations::multiply(imag_fft_2_s.data(), imag_fft_2_t.data(), sinesMaskTN.data(), fftSizeTN);
+        juce::FloatVectorOperations::multiply(real_fft_2_t.data(), residualMaskTN.data(), fftSizeTN);
+        juce::FloatVectorOperations::multiply(imag_fft_2_t.data(), residualMaskTN.data(), fftSizeTN);
+        if (!skipRound2) juce::FloatVectorOperations::multiply(rtTN.data(), residualMaskTN.data(), fftSizeTN);
+    }
+    
     juce::FloatVectorOperations::copy(real_fft_2_ns.data(), real_fft_2_t.data(), fftSizeTN);
     juce::FloatVectorOperations::copy(imag_fft_2_ns.data(), imag_fft_2_t.data(), fftSizeTN);
     
-    
-    fuzzySTN(stn2, rtTN,
-             threshold_tn_1, threshold_tn_2,
-             medianFilterHorTN, medianFilterVerTN);
+    // Skipped round 2, the residual is left unmasked as noise and T gets nothing
+    if (!skipRound2) {
+        fuzzySTN(stn2, rtTN,
+                 threshold_tn_1, threshold_tn_2,
+                 medianFilterHorTN, medianFilterVerTN);
 
-    juce::FloatVectorOperations::multiply(real_fft_2_t.data(), stn2.T.data(), fftSizeTN); // Apply transients mask
-    juce::FloatVectorOperations::multiply(imag_fft_2_t.data(), stn2.T.data(), fftSizeTN); // Apply transients mask
+        juce::FloatVectorOperations::multiply(real_fft_2_t.data(), stn2.T.data(), fftSizeTN); // Apply transients mask
+        juce::FloatVectorOperations::multiply(imag_fft_2_t.data(), stn2.T.data(), fftSizeTN); // Apply transients mask
 
-    juce::FloatVectorOperations::add(stn2.N.data(), stn2.S.data(), fftSizeTN); // Add noise and sines masks
-    juce::FloatVectorOperations::multiply(real_fft_2_ns.data(), stn2.N.data(), fftSizeTN); // Apply summed mask
-    juce::FloatVectorOperations::multiply(imag_fft_2_ns.data(), stn2.N.data(), fftSizeTN); // Apply summed mask
+        juce::FloatVectorOperations::add(stn2.N.data(), stn2.S.data(), fftSizeTN); // Add noise and sines masks
+        juce::FloatVectorOperations::multiply(real_fft_2_ns.data(), stn2.N.data(), fftSizeTN); // Apply summed mask
+        juce::FloatVectorOperations::multiply(imag_fft_2_ns.data(), stn2.N.data(), fftSizeTN); // Apply summed mask
+    }
+    
+    // Noise envelope for NoiseMorphing, frame starts at the next output sample
+    if (noiseFeed != nullptr) noiseFeed->push(real_fft_2_ns, imag_fft_2_ns, samplesProcessed);
     
     // interleave the samples back
-    helpers::interleaveFFT(fft_2, real_fft_2_t, imag_fft_2_t, fftSizeTN);
     helpers::interleaveFFT(fft_2_ns, real_fft_2_ns, imag_fft_2_ns, fftSizeTN);
-    
-    inverseFFTT.performRealOnlyInverseTransform(fft_2.data()); // IFFT
-    inverseFFTN.performRealOnlyInverseTransform(fft_2_ns.data());
-
-    juce::FloatVectorOperations::multiply(fft_2.data(), windowTN.data(), fftSizeTN); // windowing
+    inverseFFTN.performRealOnlyInverseTransform(fft_2_ns.data()); // IFFT
     juce::FloatVectorOperations::multiply(fft_2_ns.data(), windowTN.data(), fftSizeTN); // windowing
+    juce::FloatVectorOperations::multiply(fft_2_ns.data(), correctionTN, fftSizeTN); // overlap add scaling
+    bufferN.add(fft_2_ns.data(), 0, fftSizeTN); // overlap add
     
-    juce::FloatVectorOperations::multiply(fft_2.data(), windowCorrection, fftSizeTN); // overlap add scaling
-    juce::FloatVectorOperations::multiply(fft_2_ns.data(), windowCorrection, fftSizeTN); // overlap add scaling
-
-    for (auto j = 0; j < fftSizeTN; j++) {
-        bufferT[(bufferSTN2ReadWritePtr + j) % bufferT.size()] += fft_2[j];
-        bufferN[(bufferSTN2ReadWritePtr + j) % bufferN.size()] += fft_2_ns[j];
+    if (!skipRound2) {
+        helpers::interleaveFFT(fft_2, real_fft_2_t, imag_fft_2_t, fftSizeTN);
+        inverseFFTT.performRealOnlyInverseTransform(fft_2.data()); // IFFT
+        juce::FloatVectorOperations::multiply(fft_2.data(), windowTN.data(), fftSizeTN); // windowing
+        juce::FloatVectorOperations::multiply(fft_2.data(), correctionTN, fftSizeTN); // overlap add scaling
+        bufferT.add(fft_2.data(), 0, fftSizeTN); // overlap add
+    }
+    
+    if (parallel) {
+        if (sinesShifter != nullptr && sinesShifterEnabled) sinesShifter->processFrame(real_fft_2_s, imag_fft_2_s); // Fused sines pitch shifting
+        
+        helpers::interleaveFFT(fft_2_s, real_fft_2_s, imag_fft_2_s, fftSizeTN);
+        inverseFFTS2.performRealOnlyInverseTransform(fft_2_s.data()); // IFFT
+        juce::FloatVectorOperations::multiply(fft_2_s.data(), windowTN.data(), fftSizeTN); // windowing
+        juce::FloatVectorOperations::multiply(fft_2_s.data(), correctionTN, fftSizeTN); // overlap add scaling
+        bufferS.add(fft_2_s.data(), 0, fftSizeTN); // no sines delay, S and T+N come from the same frame
     }
 }
 
 void dsp::DecomposeSTN::prepare() {
-    bufferInput.resize(fftSizeS);
-    bufferS.resize(fftSizeS);
-    bufferTN.resize(fftSizeS);
+    bufferInput.setSize(fftSizeS);
+    bufferS.setSize(fftSizeS);
+    bufferTN.setSize(fftSizeS);
     
-    inputTN.resize(fftSizeTN);
-    bufferT.resize(fftSizeTN);
-    bufferN.resize(fftSizeTN);
+    inputTN.setSize(fftSizeTN);
+    bufferT.setSize(fftSizeTN);
+    bufferN.setSize(fftSizeTN);
     
     const auto pow2S = log2(fftSizeS);
     forwardFFT = juce::dsp::FFT(pow2S);
@@ -260,23 +336,23 @@ void dsp::DecomposeSTN::prepare() {
     
     sinesDelayLine.prepare({processSpec->sampleRate, processSpec->maximumBlockSize, 1});
     sinesDelayLine.setMaximumDelayInSamples(fftSizeTN);
-    sinesDelayLine.setDelay(fftSizeTN);
+    sinesDelayLine.setDelay(parallel ? 0 : fftSizeTN);
     sinesDelayLine.reset();
     
-    juce::dsp::WindowingFunction<float>::fillWindowingTables(
-        windowS.data(), fftSizeS + 1,
-        juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false);
+    windowCorrectionS = fillWindow(windowS, fftSizeS);
 
-    medianFilterHorS.setFilterSize(std::div(static_cast<int>(filterLengthTime * processSpec->sampleRate), hopSizeS).quot);
+    const auto sampleRate = static_cast<float>(processSpec->sampleRate);
+    medianFilterHorS.setFilterSize(medianFilterSize(filterLengthTime, hopSizeS / sampleRate));
     medianFilterHorS.setSamplesSize(fftSizeS);
 
-    medianFilterVerS.setFilterSize(std::div(static_cast<int>(filterLengthFreq * fftSizeS), static_cast<int>(processSpec->sampleRate)).quot);
+    medianFilterVerS.setFilterSize(medianFilterSize(filterLengthFreq, sampleRate / fftSizeS));
     medianFilterVerS.setSamplesSize(fftSizeS);
     
     const auto pow2TN = log2(fftSizeTN);
     forwardFFTTN = juce::dsp::FFT(pow2TN);
     inverseFFTT = juce::dsp::FFT(pow2TN);
     inverseFFTN = juce::dsp::FFT(pow2TN);
+    inverseFFTS2 = juce::dsp::FFT(pow2TN);
 
     hopSizeTN = fftSizeTN / overlap;
     windowTN.resize(fftSizeTN + 1);
@@ -286,17 +362,69 @@ void dsp::DecomposeSTN::prepare() {
     imag_fft_2_t.resize(fftSizeTN);
     real_fft_2_ns.resize(fftSizeTN);
     imag_fft_2_ns.resize(fftSizeTN);
+    fft_2_s.resize(fftSizeTN * 2);
+    real_fft_2_s.resize(fftSizeTN);
+    imag_fft_2_s.resize(fftSizeTN);
+    sinesMaskTN.assign(fftSizeTN, 0.f);
+    residualMaskTN.assign(fftSizeTN, 1.f);
     rtTN.resize(fftSizeTN);
     stn2.resize(fftSizeTN);
 
-    juce::dsp::WindowingFunction<float>::fillWindowingTables(
-        windowTN.data(), fftSizeTN + 1,
-        juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false);
+    windowCorrectionTN = fillWindow(windowTN, fftSizeTN);
+    windowPower = 1.f / (overlap * windowCorrectionTN);
+    prepareSinesShifter();
     
-    medianFilterHorTN.setFilterSize(std::div(static_cast<int>(filterLengthTime * processSpec->sampleRate), hopSizeTN).quot);
+    medianFilterHorTN.setFilterSize(medianFilterSize(filterLengthTime, hopSizeTN / sampleRate));
     medianFilterHorTN.setSamplesSize(fftSizeTN);
     
-    medianFilterVerTN.setFilterSize(std::div(static_cast<int>(filterLengthFreq * fftSizeTN), static_cast<int>(processSpec->sampleRate)).quot);
+    medianFilterVerTN.setFilterSize(medianFilterSize(filterLengthFreq, sampleRate / fftSizeTN));
     medianFilterVerTN.setSamplesSize(fftSizeTN);
 
+    if (noiseFeed != nullptr) noiseFeed->prepare(fftSizeTN, hopSizeTN, processSpec->maximumBlockSize + noiseFeedHistory,
+                                                  windowPower);
+}
+
+float dsp::DecomposeSTN::fillWindow(Vec1D &window, const int size) const {
+    juce::dsp::WindowingFunction<float>::fillWindowingTables(
+        window.data(), size + 1,
+        juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false);
+    
+    // Window is applied twice, Hann^2 only sums to a constant from overlap 4 up. Sine window squared is Hann.
+    if (overlap < 4) {
+        for (auto& w : window) w = std::sqrt(w);
+    }
+    
+    auto sumSq = 0.0;
+    for (auto i = 0; i < size; i++) sumSq += static_cast<double>(window[i]) * window[i];
+    return static_cast<float>((size / overlap) / sumSq);
+}
+
+void dsp::DecomposeSTN::decimateSinesMask() {
+    jassert(fftSizeS % fftSizeTN == 0);
+    const auto ratio = fftSizeS / fftSizeTN;
+    const auto lastBinS = fftSizeS / 2;
+    const auto lastBinTN = fftSizeTN / 2;
+    
+    // Largest value of the round 1 bins covering each round 2 bin, positive frequencies only. A sine is a few round 1
+    // bins wide but spreads over the whole round 2 bin, averaging would leave most of it in the residual.
+    for (auto k = 0; k <= lastBinTN; k++) {
+        const auto first = juce::jmax(0, k * ratio - ratio / 2);
+        const auto last = juce::jmin(lastBinS, k * ratio + ratio / 2);
+        auto peak = 0.f;
+        for (auto j = first; j <= last; j++) peak = juce::jmax(peak, stn1.S[j]);
+        sinesMaskTN[k] = peak;
+    }
+    
+    // Rebuild negative frequencies
+    for (auto k = 1; k < lastBinTN; k++) {
+        sinesMaskTN[fftSizeTN - k] = sinesMaskTN[k];
+    }
+    
+    for (auto k = 0; k < fftSizeTN; k++) {
+        residualMaskTN[k] = 1.f - sinesMaskTN[k];
+    }
+}
+
+int dsp::DecomposeSTN::medianFilterSize(const float length, const float resolution) {
+    return juce::jmax(3, static_cast<int>(length / resolution));
 }
@@ -1,7 +1,10 @@
 #pragma once
 #include "../Helpers/dsp.h"
+#include "../Helpers/RingBuffer.h"
 #include "../MedianFilter/Horizontal/HorizontalMedianFilter.h"
 #include "../MedianFilter/Vertical/VerticalMedianFilter.h"
+#include "../NM/NoiseMagnitudeFeed.h"
+#include "../PS/SpectralPitchShifter.h"
 #include <JuceHeader.h>
 
 using Vec2D = std::vector<std::vector<float>>;
@@ -28,43 +31,125 @@ class DecomposeSTN {
 
     void setWindowS(const int newWindowSizeS);
     void setWindowTN(const int newWindowSizeTN);
+
+    /// Set number of overlapping frames per window, used by both rounds. Not audio thread safe.
+    /// Every hop costs one forward FFT, two inverse FFTs and median filtering per round, so CPU use scales with the
+    /// overlap. Latency does not depend on it.
+    /// - 8: default, smoothest masks and best separation of short transients.
+    /// - 4: about half the CPU, masks are updated half as often, slight smearing of fast attacks.
+    /// - 2: economy mode, about a quarter of the CPU. Sine windows replace Hann windows so overlap-add stays exact, but
+    ///   frame edges leak more between bins and the masks follow changes coarsely.
+    /// - Parameter newOverlap: 2, 4 or 8.
+    void setOverlap(const int newOverlap);
+
+    /// Parallel (low latency) mode. Instead of analysing the T+N residual of round 1 in time domain, round 2 analyses
+    /// the input itself. Round 1 only computes the sines mask, reduced to the round 2 resolution, and the round 2
+    /// frame is split by mask products: S = S1, T = (1 - S1) * T2, N = (1 - S1) * (N2 + S2). Latency drops from
+    /// fftSizeS + fftSizeTN to fftSizeTN. The sines mask lags the round 2 frame by (fftSizeS - fftSizeTN) / 2 samples,
+    /// so sines onsets are separated less sharply, and fused sines are shifted at the round 2 resolution. Not audio
+    /// thread safe.
+    /// - Parameter shouldBeParallel: True for the parallel mode, false for the cascaded one.
+    void setParallel(const bool shouldBeParallel);
+    /// Skips the T / N masks of round 2, the whole residual goes to N and T stays silent. Saves the median filtering
+    /// and one inverse FFT per round 2 hop, latency and reconstruction are unchanged. Transients are then noise morphed
+    /// along with the noise.
+    /// - Parameter shouldSkip: True to skip the round 2 separation.
+    void setSkipRound2(const bool shouldSkip) { skipRound2 = shouldSkip; }
+
+    /// Halves an overlap of 8 by skipping every other frame of both rounds. Audio thread safe, buffers and windows stay
+    /// as prepared: Hann windows applied twice still sum to a constant at overlap 4, so the frames that are processed
+    /// only need twice the overlap-add scaling. The switch is spread over reductionFrames frames, the odd frames fade
+    /// out while the even ones fade up, so the overlap-add sum stays close to constant. Lower overlaps are kept. The
+    /// round that feeds the fused sines shifter keeps all its frames, the shifter advances its phases by the prepared
+    /// hop. Median filters over time span twice their length while frames are skipped.
+    /// - Parameter shouldReduce: True to skip every other frame.
+    void setReducedOverlap(const bool shouldReduce) { reducedOverlap = shouldReduce; }
     void setThresholdSines(const float thresholdLow);
     void setThresholdTransients(const float thresholdLow);
 
+    /// Fused sines mode. When a shifter is set and enabled, the masked S spectrum is pitch shifted in place before the
+    /// inverse FFT, so the S output is already shifted. Pass nullptr to get the unshifted sines back. The shifter is
+    /// prepared here and on every configuration change. Not audio thread safe.
+    void setSinesShifter(SpectralPitchShifter *newSinesShifter);
+
+    /// Switches the fused sines shifting on or off without preparing the shifter, audio thread safe. Switching on
+    /// clears the phase history of the shifter.
+    /// - Parameter shouldBeEnabled: True to shift the sines with the shifter set by setSinesShifter.
+    void setSinesShifterEnabled(const bool shouldBeEnabled);
+
+    /// When a feed is set, the N spectrum of every round 2 frame is published to it, positioned in the N output
+    /// timeline. Pass nullptr to stop publishing.
+    void setNoiseMagnitudeFeed(NoiseMagnitudeFeed *newNoiseFeed);
+
     void process(const juce::AudioBuffer<float> &buffer, juce::AudioBuffer<float> &S, juce::AudioBuffer<float> &T,
                  juce::AudioBuffer<float> &N);
     void prepare();
 
-    int getLatency() const { return fftSizeS + fftSizeTN; }
+    int getLatency() const { return getLatencyFor(fftSizeS, fftSizeTN, parallel); }
+
+    /// Latency of another configuration, without changing this one.
+    static int getLatencyFor(const int newFFTSizeS, const int newFFTSizeTN, const bool shouldBeParallel) {
+        return shouldBeParallel ? newFFTSizeTN : newFFTSizeS + newFFTSizeTN;
+    }
 
   private:
-    void decompose_1(const int ptr);
-    void decompose_2(const int ptr);
+    void decompose_1();
+    void decompose_2();
     void fuzzySTN(STN &stn, Vec1D &rt, const float G1, const float G2, medianfilter::HorizontalMedianFilter &filterH,
                   medianfilter::VerticalMedianFilter &filterV);
 
     void transientness(Vec1D &dest, const Vec1D &xHorizontal, const Vec1D &xVertical);
 
+    /// Fills the analysis / synthesis window for the current overlap.
+    /// - Parameters:
+    ///   - window: Destination, size + 1 values.
+    ///   - size: FFT size.
+    /// - Returns: Overlap-add scaling, inverse of the summed squared window over one hop.
+    float fillWindow(Vec1D &window, const int size) const;
+
+    /// Median filter length in frames or bins, at least 3 so the filter never degenerates.
+    /// - Parameters:
+    ///   - length: Filter length in seconds or Hz.
+    ///   - resolution: Duration of one hop in seconds or width of one bin in Hz.
+    static int medianFilterSize(const float length, const float resolution);
+
+    /// Reduces the round 1 sines mask to the round 2 resolution, parallel mode only.
+    void decimateSinesMask();
+
+    /// Prepares the fused sines shifter for the round producing the S spectrum.
+    void prepareSinesShifter();
+
+    /// Steps the overlap reduction of a round towards its target and gives the overlap-add weight of the frame, see
+    /// setReducedOverlap.
+    /// - Parameters:
+    ///   - reduction: Reduction step of the round, 0 for full overlap up to reductionFrames.
+    ///   - oddFrame: Frame parity of the round, toggled here.
+    ///   - feedsShifter: The round produces the S spectrum for the fused sines shifter.
+    /// - Returns: Weight of the frame, 0 when it is skipped.
+    float nextFrameWeight(int &reduction, bool &oddFrame, const bool feedsShifter) const;
+
     std::shared_ptr<juce::dsp::ProcessSpec> processSpec;
 
-    Vec1D bufferInput; // buffer for storing incoming samples
-    Vec1D bufferS;     // buffer for storing sines from STN 1 step
-    Vec1D bufferTN;    // buffer for storing transients and noise from STN 1 step
+    // Input rings have the oldest sample at the head, overlap-add rings the next output sample
+    helpers::RingBuffer bufferInput; // buffer for storing incoming samples
+    helpers::RingBuffer bufferS;     // buffer for storing sines from STN 1 step
+    helpers::RingBuffer bufferTN;    // buffer for storing transients and noise from STN 1 step
 
-    Vec1D inputTN; // input buffer for STN 2 step
-    Vec1D bufferT; // buffer for storing transients from STN 2 step
-    Vec1D bufferN; // buffer for storing noise from STN 2 step
+    helpers::RingBuffer inputTN; // input buffer for STN 2 step
+    helpers::RingBuffer bufferT; // buffer for storing transients from STN 2 step
+    helpers::RingBuffer bufferN; // buffer for storing noise from STN 2 step
 
     juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> sinesDelayLine; // delay for sines, T and N are ready fftSizeTN sample later
     
+    SpectralPitchShifter *sinesShifter{nullptr}; // optional, shifts sines in the spectral domain
+    bool sinesShifterEnabled{true};              // sinesShifter is used, when set
+    NoiseMagnitudeFeed *noiseFeed{nullptr};      // optional, receives the noise spectrum of round 2
+    juce::int64 samplesProcessed{0};             // number of output samples so far, never reset
+    const int noiseFeedHistory{4096};            // samples kept in the noise feed on top of a block, longest consumer hop
+
     STN stn1;
     STN stn2;
 
-    int inputWritePtr{0};          // write pointer for incoming samples
-    int bufferSTN1ReadWritePtr{0}; // read write pointer for buffer S and TN
-    int inputTNWritePtr{0};        // write pointer for inputTN
-    int bufferSTN2ReadWritePtr{0}; // read write pointer for buffer T and N
-
     int newSamplesCount{0};  // counter for new samples in frame processing STN1
     int newSamplesCount2{0}; // counter for new samples in frame processing STN2
 
@@ -77,6 +162,7 @@ class DecomposeSTN {
     juce::dsp::FFT forwardFFTTN; // forward T+N
     juce::dsp::FFT inverseFFTT;  // inverse T
     juce::dsp::FFT inverseFFTN;  // inverse N
+    juce::dsp::FFT inverseFFTS2; // inverse S, parallel mode
 
     Vec1D fft_1;
     Vec1D fft_1_tn;
@@ -91,6 +177,12 @@ class DecomposeSTN {
     Vec1D imag_fft_2_t;
     Vec1D real_fft_2_ns;
     Vec1D imag_fft_2_ns;
+    Vec1D fft_2_s;      // parallel mode
+    Vec1D real_fft_2_s; // parallel mode
+    Vec1D imag_fft_2_s; // parallel mode
+
+    Vec1D sinesMaskTN;    // round 1 sines mask at round 2 resolution, parallel mode
+    Vec1D residualMaskTN; // 1 - sinesMaskTN, parallel mode
 
     Vec1D rtS;
     Vec1D rtTN;
@@ -101,7 +193,17 @@ class DecomposeSTN {
     int fftSizeS{2048};
     int fftSizeTN{512};
 
-    const int overlap{8};
+    int overlap{8};
+    bool parallel{false}; // both rounds analyse the input, see setParallel
+    bool skipRound2{false}; // residual goes to N as a whole, see setSkipRound2
+    bool reducedOverlap{false}; // every other frame skipped, see setReducedOverlap
+    int reduction1{0};          // overlap reduction step of round 1, 0 to reductionFrames
+    int reduction2{0};          // overlap reduction step of round 2
+    bool oddFrame1{false};      // the last round 1 frame was odd, faded out by the reduction
+    bool oddFrame2{false};      // the last round 2 frame was odd
+    float frameWeight1{1.f};    // overlap-add weight of the current round 1 frame
+    float frameWeight2{1.f};    // overlap-add weight of the current round 2 frame
+    static constexpr int reductionFrames{16}; // frames over which the overlap reduction is switched
 
     int hopSizeS{fftSizeS / overlap};
     int hopSizeTN{fftSizeTN / overlap};
@@ -120,6 +222,8 @@ class DecomposeSTN {
     float threshold_tn_1{0.85f};
     float threshold_tn_2{0.75f};
 
-    const float windowCorrection{1.f / 3.0f};
+    float windowCorrectionS{1.f / 3.0f};  // overlap-add scaling round 1, depends on overlap
+    float windowCorrectionTN{1.f / 3.0f}; // overlap-add scaling round 2, depends on overlap
+    float windowPower{0.375f};            // mean squared window value, 3 / 8 for Hann
 };
 } // namespace dsp
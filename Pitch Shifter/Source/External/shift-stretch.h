@@ -3,6 +3,8 @@
 
 #include "dsp/delay.h"
 #include "dsp/windows.h"
+#include "../DSP/Helpers/simd.h"
+#include <algorithm>
 #include <vector>
 
 #ifndef LOG_EXPR
@@ -163,6 +165,8 @@ public:
 		this->searchSamples = searchSamples;
 
 		previousBlocks.resize(channels*blockSamples);
+		previousEnergy.resize(blockSamples + 1);
+		currentEnergy.resize(blockSamples + 1);
 	}
 
 	void reset() {
@@ -170,24 +174,33 @@ public:
 	}
 protected:
 	void processBlock(int) override {
+		// Running energy of both blocks, so the energy of any overlap is a difference of two entries
+		previousEnergy[0] = currentEnergy[0] = 0;
+		for (int i = 0; i < this->blockSamples; ++i) {
+			double prev2 = 0, current2 = 0;
+			for (int c = 0; c < this->channels; ++c) {
+				prev2 += previousBlock(c)[i]*previousBlock(c)[i];
+				current2 += this->channelBlock(c)[i]*this->channelBlock(c)[i];
+			}
+			previousEnergy[i + 1] = previousEnergy[i] + prev2;
+			currentEnergy[i + 1] = currentEnergy[i] + current2;
+		}
+
 		int bestOffset = 0;
 		Sample bestDifferenceScore = -1;
-		// Brute-force search to find the offset with minimum waveform difference
+		// Search for the offset with minimum waveform difference. The squared difference is the summed energy minus
+		// twice the cross-correlation, so every offset costs one SIMD inner product per channel. Both are summed in
+		// double, the difference cancels most of the digits near the best offset.
 		for (int offset = -searchSamples; offset <= searchSamples; ++offset) {
-			Sample sumDiff2 = 0, sum2 = 0;
 			int startIndex = std::max(0, -offset), endIndex = std::min(this->blockSamples, this->blockSamples - offset);
-			for (int i = startIndex; i < endIndex; ++i) {
-				for (int c = 0; c < this->channels; ++c) {
-					Sample prevSample = previousBlock(c)[i];
-					Sample currentSample = this->channelBlock(c)[i + offset];
-					Sample diff = prevSample - currentSample;
-					sumDiff2 += diff*diff;
-					sum2 += prevSample*prevSample + currentSample*currentSample;
-				}
+			double correlation = 0;
+			for (int c = 0; c < this->channels; ++c) {
+				correlation += dsp::helpers::dotProductDouble(previousBlock(c) + startIndex, this->channelBlock(c) + startIndex + offset, endIndex - startIndex);
 			}
+			double sum2 = (previousEnergy[endIndex] - previousEnergy[startIndex]) + (currentEnergy[endIndex + offset] - currentEnergy[startIndex + offset]);
 			
 			if (sum2 > 0) {
-				Sample score = sumDiff2/sum2;
+				Sample score = Sample(std::max(0.0, sum2 - 2*correlation)/sum2);
 				if (bestDifferenceScore < 0 || score < bestDifferenceScore) {
 					bestOffset = offset;
 					bestDifferenceScore = score;
@@ -199,7 +212,7 @@ protected:
 		if (bestOffset < 0) {
 			for (int c = 0; c < this->channels; ++c) {
 				Sample *block = this->channelBlock(c);
-				for (int i = this->blockSamples - 1 - bestOffset; i >= 0; --i) {
+				for (int i = this->blockSamples - 1 + bestOffset; i >= 0; --i) {
 					block[i - bestOffset] = block[i];
 				}
 				for (int i = 0; i < -bestOffset; ++i) {
@@ -240,6 +253,7 @@ private:
 		return previousBlocks.data() + channel*this->blockSamples;
 	}
 	std::vector<Sample> previousBlocks;
+	std::vector<double> previousEnergy, currentEnergy; // energy of samples [0, i), summed over channels
 };
 
 #include "dsp/fft.h"
@@ -259,6 +273,8 @@ public:
 		bandCount = mrfft.size()/2;
 		scalingFactor = 1.0/mrfft.size(); // the FFT round-trip scales things up, so we scale down again
 		channelSpectra.resize(bandCount*channels);
+		bandAngles.resize(bandCount);
+		bandUnits.assign(bandCount, 1);
 	}
 protected:
 	virtual void processSpectrum(int inputIntervalSamples) {
@@ -283,11 +299,18 @@ protected:
 		return freq*mrfft.size() - 0.5f;
 	}
 
-	void timeShiftPhases(Sample shiftSamples, Complex *output) const {
+	void timeShiftPhases(Sample shiftSamples, Complex *output) {
 		for (int b = 0; b < bandCount; ++b) {
-			Sample phase = bandToFreq(b)*shiftSamples*(-2*M_PI);
-			output[b] = {std::cos(phase), std::sin(phase)};
+			// Wrap whole cycles in double first, so long shifts keep their accuracy
+			double cycles = (b + 0.5)*shiftSamples/mrfft.size();
+			bandAngles[b] = Sample((cycles - std::round(cycles))*(-2*M_PI));
 		}
+		dsp::helpers::polar(bandUnits.data(), bandAngles.data(), complexData(output), bandCount);
+	}
+
+	// Interleaved float view of a complex array, for the dsp::helpers complex kernels
+	static Sample * complexData(Complex *spectrum) {
+		return reinterpret_cast<Sample *>(spectrum);
 	}
 
 	void processBlock(int inputIntervalSamples) override final {
@@ -333,6 +356,7 @@ private:
 	Sample scalingFactor = 1;
 	std::vector<Sample> fftBuffer;
 	std::vector<Complex> channelSpectra;
+	std::vector<Sample> bandAngles, bandUnits;
 };
 
 class SpectralCutStretch : public SpectralStretch {
@@ -491,6 +515,8 @@ public:
 		prevInputSpectra.resize(bands()*channels);
 		prevOutputSpectra.resize(bands()*channels);
 		outputRotations.resize(bands()*channels);
+		outputPhases.resize(bands());
+		outputEnergies.resize(bands());
 		
 		prevInputRotations.resize(bands());
 		prevOutputRotations.resize(bands());
@@ -512,44 +538,49 @@ protected:
 		// Shift previous input/output back with appropriate phase
 		timeShiftPhases(-inputIntervalSamples, prevInputRotations.data());
 		for (int c = 0; c < channels; ++c) {
-			Complex *prevInputBands = prevInputSpectrum(c);
-			Complex *prevOutputBands = prevOutputSpectrum(c);
-			for (int b = 0; b < bands(); ++b) {
-				prevInputBands[b] *= prevInputRotations[b];
-				prevOutputBands[b] *= prevOutputRotations[b];
-			}
+			Sample *prevInputBands = complexData(prevInputSpectrum(c));
+			Sample *prevOutputBands = complexData(prevOutputSpectrum(c));
+			dsp::helpers::complexMultiply(prevInputBands, complexData(prevInputRotations.data()), prevInputBands, bands());
+			dsp::helpers::complexMultiply(prevOutputBands, complexData(prevOutputRotations.data()), prevOutputBands, bands());
 		}
 
 		for (int c = 0; c < channels; ++c) {
 			Complex *currentBands = channelSpectrum(c);
 			Complex *prevInputBands = prevInputSpectrum(c);
 			Complex *prevOutputBands = prevOutputSpectrum(c);
+			Complex *rotations = outputRotations.data() + c*bands();
+			if (inputIntervalSamples > 0) {
+				// Phase advance since the previous input, scaled to the output interval
+				dsp::helpers::complexMultiplyConjugate(complexData(currentBands), complexData(prevInputBands), complexData(rotations), bands());
+				dsp::helpers::scaleComplexAngles(complexData(rotations), complexData(rotations), timeFactor, bands());
+				std::copy(currentBands, currentBands + bands(), prevInputBands);
+			}
+
 			for (int b = 0; b < bands(); ++b) {
-				if (inputIntervalSamples > 0) {
-					Complex rotation = currentBands[b]*std::conj(prevInputBands[b]);
-					Sample rotationAbs = std::abs(rotation);
-					Sample phase = std::arg(rotation)*timeFactor;
-					outputRotations[b] = {rotationAbs*std::cos(phase), rotationAbs*std::sin(phase)};
-					prevInputBands[b] = currentBands[b];
+				outputEnergies[b] = std::norm(currentBands[b]);
+			}
+			dsp::helpers::complexMultiply(complexData(prevOutputBands), complexData(rotations), complexData(outputPhases.data()), bands());
+			if (!purePhase) {
+				for (int b = 0; b < bands(); ++b) {
+					Sample existingEnergy = std::min(std::norm(prevOutputBands[b]), outputEnergies[b]);
+					Sample newEnergy = outputEnergies[b] - existingEnergy;
+					outputPhases[b] = existingEnergy*outputPhases[b] + newEnergy*currentBands[b];
 				}
-
-				Sample outputEnergy = std::norm(currentBands[b]);
-				Complex complexPhase = prevOutputBands[b]*outputRotations[b];
-				if (!purePhase) {
-					Sample existingEnergy = std::min(std::norm(prevOutputBands[b]), outputEnergy);
-					Sample newEnergy = outputEnergy - existingEnergy;
-					complexPhase = existingEnergy*complexPhase + newEnergy*currentBands[b];
+			}
+			dsp::helpers::normaliseComplex(complexData(outputPhases.data()), outputEnergies.data(), complexData(currentBands), gain, bands());
+			for (int b = 0; b < bands(); ++b) {
+				if (outputPhases[b] == Complex(0)) { // no phase to follow, pick a random one
+					currentBands[b] = generateComplex(outputEnergies[b], 0)*gain;
 				}
-				currentBands[b] = generateComplex(outputEnergy, complexPhase);
-				currentBands[b] *= gain;
-				prevOutputBands[b] = currentBands[b];
 			}
+			std::copy(currentBands, currentBands + bands(), prevOutputBands);
 		}
 	}
 private:
 	bool purePhase = true;
-	std::vector<Complex> prevInputSpectra, prevOutputSpectra, outputRotations;
+	std::vector<Complex> prevInputSpectra, prevOutputSpectra, outputRotations, outputPhases;
 	std::vector<Complex> prevInputRotations, prevOutputRotations;
+	std::vector<Sample> outputEnergies;
 	Complex * prevInputSpectrum(int channel) {
 		return prevInputSpectra.data() + channel*this->bands();
 	}
@@ -581,6 +612,9 @@ public:
 		SpectralStretch::configure(channels, blockSamples, intervalSamples, zeroPadding, maxExtraInput);
 
 		newSpectrum.resize(bands());
+		verticalRotations.resize(bands());
+		outputMagnitudes.resize(bands());
+		outputAngles.resize(bands());
 		centreTimeRotations.resize(bands());
 		timeShiftPhases(-blockSamples*0.5, centreTimeRotations.data());
 	}
@@ -594,48 +628,51 @@ protected:
 	virtual void processSpectrum(int inputIntervalSamples) {
 		Sample timeFactor = inputIntervalSamples > 0 ? intervalSamples/Sample(inputIntervalSamples) : 0;
 
+		// Stretch vertical phase to expand time, either by scaling the phase, or by using a longer stride
+		Sample binStride = stretchStride ? timeFactor : 1;
+		Sample angleScale = stretchStride ? 1 : timeFactor;
+
 		for (int c = 0; c < channels; ++c) {
 			Complex *spectrum = channelSpectrum(c);
 			
 			// Rotate so the block is centered on t=0
 			// This makes interpolation more sensible, as well as the phase-changes centred
-			for (int b = 0; b < bands(); ++b) {
-				spectrum[b] *= centreTimeRotations[b];
-			}
+			dsp::helpers::complexMultiply(complexData(spectrum), complexData(centreTimeRotations.data()), complexData(spectrum), bands());
 
 			for (int b = 0; b < bands(); ++b) {
 				Sample inputBin = freqToBand(bandToFreq(b)/freqFactor);
 
-				Sample energy = getEnergy(spectrum, inputBin);
-				Complex rotation;
-				
-				// Stretch vertical phase to expand time, either by scaling the phase, or by using a longer stride
-				if (stretchStride) {
-					Complex bin = getBin(spectrum, inputBin);
-					Complex prevBin = getBin(spectrum, inputBin - timeFactor);
-					rotation = bin*std::conj(prevBin);
+				outputMagnitudes[b] = std::sqrt(getEnergy(spectrum, inputBin))*gain;
+				Complex bin = getBin(spectrum, inputBin);
+				Complex prevBin = getBin(spectrum, inputBin - binStride);
+				verticalRotations[b] = bin*std::conj(prevBin);
+			}
+			dsp::helpers::complexAngles(complexData(verticalRotations.data()), outputAngles.data(), bands());
+
+			// Each band continues the phase of the one below, starting from the (real) lowest input bin.
+			// The fast angles are off by a few 1e-7 per band, summed over the bands that is up to about 1e-4.
+			Sample inputBin0 = freqToBand(bandToFreq(0)/freqFactor);
+			Sample phase = (inputBin0 > 0) ? 0 : (inputBin0 < 0) ? Sample(M_PI) : Sample(2*M_PI)*rand()/RAND_MAX;
+			outputAngles[0] = phase;
+			for (int b = 1; b < bands(); ++b) {
+				if (outputMagnitudes[b - 1] == 0 || (stretchStride && verticalRotations[b] == Complex(0))) {
+					phase = Sample(2*M_PI)*rand()/RAND_MAX; // nothing to continue from, pick a random phase
 				} else {
-					Complex bin = getBin(spectrum, inputBin);
-					Complex prevBin = getBin(spectrum, inputBin - 1);
-					rotation = bin*std::conj(prevBin);
-					Sample phaseRotation = std::arg(rotation)*timeFactor;
-					rotation = {std::cos(phaseRotation), std::sin(phaseRotation)};
+					phase += outputAngles[b]*angleScale;
+					phase -= Sample(2*M_PI)*std::round(phase*Sample(0.5/M_PI));
 				}
-				
-				Complex phase = (b > 0) ? rotation*newSpectrum[b - 1] : inputBin;
-				newSpectrum[b] = generateComplex(energy, phase);
+				outputAngles[b] = phase;
 			}
+			dsp::helpers::polar(outputMagnitudes.data(), outputAngles.data(), complexData(newSpectrum.data()), bands());
 			
 			// Rotate back again for output
-			for (int b = 0; b < bands(); ++b) {
-				spectrum[b] = newSpectrum[b]*std::conj(centreTimeRotations[b]);
-				spectrum[b] *= gain;
-			}
+			dsp::helpers::complexMultiplyConjugate(complexData(newSpectrum.data()), complexData(centreTimeRotations.data()), complexData(spectrum), bands());
 		}
 	}
 private:
 	bool stretchStride;
-	std::vector<Complex> newSpectrum;
+	std::vector<Complex> newSpectrum, verticalRotations;
+	std::vector<Sample> outputMagnitudes, outputAngles;
 	float freqFactor;
 
 	Sample getEnergy(Complex *spectrum, float index) {
@@ -690,6 +727,7 @@ public:
 		newOutputSpectra.resize(bands()*channels);
 		
 		horizontalRotations.resize(bands()*channels);
+		inputBins.resize(bands());
 
 		centreTimeRotations.resize(bands());
 		timeShiftPhases(-blockSamples*0.5, centreTimeRotations.data());
@@ -714,14 +752,15 @@ protected:
 		// Shift input and previous input/output with appropriate phase
 		timeShiftPhases(-inputIntervalSamples, prevInputRotations.data());
 		for (int c = 0; c < channels; ++c) {
-			Complex *currentBands = channelSpectrum(c);
-			Complex *prevInputBands = prevInputSpectrum(c);
-			Complex *prevOutputBands = prevOutputSpectrum(c);
-			for (int b = 0; b < bands(); ++b) {
-				currentBands[b] *= centreTimeRotations[b]; // Rotate so the block is centered on t=0
-				prevInputBands[b] *= prevInputRotations[b];
-				prevOutputBands[b] *= prevOutputRotations[b];
-			}
+			Sample *currentBands = complexData(channelSpectrum(c));
+			Sample *prevInputBands = complexData(prevInputSpectrum(c));
+			Sample *prevOutputBands = complexData(prevOutputSpectrum(c));
+			dsp::helpers::complexMultiply(currentBands, complexData(centreTimeRotations.data()), currentBands, bands()); // Rotate so the block is centered on t=0
+			dsp::helpers::complexMultiply(prevInputBands, complexData(prevInputRotations.data()), prevInputBands, bands());
+			dsp::helpers::complexMultiply(prevOutputBands, complexData(prevOutputRotations.data()), prevOutputBands, bands());
+		}
+		for (int b = 0; b < bands(); ++b) {
+			inputBins[b] = freqToBand(bandToFreq(b)/freqFactor);
 		}
 
 		Complex *newSpectrum0 = newOutputSpectrum(0);
@@ -733,8 +772,19 @@ protected:
 			
 			Complex *horizontalRotations = channelHorizontalRotations(c);
 
+			// Phase-vocoder (horizontal) rotations don't depend on other output bands, so they're done for all bands at once
+			if (inputIntervalSamples > 0) {
+				for (int b = 0; b < bands(); ++b) {
+					Complex bin = getBin(currentBands, inputBins[b]);
+					Complex prevBin = getBin(prevInputBands, inputBins[b]);
+					horizontalRotations[b] = bin*std::conj(prevBin);
+				}
+				// Scale phase-rotation from input time-diff to output time-diff, and also by frequency
+				dsp::helpers::scaleComplexAngles(complexData(horizontalRotations), complexData(horizontalRotations), timeFactor*freqFactor, bands());
+			}
+
 			for (int b = 0; b < bands(); ++b) {
-				Sample inputBin = freqToBand(bandToFreq(b)/freqFactor);
+				Sample inputBin = inputBins[b];
 
 				Sample energy = getEnergy(currentBands, inputBin);
 				energy /= freqFactor; // Keep total energy constant
@@ -781,14 +831,6 @@ protected:
 				}
 				
 				// Phase-vocoder (horizontal) predictions
-				if (inputIntervalSamples > 0) {
-					Complex prevBin = getBin(prevInputBands, inputBin);
-					
-					Complex rotation = bin*std::conj(prevBin);
-					// Scale phase-rotation from input time-diff to output time-diff, and also by frequency
-					rotation = scaleAngle(rotation, timeFactor*freqFactor);
-					horizontalRotations[b] = rotation;
-				}
 				Complex horizontalPrediction = prevOutputBands[b]*horizontalRotations[b];
 				if (std::norm(horizontalPrediction) > maxNorm) {
 					maxPrediction = horizontalPrediction;
@@ -812,23 +854,20 @@ protected:
 				newSpectrum[b] = generateComplex(energy, phase);
 			}
 
-			for (int b = 0; b < bands(); ++b) {
-				prevInputBands[b] = currentBands[b];
-			}
+			std::copy(currentBands, currentBands + bands(), prevInputBands);
 		}
 		for (int c = 0; c < channels; ++c) {
 			Complex *currentBands = channelSpectrum(c);
 			Complex *prevOutputBands = prevOutputSpectrum(c);
 			Complex *newSpectrum = newOutputSpectrum(c);
-			for (int b = 0; b < bands(); ++b) {
-				prevOutputBands[b] = newSpectrum[b];
-				currentBands[b] = newSpectrum[b]*std::conj(centreTimeRotations[b]);
-			}
+			std::copy(newSpectrum, newSpectrum + bands(), prevOutputBands);
+			dsp::helpers::complexMultiplyConjugate(complexData(newSpectrum), complexData(centreTimeRotations.data()), complexData(currentBands), bands());
 		}
 	}
 private:
 	bool multipleTimeObservations;
 	float freqFactor = 1;
+	std::vector<Sample> inputBins;
 	float pitchWeight, timeWeight, channelWeight, maxWeight;
 	std::vector<Complex> newOutputSpectra;
 	std::vector<Complex> prevInputSpectra, prevOutputSpectra, outputRotations;
@@ -883,12 +922,6 @@ private:
 		}
 		return lowBin + (highBin - lowBin)*fractional;
 	}
-	
-	Complex scaleAngle(Complex rotation, Sample multiplier) {
-		Sample rotationAbs = std::abs(rotation);
-		Sample phase = std::arg(rotation)*multiplier;
-		return {rotationAbs*std::cos(phase), rotationAbs*std::sin(phase)};
-	}
 };
 
 #endif // include guard
@@ -5,6 +5,9 @@
 #include "dsp/delay.h"
 #include "dsp/perf.h"
 SIGNALSMITH_DSP_VERSION_CHECK(1, 6, 0); // Check version is compatible
+#include <cstdint>
+#include <limits>
+#include <numeric>
 #include <vector>
 #include <algorithm>
 #include <functional>
@@ -14,9 +17,9 @@ namespace signalsmith { namespace stretch {
 
 template<typename Sample=float>
 struct SignalsmithStretch {
-
 	SignalsmithStretch() : randomEngine(std::random_device{}()) {}
 	SignalsmithStretch(long seed) : randomEngine(seed) {}
+	virtual ~SignalsmithStretch() = default;
 
 	int blockSamples() const {
 		return stft.windowSize();
@@ -33,8 +36,9 @@ struct SignalsmithStretch {
 	
 	void reset() {
 		stft.reset();
-		inputBuffer.reset();
+		for (auto &history : inputHistory) history.reset();
 		prevInputOffset = -1;
+		nextSpectrumOffset = 0;
 		channelBands.assign(channelBands.size(), Band());
 		silenceCounter = 2*stft.windowSize();
 		didSeek = false;
@@ -54,7 +58,8 @@ struct SignalsmithStretch {
 		channels = nChannels;
 		stft.resize(channels, blockSamples, intervalSamples);
 		bands = stft.bands();
-		inputBuffer.resize(channels, blockSamples + intervalSamples + 1);
+		inputHistory.resize(channels);
+		for (auto &history : inputHistory) history.setSize(blockSamples + intervalSamples + 1);
 		timeBuffer.assign(stft.fftSize(), 0);
 		channelBands.assign(bands*channels, Band());
 		
@@ -66,12 +71,19 @@ struct SignalsmithStretch {
 		peaks.reserve(bands);
 		energy.resize(bands);
 		smoothedEnergy.resize(bands);
+		peakMask.resize((bands + 31)/32);
+		bandIndices.resize(bands);
+		std::iota(bandIndices.begin(), bandIndices.end(), Sample(0));
 		outputMap.resize(bands);
+		outputMapIsIdentity = false;
 		channelPredictions.resize(channels*bands);
 	}
 
 	/// Frequency multiplier, and optional tonality limit (as multiple of sample-rate)
 	void setTransposeFactor(Sample multiplier, Sample tonalityLimit=0) {
+		// Hosts tend to call this every block, usually with the same values
+		if (multiplier == freqMultiplier && tonalityLimit == transposeTonalityLimit && !customFreqMap) return;
+		transposeTonalityLimit = tonalityLimit;
 		freqMultiplier = multiplier;
 		if (tonalityLimit > 0) {
 			freqTonalityLimit = tonalityLimit/std::sqrt(multiplier); // compromise between input and output limits
@@ -92,16 +104,8 @@ struct SignalsmithStretch {
 	// Provide previous input ("pre-roll"), without affecting the speed calculation.  You should ideally feed it one block-length + one interval
 	template<class Inputs>
 	void seek(Inputs &&inputs, int inputSamples, double playbackRate) {
-		inputBuffer.reset();
-		for (int c = 0; c < channels; ++c) {
-			auto &&inputChannel = inputs[c];
-			auto &&bufferChannel = inputBuffer[c];
-			int startIndex = std::max<int>(0, inputSamples - stft.windowSize() - stft.interval());
-			for (int i = startIndex; i < inputSamples; ++i) {
-				bufferChannel[i] = inputChannel[i];
-			}
-		}
-		inputBuffer += inputSamples;
+		for (auto &history : inputHistory) history.reset();
+		storeInputHistory(inputs, inputSamples);
 		didSeek = true;
 		seekTimeFactor = (playbackRate*stft.interval() > 1) ? 1/playbackRate : stft.interval();
 	}
@@ -143,16 +147,7 @@ struct SignalsmithStretch {
 					}
 				}
 
-				// Store input in history buffer
-				for (int c = 0; c < channels; ++c) {
-					auto &&inputChannel = inputs[c];
-					auto &&bufferChannel = inputBuffer[c];
-					int startIndex = std::max<int>(0, inputSamples - stft.windowSize() - stft.interval());
-					for (int i = startIndex; i < inputSamples; ++i) {
-						bufferChannel[i] = inputChannel[i];
-					}
-				}
-				inputBuffer += inputSamples;
+				storeInputHistory(inputs, inputSamples);
 				return;
 			} else {
 				silenceCounter += inputSamples;
@@ -162,7 +157,7 @@ struct SignalsmithStretch {
 			silenceFirst = true;
 		}
 
-		for (int outputIndex = 0; outputIndex < outputSamples; ++outputIndex) {
+		for (int outputIndex = 0; outputIndex < outputSamples;) {
 			stft.ensureValid(outputIndex, [&](int outputOffset) {
 				// Time to process a spectrum!  Where should it come from in the input?
 				int inputOffset = std::round(outputOffset*Sample(inputSamples)/outputSamples) - stft.windowSize();
@@ -172,16 +167,7 @@ struct SignalsmithStretch {
 				bool newSpectrum = didSeek || (inputInterval > 0);
 				if (newSpectrum) {
 					for (int c = 0; c < channels; ++c) {
-						// Copy from the history buffer, if needed
-						auto &&bufferChannel = inputBuffer[c];
-						for (int i = 0; i < -inputOffset; ++i) {
-							timeBuffer[i] = bufferChannel[i + inputOffset];
-						}
-						// Copy the rest from the input
-						auto &&inputChannel = inputs[c];
-						for (int i = std::max<int>(0, -inputOffset); i < stft.windowSize(); ++i) {
-							timeBuffer[i] = inputChannel[i + inputOffset];
-						}
+						fillTimeBuffer(c, inputs[c], inputOffset);
 						stft.analyse(c, timeBuffer);
 					}
 					flushed = false; // TODO: first block after a flush should be gain-compensated
@@ -197,16 +183,7 @@ struct SignalsmithStretch {
 					if (didSeek || inputInterval != stft.interval()) { // make sure the previous input is the correct distance in the past
 						int prevIntervalOffset = inputOffset - stft.interval();
 						for (int c = 0; c < channels; ++c) {
-							// Copy from the history buffer, if needed
-							auto &&bufferChannel = inputBuffer[c];
-							for (int i = 0; i < std::min(-prevIntervalOffset, stft.windowSize()); ++i) {
-								timeBuffer[i] = bufferChannel[i + prevIntervalOffset];
-							}
-							// Copy the rest from the input
-							auto &&inputChannel = inputs[c];
-							for (int i = std::max<int>(0, -prevIntervalOffset); i < stft.windowSize(); ++i) {
-								timeBuffer[i] = inputChannel[i + prevIntervalOffset];
-							}
+							fillTimeBuffer(c, inputs[c], prevIntervalOffset);
 							stft.analyse(c, timeBuffer);
 						}
 						for (int c = 0; c < channels; ++c) {
@@ -230,27 +207,26 @@ struct SignalsmithStretch {
 						spectrumBands[b] = signalsmith::perf::mul<true>(channelBands[b].output, rotCentreSpectrum[b]);
 					}
 				}
+				// This block only adds to output from outputOffset on, so everything before the next block is final
+				nextSpectrumOffset = outputOffset + stft.interval();
 			});
 
+			// Copy the whole run up to the next spectrum, rather than checking for a new spectrum every sample
+			int runEnd = std::min(outputSamples, std::max(outputIndex + 1, nextSpectrumOffset));
 			for (int c = 0; c < channels; ++c) {
 				auto &&outputChannel = outputs[c];
 				auto &&stftChannel = stft[c];
-				outputChannel[outputIndex] = stftChannel[outputIndex];
+				for (int i = outputIndex; i < runEnd; ++i) {
+					outputChannel[i] = stftChannel[i];
+				}
 			}
+			outputIndex = runEnd;
 		}
 
-		// Store input in history buffer
-		for (int c = 0; c < channels; ++c) {
-			auto &&inputChannel = inputs[c];
-			auto &&bufferChannel = inputBuffer[c];
-			int startIndex = std::max<int>(0, inputSamples - stft.windowSize());
-			for (int i = startIndex; i < inputSamples; ++i) {
-				bufferChannel[i] = inputChannel[i];
-			}
-		}
-		inputBuffer += inputSamples;
+		storeInputHistory(inputs, inputSamples);
 		stft += outputSamples;
 		prevInputOffset -= inputSamples;
+		nextSpectrumOffset -= outputSamples;
 	}
 
 	// Read the remaining output, providing no further input.  `outputSamples` should ideally be at least `.outputLatency()`
@@ -274,6 +250,7 @@ struct SignalsmithStretch {
 		}
 		// Skip the output we just used/cleared
 		stft += plainOutput + foldedBackOutput;
+		nextSpectrumOffset -= plainOutput + foldedBackOutput;
 		// Reset the phase-vocoder stuff, so the next block gets a fresh start
 		for (int c = 0; c < channels; ++c) {
 			auto channelBands = bandsForChannel(c);
@@ -283,6 +260,37 @@ struct SignalsmithStretch {
 		}
 		flushed = true;
 	}
+protected:
+	// Inner loops of the peak detection. Subclasses may replace them with vectorised versions, which can differ by
+	// rounding only.
+
+	// In-place one-pole smoothing, from the first element to the last
+	virtual void smoothForward(Sample *data, int size, Sample slew, Sample &state) {
+		for (int i = 0; i < size; ++i) {
+			state += (data[i] - state)*slew;
+			data[i] = state;
+		}
+	}
+	// In-place one-pole smoothing, from the last element to the first
+	virtual void smoothBackward(Sample *data, int size, Sample slew, Sample &state) {
+		for (int i = size - 1; i >= 0; --i) {
+			state += (data[i] - state)*slew;
+			data[i] = state;
+		}
+	}
+	// Bit i % 32 of mask[i / 32] set where a[i] > b[i], bits past size cleared
+	virtual void compareGreater(const Sample *a, const Sample *b, std::uint32_t *mask, int size) {
+		for (int word = 0; word*32 < size; ++word) {
+			std::uint32_t bits = 0;
+			for (int i = word*32; i < std::min(size, word*32 + 32); ++i) {
+				bits |= std::uint32_t(a[i] > b[i]) << (i - word*32);
+			}
+			mask[word] = bits;
+		}
+	}
+	virtual Sample dotProduct(const Sample *a, const Sample *b, int size) {
+		return std::inner_product(a, a + size, b, Sample(0));
+	}
 private:
 	using Complex = std::complex<Sample>;
 	static constexpr Sample noiseFloor{1e-15};
@@ -291,13 +299,68 @@ private:
 	bool silenceFirst = true;
 
 	Sample freqMultiplier = 1, freqTonalityLimit = 0.5;
+	Sample transposeTonalityLimit = std::numeric_limits<Sample>::quiet_NaN(); // as last passed to setTransposeFactor()
 	std::function<Sample(Sample)> customFreqMap = nullptr;
 
 	signalsmith::spectral::STFT<Sample> stft{0, 1, 1};
-	signalsmith::delay::MultiBuffer<Sample> inputBuffer;
+	// Input samples stored twice, one copy after the other, so any window into the past is a single contiguous span
+	struct InputHistory {
+		std::vector<Sample> buffer;
+		int size = 0, head = 0;
+
+		void setSize(int newSize) {
+			size = newSize;
+			buffer.assign(2*size, 0);
+			head = 0;
+		}
+		void reset() {
+			std::fill(buffer.begin(), buffer.end(), 0);
+			head = 0;
+		}
+		// Writes up to size samples at the head
+		void push(const Sample *samples, int count) {
+			int first = std::min(count, size - head);
+			std::copy_n(samples, first, &buffer[head]);
+			std::copy_n(samples, first, &buffer[head + size]);
+			std::copy_n(samples + first, count - first, &buffer[0]);
+			std::copy_n(samples + first, count - first, &buffer[size]);
+			head += count;
+			if (head >= size) head -= size;
+		}
+		// Samples from `offset` (down to -size) before the head onwards
+		const Sample * window(int offset) const {
+			return &buffer[head + offset + (head + offset < 0 ? size : 0)];
+		}
+	};
+	std::vector<InputHistory> inputHistory; // per channel, the last block + interval input samples
 	int channels = 0, bands = 0;
 	int prevInputOffset = -1;
+	int nextSpectrumOffset = 0; // output index of the next spectrum, 0 until the first one
 	std::vector<Sample> timeBuffer;
+
+	// Keeps the end of the input in the history, for spectra reaching back before the next input block
+	template<class Inputs>
+	void storeInputHistory(Inputs &&inputs, int inputSamples) {
+		for (int c = 0; c < channels; ++c) {
+			int stored = std::min(inputSamples, inputHistory[c].size);
+			if (stored > 0) inputHistory[c].push(&inputs[c][inputSamples - stored], stored);
+		}
+	}
+
+	// Fills the time buffer with one window of input starting at inputOffset, negative offsets read the history.
+	// Input channels must be contiguous arrays.
+	template<class InputChannel>
+	void fillTimeBuffer(int c, InputChannel &&inputChannel, int inputOffset) {
+		int fromHistory = std::min(std::max(0, -inputOffset), stft.windowSize());
+		if (fromHistory > 0) {
+			const Sample *history = inputHistory[c].window(inputOffset);
+			std::copy(history, history + fromHistory, timeBuffer.begin());
+		}
+		int fromInput = stft.windowSize() - fromHistory;
+		if (fromInput > 0) {
+			std::copy_n(&inputChannel[fromHistory + inputOffset], fromInput, timeBuffer.begin() + fromHistory);
+		}
+	}
 	bool didSeek = false, flushed = true;
 	Sample seekTimeFactor = 1;
 
@@ -364,10 +427,20 @@ private:
 	};
 	std::vector<Peak> peaks;
 	std::vector<Sample> energy, smoothedEnergy;
+	std::vector<std::uint32_t> peakMask; // bit per band, set where the energy is above the smoothed energy
+	std::vector<Sample> bandIndices; // 0, 1, 2... for energy-weighted band averages
 	struct PitchMapPoint {
 		Sample inputBin, freqGrad;
 	};
 	std::vector<PitchMapPoint> outputMap;
+	bool outputMapIsIdentity = false;
+	void setIdentityOutputMap() {
+		if (outputMapIsIdentity) return;
+		for (int b = 0; b < bands; ++b) {
+			outputMap[b] = {Sample(b), 1};
+		}
+		outputMapIsIdentity = true;
+	}
 	
 	struct Prediction {
 		Sample energy = 0;
@@ -418,9 +491,7 @@ private:
 					bins[b].inputEnergy = std::norm(bins[b].input);
 				}
 			}
-			for (int b = 0; b < bands; ++b) {
-				outputMap[b] = {Sample(b), 1};
-			}
+			setIdentityOutputMap();
 		}
 
 		// Preliminary output prediction from phase-vocoder
@@ -531,7 +602,7 @@ private:
 	// Produces smoothed energy across all channels
 	void smoothEnergy(Sample smoothingBins) {
 		Sample smoothingSlew = 1/(1 + smoothingBins*Sample(0.5));
-		for (auto &e : energy) e = 0;
+		std::fill(energy.begin(), energy.end(), 0);
 		for (int c = 0; c < channels; ++c) {
 			Band *bins = bandsForChannel(c);
 			for (int b = 0; b < bands; ++b) {
@@ -540,19 +611,11 @@ private:
 				energy[b] += e;
 			}
 		}
-		for (int b = 0; b < bands; ++b) {
-			smoothedEnergy[b] = energy[b];
-		}
+		std::copy(energy.begin(), energy.end(), smoothedEnergy.begin());
 		Sample e = 0;
 		for (int repeat = 0; repeat < 2; ++repeat) {
-			for (int b = bands - 1; b >= 0; --b) {
-				e += (smoothedEnergy[b] - e)*smoothingSlew;
-				smoothedEnergy[b] = e;
-			}
-			for (int b = 0; b < bands; ++b) {
-				e += (smoothedEnergy[b] - e)*smoothingSlew;
-				smoothedEnergy[b] = e;
-			}
+			smoothBackward(smoothedEnergy.data(), bands, smoothingSlew, e);
+			smoothForward(smoothedEnergy.data(), bands, smoothingSlew, e);
 		}
 	}
 	
@@ -571,33 +634,52 @@ private:
 
 		peaks.resize(0);
 		
+		// Peaks are runs of bands above the smoothed energy. Run edges are found from the bit changes of a comparison
+		// mask, instead of branching on every band.
+		compareGreater(energy.data(), smoothedEnergy.data(), peakMask.data(), bands);
 		int start = 0;
-		while (start < bands) {
-			if (energy[start] > smoothedEnergy[start]) {
-				int end = start;
-				Sample bandSum = 0, energySum = 0;
-				while (end < bands && energy[end] > smoothedEnergy[end]) {
-					bandSum += end*energy[end];
-					energySum += energy[end];
-					++end;
+		std::uint32_t prevBit = 0;
+		for (int word = 0; word < int(peakMask.size()); ++word) {
+			std::uint32_t above = peakMask[word];
+			std::uint32_t edges = above ^ ((above << 1) | prevBit);
+			while (edges) {
+				int bit = countTrailingZeros(edges);
+				edges &= edges - 1;
+				int band = word*32 + bit;
+				if ((above >> bit) & 1) {
+					start = band;
+				} else {
+					addPeak(start, band);
 				}
-				Sample avgBand = bandSum/energySum;
-				Sample avgFreq = bandToFreq(avgBand);
-				peaks.emplace_back(Peak{avgBand, freqToBand(mapFreq(avgFreq))});
-
-				start = end;
 			}
-			++start;
+			prevBit = above >> 31;
 		}
+		if (prevBit) addPeak(start, bands); // only possible when bands is a multiple of 32
+	}
+	
+	static int countTrailingZeros(std::uint32_t x) { // x must not be 0
+		int count = 0;
+		if (!(x & 0xFFFF)) { count += 16; x >>= 16; }
+		if (!(x & 0xFF)) { count += 8; x >>= 8; }
+		if (!(x & 0xF)) { count += 4; x >>= 4; }
+		if (!(x & 0x3)) { count += 2; x >>= 2; }
+		return count + !(x & 0x1);
+	}
+
+	void addPeak(int start, int end) {
+		Sample bandSum = dotProduct(bandIndices.data() + start, energy.data() + start, end - start);
+		Sample energySum = std::accumulate(energy.data() + start, energy.data() + end, Sample(0));
+		Sample avgBand = bandSum/energySum;
+		Sample avgFreq = bandToFreq(avgBand);
+		peaks.emplace_back(Peak{avgBand, freqToBand(mapFreq(avgFreq))});
 	}
 	
 	void updateOutputMap() {
 		if (peaks.empty()) {
-			for (int b = 0; b < bands; ++b) {
-				outputMap[b] = {Sample(b), 1};
-			}
+			setIdentityOutputMap();
 			return;
 		}
+		outputMapIsIdentity = false;
 		Sample bottomOffset = peaks[0].input - peaks[0].output;
 		for (int b = 0; b < std::min<int>(bands, std::ceil(peaks[0].output)); ++b) {
 			outputMap[b] = {b + bottomOffset, 1};
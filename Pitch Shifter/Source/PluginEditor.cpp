@@ -21,6 +21,7 @@ PitchShifterAudioProcessorEditor::PitchShifterAudioProcessorEditor(PitchShifterA
     styleLabel(boundsSinesLabel, "Bounds S");
     styleLabel(fftSizeLabel, "FFT Size");
     styleLabel(boundsTransientsLabel, "Bounds T");
+    styleLabel(cpuTierLabel, {});
 
     pitchShiftSlider.setRange(audioProcessor.pitchShiftMin, audioProcessor.pitchShiftMax);
     pitchShiftSlider.setTextValueSuffix(" st");
@@ -42,6 +43,9 @@ PitchShifterAudioProcessorEditor::PitchShifterAudioProcessorEditor(PitchShifterA
     styleWaveforms();
 
     addAndMakeVisibleComponents();
+
+    timerCallback();
+    startTimerHz(4);
 }
 
 PitchShifterAudioProcessorEditor::~PitchShifterAudioProcessorEditor() {}
@@ -105,6 +109,17 @@ void PitchShifterAudioProcessorEditor::addAndMakeVisibleComponents() {
     addAndMakeVisible(&boundsSinesLabel);
     addAndMakeVisible(&boundsTransientsLabel);
     addAndMakeVisible(&fftSizeLabel);
+
+    addAndMakeVisible(&cpuTierLabel);
+}
+
+void PitchShifterAudioProcessorEditor::timerCallback() {
+    const auto &governor = *audioProcessor.cpuGovernorService;
+    const auto load = juce::String(juce::roundToInt(governor.getLoad() * 100.0)) + "%";
+    const auto text = audioProcessor.getCpuGovernorParam().getValue() >= 0.5f
+                          ? "CPU " + load + " | " + services::CpuGovernorService::getTierName(governor.getTier())
+                          : "CPU " + load;
+    cpuTierLabel.setText(text, juce::dontSendNotification);
 }
 
 //==============================================================================
@@ -133,4 +148,6 @@ void PitchShifterAudioProcessorEditor::resized() {
     boundsSinesSlider.setBounds(220, 285, 100, 100);
     boundsTransientsSlider.setBounds(330, 285, 100, 100);
     fftSizeSlider.setBounds(440, 285, 100, 100);
+
+    cpuTierLabel.setBounds(75, 5, 500, 20);
 }
@@ -16,7 +16,7 @@
 //==============================================================================
 /**
  */
-class PitchShifterAudioProcessorEditor : public juce::AudioProcessorEditor {
+class PitchShifterAudioProcessorEditor : public juce::AudioProcessorEditor, private juce::Timer {
   public:
     PitchShifterAudioProcessorEditor(PitchShifterAudioProcessor &);
     ~PitchShifterAudioProcessorEditor() override;
@@ -25,6 +25,9 @@ class PitchShifterAudioProcessorEditor : public juce::AudioProcessorEditor {
     void paint(juce::Graphics &) override;
     void resized() override;
 
+    /// Shows the quality tier of the CPU governor.
+    void timerCallback() override;
+
   private:
     void addAndMakeVisibleComponents();
     void styleLabel(juce::Label &label, juce::String text);
@@ -64,6 +67,8 @@ class PitchShifterAudioProcessorEditor : public juce::AudioProcessorEditor {
     juce::Label waveformNLabel;
     juce::Label waveformOutLabel;
 
+    juce::Label cpuTierLabel;
+
     // ==== colors ====
     const juce::Colour widgetBgColour{245, 245, 245};
     const juce::Colour sliderUnusedColour{180, 180, 180};
@@ -18,12 +18,17 @@ PitchShifterAudioProcessor::PitchShifterAudioProcessor()
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
+                       .withOutput ("Sines", juce::AudioChannelSet::stereo(), false)
+                       .withOutput ("Transients", juce::AudioChannelSet::stereo(), false)
+                       .withOutput ("Noise", juce::AudioChannelSet::stereo(), false)
                      #endif
                        ),
     processSpec(std::make_shared<juce::dsp::ProcessSpec>()),
     decomposeSTN(processSpec),
     noiseMorphing(processSpec),
-    sinesDelayLine(4096), transientsDelayLine(4096), noiseDelayLine(4096)
+    harmonizer(processSpec),
+    sinesDelayLine(4096), transientsDelayLine(4096), noiseDelayLine(4096),
+    unshiftedSinesDelayLine(4096), unshiftedNoiseDelayLine(4096)
 #endif
 {
     waveformBufferServiceS = std::make_shared<services::WaveformBufferQueueService>();
@@ -35,17 +40,61 @@ PitchShifterAudioProcessor::PitchShifterAudioProcessor()
     spectrumBufferServiceT = std::make_shared<services::SpectrumBufferQueueService>();
     spectrumBufferServiceN = std::make_shared<services::SpectrumBufferQueueService>();
     
+    cpuGovernorService = std::make_shared<services::CpuGovernorService>();
+    
     addParameter(pitchShiftParam = new juce::AudioParameterInt({"Pitch Shift", 1}, "Pitch Shift", pitchShiftMin, pitchShiftMax, 0));
     addParameter(boundsSinesParam = new juce::AudioParameterFloat({"Bounds Sines", 1}, "Bounds Sines", minBounds, maxBounds, 0.75f));
     addParameter(boundsTransientsParam = new juce::AudioParameterFloat({"Bounds Transients", 1}, "Bounds Transients", minBounds, maxBounds, 0.8f));
     
     addParameter(fftSizeParam = new juce::AudioParameterChoice({"STN FFT Size", 1}, "STN FFT Size", {"512", "1024", "2048", "4096"}, 2));
+    addParameter(fusedSinesParam = new juce::AudioParameterBool({"Fused Sines", 1}, "Fused Sines", false));
+    addParameter(overlapParam = new juce::AudioParameterChoice({"STN Overlap", 1}, "STN Overlap", {"2", "4", "8"}, 2, juce::AudioParameterChoiceAttributes().withAutomatable(false)));
+    addParameter(lowLatencyParam = new juce::AudioParameterBool({"Low Latency STN", 1}, "Low Latency STN", false, juce::AudioParameterBoolAttributes().withAutomatable(false)));
+    addParameter(targetLatencyParam = new juce::AudioParameterChoice({"Target Latency", 1}, "Target Latency", {"Manual", "10 ms", "20 ms", "30 ms", "50 ms", "80 ms", "120 ms"}, 0, juce::AudioParameterChoiceAttributes().withAutomatable(false)));
+    addParameter(noiseFFTSizeParam = new juce::AudioParameterChoice({"Noise FFT Size", 1}, "Noise FFT Size", {"Follow STN", "512", "1024", "2048"}, 0));
+    addParameter(cpuGovernorParam = new juce::AudioParameterBool({"CPU Governor", 1}, "CPU Governor", false));
+    addParameter(rateReductionParam = new juce::AudioParameterBool({"Reduce Sample Rate", 1}, "Reduce Sample Rate", false, juce::AudioParameterBoolAttributes().withAutomatable(false)));
+    addParameter(sinesEngineParam = new juce::AudioParameterChoice({"Sines Engine", 1}, "Sines Engine", dsp::SinesShiftEngine::getTypeNames(), 0));
+    
+    addParameter(harmonizerModeParam = new juce::AudioParameterChoice({"Harmonizer", 1}, "Harmonizer", {"Off", "Intervals", "MIDI"}, 0));
+    addParameter(harmonyVoicesParam = new juce::AudioParameterInt({"Harmony Voices", 1}, "Harmony Voices", 1, dsp::HarmonizerVoicePool::maxVoices, 3));
+    const int defaultIntervals[dsp::HarmonizerVoicePool::maxVoices]{0, 4, 7, 12};
+    for(auto voice = 0; voice < dsp::HarmonizerVoicePool::maxVoices; voice++){
+        const auto name = "Harmony Interval " + juce::String(voice + 1);
+        addParameter(harmonyIntervalParams[voice] = new juce::AudioParameterInt({name, 1}, name, pitchShiftMin, pitchShiftMax, defaultIntervals[voice]));
+    }
+    addParameter(harmonyRootParam = new juce::AudioParameterInt({"Harmony Root", 1}, "Harmony Root", 0, 127, 60));
+    addParameter(stemOutputsParam = new juce::AudioParameterChoice({"Stem Outputs", 1}, "Stem Outputs", {"Shifted", "Unshifted"}, 0));
+    
+    // Changing these prepares DSP stages again or changes the latency plan, which is done off the audio thread
+    configurationParams = {rateReductionParam, overlapParam, lowLatencyParam, targetLatencyParam, fftSizeParam,
+        noiseFFTSizeParam, sinesEngineParam, fusedSinesParam, harmonizerModeParam, stemOutputsParam};
+    for(auto* param : configurationParams){
+        param->addListener(this);
+    }
     
     pitchShiftSmoothing = juce::SmoothedValue(0.f);
+    
+    for(auto type = 0; type < static_cast<int>(dsp::SinesShiftEngine::Type::numTypes); type++){
+        sinesEngines.push_back(dsp::SinesShiftEngine::create(static_cast<dsp::SinesShiftEngine::Type>(type)));
+        cheaperSinesEngines.push_back(dsp::SinesShiftEngine::create(static_cast<dsp::SinesShiftEngine::Type>(type)));
+    }
+    sinesEngine = sinesEngines.front().get();
+    
+    decomposeSTN.setNoiseMagnitudeFeed(&noiseMagnitudeFeed);
+    decomposeSTN.setSinesShifter(&sinesShifter); // prepared with every STN configuration, enabled per block
+    decomposeSTN.setSinesShifterEnabled(fusedSines);
+    noiseMorphing.setNoiseMagnitudeFeed(&noiseMagnitudeFeed);
+    noiseMorphing.setSpectralNoise(true);
+    harmonizer.setNoiseMagnitudeFeed(&noiseMagnitudeFeed);
 }
 
 PitchShifterAudioProcessor::~PitchShifterAudioProcessor()
 {
+    for(auto* param : configurationParams){
+        param->removeListener(this);
+    }
+    cancelPendingUpdate();
 }
 
 //==============================================================================
@@ -112,13 +161,34 @@ void PitchShifterAudioProcessor::changeProgramName (int index, const juce::Strin
 
 //==============================================================================
 void PitchShifterAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    hostSampleRate = sampleRate;
+    hostBlockSize = samplesPerBlock;
+    cpuGovernorService->prepare(sampleRate, samplesPerBlock);
+    
+    rateReduction = rateReductionParam->get();
+    prepareInternalRate();
+    applyConfiguration();
+}
+
+void PitchShifterAudioProcessor::prepareInternalRate()
 {
     const auto channels = getTotalNumInputChannels();
+    
+    // Everything below runs at the internal rate
+    const auto factor = rateReduction ? dsp::RateReducer::getFactorFor(hostSampleRate) : 1;
+    const auto sampleRate = hostSampleRate / factor;
+    latencyPlanner.prepare(sampleRate);
+    rateReducer.prepare(factor, hostBlockSize, latencyPlanner.getMaxLatency()); // high band for the slowest plan
+    for(auto& stemUpsampler : stemUpsamplers){
+        stemUpsampler.prepare(factor, hostBlockSize, 0); // interpolation only, there is no high band to delay
+    }
+    const auto samplesPerBlock = factor > 1 ? rateReducer.getMaxLowBlockSize() : hostBlockSize;
 
 //    stretch.presetDefault(channels, sampleRate);
     const auto blockSamples = static_cast<int>(sampleRate * 0.001 * pitchBlockMs);
     const auto hopSizeSamples = static_cast<int>(blockSamples / 4);
-    stretch.configure(1, blockSamples, hopSizeSamples);
+    configureSinesEngines(blockSamples, hopSizeSamples, samplesPerBlock);
     
     outputSinesPtrs.resize(1);
     outputSinesBuf.resize(1);
@@ -126,9 +196,12 @@ void PitchShifterAudioProcessor::prepareToPlay (double sampleRate, int samplesPe
         ab.resize(samplesPerBlock);
     }
     
+    abIn.setSize(1, samplesPerBlock);
     abS.setSize(1, samplesPerBlock);
     abT.setSize(1, samplesPerBlock);
     abN.setSize(1, samplesPerBlock);
+    abSUnshifted.setSize(1, samplesPerBlock);
+    abNUnshifted.setSize(1, samplesPerBlock);
     
     if(processSpec->numChannels != channels || processSpec->maximumBlockSize != samplesPerBlock || processSpec->sampleRate != sampleRate){
         processSpec->maximumBlockSize = samplesPerBlock;
@@ -137,34 +210,51 @@ void PitchShifterAudioProcessor::prepareToPlay (double sampleRate, int samplesPe
         
         decomposeSTN.prepare();
         noiseMorphing.prepare();
+        harmonizer.prepare();
     }
 
     pitchShiftSmoothing.reset(smoothingRate);
     
     
     DBG("============ CONFIGURATION ============");
-    DBG("Sample Rate: " << sampleRate);
+    DBG("Sample Rate: " << sampleRate << " (host / " << factor << ")");
     DBG("Samples Per Block: " << samplesPerBlock);
     DBG("Channels: " << channels);
-    DBG("Stretch Block Samples: " << stretch.blockSamples());
-    DBG("Stretch Interval Samples: " << stretch.intervalSamples());
+    DBG("Stretch Block Samples: " << stretchBlockSamples);
+    DBG("Stretch Interval Samples: " << stretchIntervalSamples);
     
     DBG("============ LATENCY ============");
-    DBG("Input: " << stretch.inputLatency() << "| Output: " << stretch.outputLatency() << "| Total: " << (stretch.inputLatency() + stretch.outputLatency()) << " | Total (ms): " << ((stretch.inputLatency() + stretch.outputLatency()) / sampleRate * 1000));
+    DBG("Sines Engine: " << sinesEngine->getLatency() << " | Total (ms): " << (sinesEngine->getLatency() / sampleRate * 1000));
     DBG("Decompose STN: " << decomposeSTN.getLatency());
     DBG("Noise Morphing: " << noiseMorphing.getLatency());
     
+    // Stems wait for the slower of sines and noise. Noise morphing stays within 4096 samples, the sines engines are
+    // configured above for the longest stretch block a plan uses.
+    auto maxDelay = 4096;
+    for(const auto& engine : sinesEngines){
+        maxDelay = juce::jmax(maxDelay, engine->getLatency());
+    }
+    for(const auto& engine : cheaperSinesEngines){
+        maxDelay = juce::jmax(maxDelay, engine->getLatency());
+    }
+    
     sinesDelayLine.prepare({processSpec->sampleRate, processSpec->maximumBlockSize, 1});
-    sinesDelayLine.setMaximumDelayInSamples(4096);
+    sinesDelayLine.setMaximumDelayInSamples(maxDelay);
     sinesDelayLine.reset();
     
     transientsDelayLine.prepare({processSpec->sampleRate, processSpec->maximumBlockSize, 1});
-    transientsDelayLine.setMaximumDelayInSamples(4096);
+    transientsDelayLine.setMaximumDelayInSamples(maxDelay);
     transientsDelayLine.reset();
     
     noiseDelayLine.prepare({processSpec->sampleRate, processSpec->maximumBlockSize, 1});
-    noiseDelayLine.setMaximumDelayInSamples(4096);
+    noiseDelayLine.setMaximumDelayInSamples(maxDelay);
     noiseDelayLine.reset();
+    
+    for(auto* delayLine : {&unshiftedSinesDelayLine, &unshiftedNoiseDelayLine}){
+        delayLine->prepare({processSpec->sampleRate, processSpec->maximumBlockSize, 1});
+        delayLine->setMaximumDelayInSamples(maxDelay);
+        delayLine->reset();
+    }
 }
 
 void PitchShifterAudioProcessor::releaseResources()
@@ -173,6 +263,12 @@ void PitchShifterAudioProcessor::releaseResources()
     // spare memory, etc.
 }
 
+void PitchShifterAudioProcessor::audioWorkgroupContextChanged (const juce::AudioWorkgroup& workgroup)
+{
+    // Harmonizer workers process voices while the audio thread waits, the host schedules them together
+    harmonizer.setAudioWorkgroup(workgroup);
+}
+
 #ifndef JucePlugin_PreferredChannelConfigurations
 bool PitchShifterAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
@@ -194,6 +290,16 @@ bool PitchShifterAudioProcessor::isBusesLayoutSupported (const BusesLayout& layo
         return false;
    #endif
 
+    // Stem outputs are optional, mono or stereo
+    for (auto bus = 1; bus < layouts.outputBuses.size(); ++bus)
+    {
+        const auto& channelSet = layouts.outputBuses.getReference(bus);
+        if (! channelSet.isDisabled()
+         && channelSet != juce::AudioChannelSet::mono()
+         && channelSet != juce::AudioChannelSet::stereo())
+            return false;
+    }
+
     return true;
   #endif
 }
@@ -203,31 +309,227 @@ void PitchShifterAudioProcessor::getParametersValues(){
     pitchShiftSmoothing.setTargetValue(std::powf(2.f, pitchShiftParam->get() / 12.f));
     pitchShift = pitchShiftSmoothing.getNextValue();
     
-    stretch.setTransposeFactor(pitchShift);
+    // Quality tiers under CPU pressure, each one keeps the savings of the lower ones
+    cpuGovernorService->setEnabled(cpuGovernorParam->get());
+    cpuTier = cpuGovernorService->getTier();
+    noiseMorphing.setMaxStretchFrames(cpuTier >= services::CpuGovernorService::reducedNoiseFrames ? 1 : 2);
+    harmonizer.setNoiseMaxStretchFrames(cpuTier >= services::CpuGovernorService::reducedNoiseFrames ? 1 : 2);
+    decomposeSTN.setReducedOverlap(cpuTier >= services::CpuGovernorService::reducedOverlap);
+    decomposeSTN.setSkipRound2(cpuTier >= services::CpuGovernorService::skipRound2);
+    
+    // Engines are configured in advance, switching only clears the new one
+    const auto& engines = cpuTier >= services::CpuGovernorService::cheaperStretch ? cheaperSinesEngines : sinesEngines;
+    const auto selectedSinesEngine = engines[sinesEngineParam->getIndex()].get();
+    if(sinesEngine != selectedSinesEngine){
+        sinesEngine = selectedSinesEngine;
+        sinesEngine->reset();
+    }
+    
+    harmonizer.setSinesEngineType(static_cast<dsp::SinesShiftEngine::Type>(sinesEngineParam->getIndex()));
+    
+    sinesEngine->setPitchShiftRatio(pitchShift);
+    sinesShifter.setPitchShiftRatio(pitchShift);
     noiseMorphing.setPitchShiftRatio(pitchShift);
     
+    // Harmonizer voices take over from the sines engine and noise morphing, which start again from silence
+    const auto selectedHarmonizerMode = getSelectedHarmonizerMode();
+    if(harmonizerMode != selectedHarmonizerMode){
+        harmonizerMode = selectedHarmonizerMode;
+        harmonizer.stopAllVoices();
+        sinesEngine->reset();
+    }
+    
+    // Unshifted stem outputs need the sines before shifting, fused sines come out of DecomposeSTN shifted
+    unshiftedStems = stemOutputsParam->getIndex() == 1 && hasStemOutputs();
+    
+    const auto fuseSines = isFusedSinesSelected();
+    if(fusedSines != fuseSines){
+        fusedSines = fuseSines;
+        decomposeSTN.setSinesShifterEnabled(fusedSines);
+        sinesEngine->reset();
+    }
+    
     decomposeSTN.setThresholdSines(boundsSinesParam->get());
     decomposeSTN.setThresholdTransients(boundsTransientsParam->get());
-    
-    const auto fftSize = fftSizes[fftSizeParam->getIndex()];
-    decomposeSTN.setWindowS(fftSize);
-    decomposeSTN.setWindowTN(static_cast<int>(fftSize * 0.25f));
 
-    maxLatencySTN = juce::jmax(noiseMorphing.getLatency(), (stretch.inputLatency() + stretch.outputLatency()));
-    const auto sinesLatency = maxLatencySTN - (stretch.inputLatency() + stretch.outputLatency());
+    const auto sinesShiftLatency = fusedSines ? 0 : sinesEngine->getLatency(); // fused sines are shifted with no extra latency
+    maxLatencySTN = juce::jmax(noiseMorphing.getLatency(), sinesShiftLatency);
+    const auto sinesLatency = maxLatencySTN - sinesShiftLatency;
     const auto transientsLatency = maxLatencySTN;
     const auto noiseLatency = maxLatencySTN - noiseMorphing.getLatency();
-    setLatencySamples(decomposeSTN.getLatency() + maxLatencySTN);
+    
+    const auto pipelineLatency = decomposeSTN.getLatency() + maxLatencySTN; // internal rate samples
+    const auto factor = rateReducer.getFactor();
+    if(factor > 1) rateReducer.setPipelineLatency(pipelineLatency); // without rate reduction there is no high band
+    setLatencySamples(factor > 1 ? pipelineLatency * factor + rateReducer.getLatency() : pipelineLatency);
     
     sinesDelayLine.setDelay(sinesLatency);
     transientsDelayLine.setDelay(transientsLatency);
     noiseDelayLine.setDelay(noiseLatency);
+    unshiftedSinesDelayLine.setDelay(transientsLatency); // unshifted stems wait for the shifting like the transients
+    unshiftedNoiseDelayLine.setDelay(transientsLatency);
 }
 
+bool PitchShifterAudioProcessor::hasStemOutputs() const
+{
+    for(auto bus = 1; bus <= numStemOutputs; bus++){
+        if(const auto* output = getBus(false, bus); output != nullptr && output->isEnabled()) return true;
+    }
+    return false;
+}
+
+PitchShifterAudioProcessor::HarmonizerMode PitchShifterAudioProcessor::getSelectedHarmonizerMode() const
+{
+    // The Audio Unit stays an effect ('aufx') so existing sessions still load, hosts do not send it MIDI
+    const auto mode = static_cast<HarmonizerMode>(harmonizerModeParam->getIndex());
+    const auto audioUnit = wrapperType == wrapperType_AudioUnit || wrapperType == wrapperType_AudioUnitv3;
+    return mode == HarmonizerMode::midi && audioUnit ? HarmonizerMode::off : mode;
+}
+
+bool PitchShifterAudioProcessor::isFusedSinesSelected() const
+{
+    // Every voice shifts the sines on its own, DecomposeSTN can only shift them by one ratio
+    const auto harmonizerOff = getSelectedHarmonizerMode() == HarmonizerMode::off;
+    const auto unshifted = stemOutputsParam->getIndex() == 1 && hasStemOutputs();
+    return fusedSinesParam->get() && harmonizerOff && !unshifted;
+}
+
+void PitchShifterAudioProcessor::writeStemOutputs(juce::AudioBuffer<float>& buffer, int numInternalSamples, bool reduced){
+    const juce::AudioBuffer<float>* stems[numStemOutputs]{
+        unshiftedStems ? &abSUnshifted : &abS, &abT, unshiftedStems ? &abNUnshifted : &abN};
+    const auto numSamples = buffer.getNumSamples();
+    for(auto stem = 0; stem < numStemOutputs; stem++){
+        auto output = getBusBuffer(buffer, false, stem + 1);
+        if(output.getNumChannels() == 0) continue;
+        
+        // Without the high band, it stays in the main output only
+        if(reduced){
+            stemUpsamplers[stem].upsample(stems[stem]->getReadPointer(0), numInternalSamples, output.getWritePointer(0), numSamples);
+        } else {
+            output.copyFrom(0, 0, *stems[stem], 0, 0, numSamples);
+        }
+        for(auto channel = 1; channel < output.getNumChannels(); channel++){
+            output.copyFrom(channel, 0, output.getReadPointer(0), numSamples);
+        }
+    }
+}
+
+void PitchShifterAudioProcessor::updateLatencyPlan(){
+    latencyPlanner.setOverlap(stnOverlap);
+    latencyPlanner.setFusedSines(isFusedSinesSelected());
+    latencyPlanner.setSinesEngine(static_cast<dsp::SinesShiftEngine::Type>(sinesEngineParam->getIndex()));
+    
+    const auto targetMs = targetLatenciesMs[targetLatencyParam->getIndex()];
+    auto plan = dsp::LatencyPlan{};
+    if(targetMs > 0.){
+        plan = latencyPlanner.plan(targetMs);
+    } else {
+        // Manual, STN and noise morphing from the parameters, stretch at its default
+        const auto fftSize = fftSizes[fftSizeParam->getIndex()];
+        const auto noiseFFTSize = noiseFFTSizes[noiseFFTSizeParam->getIndex()];
+        plan.fftSizeS = fftSize;
+        plan.fftSizeTN = static_cast<int>(fftSize * 0.25f);
+        plan.parallelSTN = lowLatencySTN; // both STN rounds analyse the input, saves fftSizeS latency
+        plan.stretchBlockSamples = static_cast<int>(processSpec->sampleRate * 0.001 * pitchBlockMs);
+        plan.stretchIntervalSamples = static_cast<int>(plan.stretchBlockSamples / 4);
+        plan.noiseFFTSize = noiseFFTSize > 0 ? noiseFFTSize : juce::jmin(fftSize, dsp::NoiseMorphing::maxFFTSize);
+        latencyPlanner.evaluate(plan);
+    }
+    
+    decomposeSTN.setParallel(plan.parallelSTN);
+    decomposeSTN.setWindowS(plan.fftSizeS);
+    decomposeSTN.setWindowTN(plan.fftSizeTN);
+    noiseMorphing.setFFTSize(plan.noiseFFTSize);
+    harmonizer.setNoiseFFTSize(plan.noiseFFTSize);
+    if(stretchBlockSamples != plan.stretchBlockSamples || stretchIntervalSamples != plan.stretchIntervalSamples){
+        configureSinesEngines(plan.stretchBlockSamples, plan.stretchIntervalSamples, static_cast<int>(processSpec->maximumBlockSize));
+    }
+    
+    const juce::SpinLock::ScopedLockType lock(latencyPlanLock);
+    if(plan != latencyPlan){
+        latencyPlan = plan;
+        DBG("Latency plan: " << latencyPlanner.describe(plan));
+    }
+}
+
+void PitchShifterAudioProcessor::applyConfiguration(){
+    // Switching the internal rate prepares the whole pipeline again
+    if(rateReduction != rateReductionParam->get()){
+        rateReduction = rateReductionParam->get();
+        prepareInternalRate();
+    }
+    
+    stnOverlap = overlaps[overlapParam->getIndex()];
+    decomposeSTN.setOverlap(stnOverlap);
+    
+    // Switching between cascaded and parallel STN, FFT sizes or stretch blocks prepares the stages again
+    lowLatencySTN = lowLatencyParam->get();
+    updateLatencyPlan();
+}
+
+void PitchShifterAudioProcessor::parameterValueChanged(int parameterIndex, float newValue){
+    triggerAsyncUpdate();
+}
+
+void PitchShifterAudioProcessor::handleAsyncUpdate(){
+    // Not prepared yet, prepareToPlay applies the configuration
+    if(processSpec->sampleRate <= 0.) return;
+    
+    // Waits for the current block, the host gets silence until the DSP is configured again
+    suspendProcessing(true);
+    applyConfiguration();
+    suspendProcessing(false);
+}
+
+void PitchShifterAudioProcessor::configureSinesEngines(int blockSamples, int intervalSamples, int maximumBlockSize){
+    stretchBlockSamples = blockSamples;
+    stretchIntervalSamples = intervalSamples;
+    for(auto& engine : sinesEngines){
+        engine->configure(blockSamples, intervalSamples, maximumBlockSize);
+    }
+    // Same block, so the same latency, with fewer stretch frames per second for the Cheaper Stretch tier
+    const auto cheaperIntervalSamples = static_cast<int>(blockSamples * 0.4);
+    for(auto& engine : cheaperSinesEngines){
+        engine->configure(blockSamples, cheaperIntervalSamples, maximumBlockSize);
+    }
+    harmonizer.configureSinesEngines(blockSamples, intervalSamples, maximumBlockSize);
+}
+
+void PitchShifterAudioProcessor::updateHarmonyVoices(const juce::MidiBuffer& midiMessages){
+    if(harmonizerMode == HarmonizerMode::intervals){
+        const auto numVoices = harmonyVoicesParam->get();
+        for(auto voice = 0; voice < dsp::HarmonizerVoicePool::maxVoices; voice++){
+            if(voice < numVoices) harmonizer.startVoice(voice, getHarmonyRatio(harmonyIntervalParams[voice]->get()));
+            else harmonizer.stopVoice(voice);
+        }
+    } else if(harmonizerMode == HarmonizerMode::midi){
+        // Notes are applied at the start of the block
+        for(const auto metadata : midiMessages){
+            const auto message = metadata.getMessage();
+            if(message.isNoteOn()){
+                harmonizer.startVoice(message.getNoteNumber(), getHarmonyRatio(message.getNoteNumber() - harmonyRootParam->get()));
+            } else if(message.isNoteOff()){
+                harmonizer.stopVoice(message.getNoteNumber());
+            } else if(message.isAllNotesOff() || message.isAllSoundOff()){
+                harmonizer.stopAllVoices();
+            }
+        }
+    }
+}
+
+float PitchShifterAudioProcessor::getHarmonyRatio(int semitones) const {
+    return juce::jlimit(0.25f, 4.f, pitchShift * std::powf(2.f, semitones / 12.f));
+}
+
+dsp::LatencyPlan PitchShifterAudioProcessor::getLatencyPlan() const {
+    const juce::SpinLock::ScopedLockType lock(latencyPlanLock);
+    return latencyPlan;
+}
 
 void PitchShifterAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+    const auto blockStartMs = juce::Time::getMillisecondCounterHiRes();
     const auto totalNumInputChannels  = getTotalNumInputChannels();
     const auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -238,19 +540,47 @@ void PitchShifterAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     
     // ===== Get Parameters =====
     getParametersValues();
+    updateHarmonyVoices(midiMessages);
+    
+    // ===== Rate Reduction =====
+    // From here on the pipeline runs on numInternalSamples samples at the internal rate
+    const auto reduced = rateReducer.getFactor() > 1 && buffer.getNumChannels() > 0;
+    auto numInternalSamples = numSamples;
+    if(reduced){
+        abIn.setSize(1, rateReducer.getMaxLowBlockSize(), false, false, true);
+        numInternalSamples = rateReducer.downsample(buffer.getReadPointer(0), numSamples, abIn.getWritePointer(0));
+        abIn.setSize(1, numInternalSamples, true, false, true);
+    }
+    abS.setSize(1, numInternalSamples, false, false, true);
+    abT.setSize(1, numInternalSamples, false, false, true);
+    abN.setSize(1, numInternalSamples, false, false, true);
     
     // ===== Decompose STN =====
-    decomposeSTN.process(buffer, abS, abT, abN);
+    decomposeSTN.process(reduced ? abIn : buffer, abS, abT, abN);
+    if(unshiftedStems){
+        abSUnshifted.makeCopyOf(abS, true);
+        abNUnshifted.makeCopyOf(abN, true);
+    }
     
     // ===== Pitch Shifting =====
-    // = Sines by signal smith =
-    outputSinesPtrs[0] = outputSinesBuf[0].data();
-    
-    stretch.process(abS.getArrayOfReadPointers(), numSamples, outputSinesPtrs.data(), numSamples);
-    abS.copyFrom(0, 0, outputSinesPtrs[0], numSamples);
-
-    // = Noise =
-    noiseMorphing.process(abN);
+    if(harmonizerMode != HarmonizerMode::off){
+        // = Sines and noise by every harmonizer voice, summed =
+        harmonizer.process(abS, abN);
+        noiseMorphing.skip(numInternalSamples);
+    } else {
+        harmonizer.skip(numInternalSamples);
+        
+        // = Sines by the sines engine (already shifted by DecomposeSTN in fused mode) =
+        if(!fusedSines){
+            outputSinesPtrs[0] = outputSinesBuf[0].data();
+            
+            sinesEngine->process(abS.getReadPointer(0), outputSinesPtrs[0], numInternalSamples);
+            abS.copyFrom(0, 0, outputSinesPtrs[0], numInternalSamples);
+        }
+        
+        // = Noise =
+        noiseMorphing.process(abN);
+    }
     
     // ===== Latency Handling =====
     // = Sines =
@@ -267,26 +597,52 @@ void PitchShifterAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     juce::dsp::AudioBlock<float> noiseAb(abN);
     const juce::dsp::ProcessContextReplacing<float> contextNoise(noiseAb);
     noiseDelayLine.process(contextNoise);
+    
+    // = Unshifted Stems =
+    if(unshiftedStems){
+        juce::dsp::AudioBlock<float> unshiftedSinesAb(abSUnshifted);
+        const juce::dsp::ProcessContextReplacing<float> contextUnshiftedSines(unshiftedSinesAb);
+        unshiftedSinesDelayLine.process(contextUnshiftedSines);
+        
+        juce::dsp::AudioBlock<float> unshiftedNoiseAb(abNUnshifted);
+        const juce::dsp::ProcessContextReplacing<float> contextUnshiftedNoise(unshiftedNoiseAb);
+        unshiftedNoiseDelayLine.process(contextUnshiftedNoise);
+    }
 
     if(buffer.getNumChannels() > 0){
         // ===== S + T + N =====
-        buffer.copyFrom(0, 0, abS, 0, 0, numSamples);
-        buffer.addFrom(0, 0, abT, 0, 0, numSamples);
-        buffer.addFrom(0, 0, abN, 0, 0, numSamples);
+        if(reduced){
+            abIn.copyFrom(0, 0, abS, 0, 0, numInternalSamples);
+            abIn.addFrom(0, 0, abT, 0, 0, numInternalSamples);
+            abIn.addFrom(0, 0, abN, 0, 0, numInternalSamples);
+            // back to the host rate, the band above the internal Nyquist frequency is added unprocessed
+            rateReducer.upsample(abIn.getReadPointer(0), numInternalSamples, buffer.getWritePointer(0), numSamples);
+        } else {
+            buffer.copyFrom(0, 0, abS, 0, 0, numSamples);
+            buffer.addFrom(0, 0, abT, 0, 0, numSamples);
+            buffer.addFrom(0, 0, abN, 0, 0, numSamples);
+        }
     }
-    if(buffer.getNumChannels() > 1){
-        buffer.copyFrom (1, 0, buffer.getReadPointer(0), buffer.getNumSamples());
+    auto mainOutput = getBusBuffer(buffer, false, 0);
+    if(mainOutput.getNumChannels() > 1){
+        mainOutput.copyFrom (1, 0, mainOutput.getReadPointer(0), numSamples);
     }
+    
+    // ===== Stem Outputs =====
+    writeStemOutputs(buffer, numInternalSamples, reduced);
+    
     // ===== Plotting =====
     waveformBufferServiceS->insertBuffers(abS);
     waveformBufferServiceT->insertBuffers(abT);
     waveformBufferServiceN->insertBuffers(abN);
-    waveformBufferServiceOut->insertBuffers(buffer);
+    waveformBufferServiceOut->insertBuffers(mainOutput);
 
     
 //    spectrumBufferServiceS->insertBuffers(abS);
 //    spectrumBufferServiceT->insertBuffers(abT);
 //    spectrumBufferServiceN->insertBuffers(abN);
+    
+    cpuGovernorService->registerBlock(juce::Time::getMillisecondCounterHiRes() - blockStartMs, numSamples);
 }
 
 //==============================================================================
@@ -9,17 +9,22 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "External/signalsmith-stretch.h"
 #include "DSP/STN/decomposeSTN.h"
 #include "DSP/NM/NoiseMorphing.h"
+#include "DSP/PS/SinesShiftEngine.h"
+#include "DSP/Harmonizer/HarmonizerVoicePool.h"
+#include "DSP/Latency/LatencyPlanner.h"
+#include "DSP/Resampler/RateReducer.h"
 #include "Services/WaveformBufferQueueService.h"
 #include "Services/SpectrumBufferQueueService.h"
+#include "Services/CpuGovernorService.h"
 
 //==============================================================================
 /**
 */
 
-class PitchShifterAudioProcessor  : public juce::AudioProcessor
+class PitchShifterAudioProcessor  : public juce::AudioProcessor, private juce::AudioProcessorParameter::Listener,
+                                    private juce::AsyncUpdater
 {
     public:
     //==============================================================================
@@ -29,6 +34,7 @@ class PitchShifterAudioProcessor  : public juce::AudioProcessor
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void audioWorkgroupContextChanged (const juce::AudioWorkgroup& workgroup) override;
     
 #ifndef JucePlugin_PreferredChannelConfigurations
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
@@ -68,26 +74,102 @@ class PitchShifterAudioProcessor  : public juce::AudioProcessor
     std::shared_ptr<services::SpectrumBufferQueueService> spectrumBufferServiceT;
     std::shared_ptr<services::SpectrumBufferQueueService> spectrumBufferServiceN;
     
+    std::shared_ptr<services::CpuGovernorService> cpuGovernorService; // current quality tier for the editor
+    
     juce::RangedAudioParameter& getPitchShiftParam() { return *pitchShiftParam; }
     juce::RangedAudioParameter& getBoundsSinesParam() { return *boundsSinesParam; }
     juce::RangedAudioParameter& getBoundsTransientsParam() { return *boundsTransientsParam; }
     juce::RangedAudioParameter& getFFTSizeParam() { return *fftSizeParam; }
+    juce::RangedAudioParameter& getFusedSinesParam() { return *fusedSinesParam; }
+    juce::RangedAudioParameter& getOverlapParam() { return *overlapParam; }
+    juce::RangedAudioParameter& getLowLatencyParam() { return *lowLatencyParam; }
+    juce::RangedAudioParameter& getTargetLatencyParam() { return *targetLatencyParam; }
+    juce::RangedAudioParameter& getNoiseFFTSizeParam() { return *noiseFFTSizeParam; }
+    juce::RangedAudioParameter& getCpuGovernorParam() { return *cpuGovernorParam; }
+    juce::RangedAudioParameter& getRateReductionParam() { return *rateReductionParam; }
+    juce::RangedAudioParameter& getSinesEngineParam() { return *sinesEngineParam; }
+    juce::RangedAudioParameter& getHarmonizerModeParam() { return *harmonizerModeParam; }
+    juce::RangedAudioParameter& getHarmonyVoicesParam() { return *harmonyVoicesParam; }
+    juce::RangedAudioParameter& getHarmonyIntervalParam(int voice) { return *harmonyIntervalParams[voice]; }
+    juce::RangedAudioParameter& getHarmonyRootParam() { return *harmonyRootParam; }
+    juce::RangedAudioParameter& getStemOutputsParam() { return *stemOutputsParam; }
+    
+    /// Harmonizer voices currently sounding, see getHarmonizerModeParam.
+    int getNumHarmonyVoices() const { return harmonizer.getNumActiveVoices(); }
+    
+    /// Sines shifting engine, for its latency and measured cost per block.
+    /// - Parameter index: Index of the Sines Engine parameter.
+    const dsp::SinesShiftEngine& getSinesEngine(int index) const { return *sinesEngines[index]; }
+    
+    /// Current configuration and latency breakdown, see getTargetLatencyParam.
+    dsp::LatencyPlan getLatencyPlan() const;
     
     const int pitchShiftMin{-24};
     const int pitchShiftMax{24};
     
     const int fftSizes[4]{512, 1024, 2048, 4096};
+    const int overlaps[3]{2, 4, 8}; // STN frames per window, 2 is the low CPU mode
+    const double targetLatenciesMs[7]{0., 10., 20., 30., 50., 80., 120.}; // 0 is manual configuration
+    const int noiseFFTSizes[4]{0, 512, 1024, 2048}; // 0 follows the STN FFT size
     
     const float minBounds{0.4f};
     const float maxBounds{0.9f};
     
+    /// Off shifts by the Pitch Shift parameter only. Intervals sounds one voice per Harmony Interval parameter, MIDI one
+    /// voice per held note relative to the Harmony Root parameter. Both are transposed by the Pitch Shift parameter.
+    enum class HarmonizerMode { off, intervals, midi };
+    
     private:
     //==============================================================================
     void getParametersValues();
     
+    /// Prepares all stages for the internal sample rate, the host rate or a fraction of it when reducing the rate.
+    void prepareInternalRate();
+    
+    /// Configures every sines engine for the same stretch block, so switching between them does not allocate.
+    void configureSinesEngines(int blockSamples, int intervalSamples, int maximumBlockSize);
+    
+    /// Configures STN, stretch and noise morphing, either from the target latency or from the manual parameters.
+    void updateLatencyPlan();
+    
+    /// Applies the parameters that allocate or reset the DSP, see configurationParams. Not audio thread safe, called by
+    /// prepareToPlay and by handleAsyncUpdate.
+    void applyConfiguration();
+    
+    /// Defers configuration changes to the message thread.
+    void parameterValueChanged(int parameterIndex, float newValue) override;
+    void parameterGestureChanged(int parameterIndex, bool gestureIsStarting) override {}
+    
+    /// Applies a configuration change with processing suspended.
+    void handleAsyncUpdate() override;
+    
+    /// Starts and stops harmonizer voices from the interval parameters or the MIDI notes of the block.
+    void updateHarmonyVoices(const juce::MidiBuffer& midiMessages);
+    
+    /// Pitch shift ratio of a harmonizer voice, transposed by the Pitch Shift parameter.
+    /// - Parameter semitones: Interval of the voice.
+    float getHarmonyRatio(int semitones) const;
+    
+    /// Whether the host enabled any of the Sines, Transients and Noise output buses.
+    bool hasStemOutputs() const;
+    
+    /// Harmonizer mode of the parameter, MIDI mode counts as off where the host sends no MIDI.
+    HarmonizerMode getSelectedHarmonizerMode() const;
+    
+    /// Whether the Fused Sines parameter applies, it does not with harmonizer voices or unshifted stem outputs.
+    bool isFusedSinesSelected() const;
+    
+    /// Copies the latency aligned stems to the enabled stem output buses, back at the host rate when reduced.
+    /// - Parameters:
+    ///   - buffer: Buffer of all buses, as given to processBlock.
+    ///   - numInternalSamples: Samples in abS, abT and abN.
+    ///   - reduced: Whether the stems run at the reduced internal rate.
+    void writeStemOutputs(juce::AudioBuffer<float>& buffer, int numInternalSamples, bool reduced);
+    
     //==============================================================================
     
     juce::AudioParameterChoice* fftSizeParam;
+    juce::AudioParameterChoice* overlapParam;
     
     
     juce::AudioParameterInt* pitchShiftParam;
@@ -96,17 +178,57 @@ class PitchShifterAudioProcessor  : public juce::AudioProcessor
     juce::AudioParameterFloat* boundsSinesParam;
     juce::AudioParameterFloat* boundsTransientsParam;
     
+    juce::AudioParameterBool* fusedSinesParam;
+    juce::AudioParameterBool* lowLatencyParam;
+    juce::AudioParameterChoice* targetLatencyParam;
+    juce::AudioParameterChoice* noiseFFTSizeParam;
+    juce::AudioParameterBool* cpuGovernorParam;
+    juce::AudioParameterBool* rateReductionParam;
+    juce::AudioParameterChoice* sinesEngineParam;
+    juce::AudioParameterChoice* harmonizerModeParam;
+    juce::AudioParameterInt* harmonyVoicesParam;
+    std::array<juce::AudioParameterInt*, dsp::HarmonizerVoicePool::maxVoices> harmonyIntervalParams;
+    juce::AudioParameterInt* harmonyRootParam;
+    juce::AudioParameterChoice* stemOutputsParam;
+    std::vector<juce::AudioProcessorParameter*> configurationParams; // applied by applyConfiguration, never per block
+    
     float pitchShift{1.f};
+    bool fusedSines{false}; // sines shifted inside DecomposeSTN instead of the sines engine, not with the harmonizer
+    HarmonizerMode harmonizerMode{HarmonizerMode::off};
+    bool unshiftedStems{false}; // stem outputs enabled and set to the stems before shifting
+    int cpuTier{services::CpuGovernorService::full}; // quality tier applied to the current block
+    int stnOverlap{8}; // applied STN overlap
+    bool lowLatencySTN{false}; // applied Low Latency STN, manual configuration only
     
     const double pitchBlockMs{50.};
     const int smoothingRate{10}; // number of steps to reach target value
     
     std::shared_ptr<juce::dsp::ProcessSpec> processSpec;
     
-    signalsmith::stretch::SignalsmithStretch<float> stretch;
+    std::vector<std::unique_ptr<dsp::SinesShiftEngine>> sinesEngines; // one per SinesShiftEngine::Type
+    std::vector<std::unique_ptr<dsp::SinesShiftEngine>> cheaperSinesEngines; // longer interval, Cheaper Stretch tier
+    dsp::SinesShiftEngine* sinesEngine{nullptr}; // engine of the Sines Engine parameter and CPU tier
+    int stretchBlockSamples{0};    // block of all sines engines
+    int stretchIntervalSamples{0}; // interval of all sines engines
     dsp::DecomposeSTN decomposeSTN;
     dsp::NoiseMorphing noiseMorphing;
+    dsp::SpectralPitchShifter sinesShifter;
+    dsp::NoiseMagnitudeFeed noiseMagnitudeFeed; // noise spectrum from DecomposeSTN to NoiseMorphing
     
+    // Harmonizer voices replace sinesEngine and noiseMorphing, they run the same configuration and have the same latency
+    dsp::HarmonizerVoicePool harmonizer;
+    
+    // At 88.2 kHz and above the pipeline can run at 44.1 / 48 kHz, FFT sizes and stretch blocks keep their duration
+    dsp::RateReducer rateReducer;
+    bool rateReduction{false};
+    double hostSampleRate{44100.};
+    int hostBlockSize{512};
+    
+    dsp::LatencyPlanner latencyPlanner;
+    dsp::LatencyPlan latencyPlan; // applied configuration, guarded by latencyPlanLock
+    mutable juce::SpinLock latencyPlanLock; // latencyPlan is written by applyConfiguration and read by the editor
+    
+    juce::AudioBuffer<float> abIn; // input at the internal rate, then the S + T + N sum
     juce::AudioBuffer<float> abS;
     juce::AudioBuffer<float> abT;
     juce::AudioBuffer<float> abN;
@@ -115,6 +237,14 @@ class PitchShifterAudioProcessor  : public juce::AudioProcessor
     juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> transientsDelayLine;
     juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> noiseDelayLine;
     
+    // Stem output buses 1 to 3 carry S, T and N next to the main mix, so one instance can feed separate processing
+    static constexpr int numStemOutputs{3};
+    juce::AudioBuffer<float> abSUnshifted; // sines and noise before shifting, for unshifted stem outputs
+    juce::AudioBuffer<float> abNUnshifted;
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> unshiftedSinesDelayLine;
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> unshiftedNoiseDelayLine;
+    std::array<dsp::RateReducer, numStemOutputs> stemUpsamplers; // only upsample, in step with rateReducer
+    
     std::vector<float *> outputSinesPtrs;
     std::vector<std::vector<float>> outputSinesBuf;
     
@@ -0,0 +1,75 @@
+#include "CpuGovernorService.h"
+
+void services::CpuGovernorService::prepare(double newSampleRate, int maximumBlockSize)
+{
+    sampleRate = newSampleRate;
+    loadMeasurer.reset(sampleRate, maximumBlockSize);
+    load = 0.0;
+    pressureSamples = 0;
+    headroomSamples = 0;
+}
+
+void services::CpuGovernorService::setEnabled(bool shouldBeEnabled)
+{
+    if (enabled == shouldBeEnabled)
+        return;
+
+    enabled = shouldBeEnabled;
+    tier = full;
+    pressureSamples = 0;
+    headroomSamples = 0;
+}
+
+void services::CpuGovernorService::registerBlock(double millisecondsTaken, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    loadMeasurer.registerRenderTime(millisecondsTaken, numSamples);
+    load = loadMeasurer.getLoadAsProportion();
+
+    if (!enabled)
+        return;
+
+    // Only sustained pressure counts, a single slow block resets the headroom but does not step down
+    if (load > stepDownLoad)
+    {
+        pressureSamples += numSamples;
+        headroomSamples = 0;
+    }
+    else if (load < stepUpLoad)
+    {
+        headroomSamples += numSamples;
+        pressureSamples = 0;
+    }
+    else
+    {
+        pressureSamples = 0;
+        headroomSamples = 0;
+    }
+
+    const auto currentTier = tier.load();
+    if (pressureSamples >= stepDownSeconds * sampleRate && currentTier < numTiers - 1)
+    {
+        tier = currentTier + 1;
+        pressureSamples = 0;
+    }
+    else if (headroomSamples >= stepUpSeconds * sampleRate && currentTier > full)
+    {
+        tier = currentTier - 1;
+        headroomSamples = 0;
+    }
+}
+
+juce::String services::CpuGovernorService::getTierName(int tierToName)
+{
+    switch (tierToName)
+    {
+        case full: return "Full";
+        case reducedOverlap: return "Reduced Overlap";
+        case cheaperStretch: return "Cheaper Stretch";
+        case reducedNoiseFrames: return "Reduced Noise Frames";
+        case skipRound2: return "No Transients";
+        default: return {};
+    }
+}
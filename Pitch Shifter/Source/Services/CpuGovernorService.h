@@ -0,0 +1,64 @@
+#pragma once
+
+#include "JuceHeader.h"
+
+namespace services
+{
+    /// Watches the processing time of every block against the block duration and lowers the quality tier when the
+    /// load stays high, so the host does not drop out. Tiers are cumulative, each one keeps the savings of the
+    /// previous ones. The tier goes back up only after the load stayed low for a longer time, so it does not
+    /// oscillate around the threshold.
+    /// Every tier only switches settings that change live without allocating, the STN skips frames instead of being
+    /// prepared with a lower overlap and the cheaper sines engines are configured together with the regular ones.
+    /// Blocks are registered on the audio thread, the tier can be read from any thread.
+    class CpuGovernorService
+    {
+    public:
+        enum Tier
+        {
+            full = 0,           // no savings
+            reducedOverlap,     // every other STN frame skipped at overlap 8, see DecomposeSTN::setReducedOverlap
+            cheaperStretch,     // sines engines with a longer stretch interval, same block size and latency
+            reducedNoiseFrames, // one noise morphing frame per hop, the rest of the shift by envelope warp
+            skipRound2,         // no T / N masks, the STN residual goes to N as a whole
+            numTiers
+        };
+
+        CpuGovernorService() = default;
+
+        /// Resets the load measurement. Not audio thread safe.
+        void prepare(double sampleRate, int maximumBlockSize);
+
+        /// When disabled, the tier is held at full and blocks are only measured.
+        void setEnabled(bool shouldBeEnabled);
+
+        /// Registers the processing time of a block and steps the tier down or up.
+        /// - Parameters:
+        ///   - millisecondsTaken: Time spent in processBlock.
+        ///   - numSamples: Number of samples in the block.
+        void registerBlock(double millisecondsTaken, int numSamples);
+
+        int getTier() const { return tier.load(); }
+
+        /// Smoothed proportion of the block duration spent processing.
+        double getLoad() const { return load.load(); }
+
+        static juce::String getTierName(int tierToName);
+
+    private:
+        juce::AudioProcessLoadMeasurer loadMeasurer;
+
+        std::atomic<int> tier{full};
+        std::atomic<double> load{0.0};
+        bool enabled{false};
+
+        double sampleRate{44100.0};
+        int pressureSamples{0}; // time spent above stepDownLoad
+        int headroomSamples{0}; // time spent below stepUpLoad
+
+        static constexpr double stepDownLoad{0.8};
+        static constexpr double stepUpLoad{0.5};
+        static constexpr double stepDownSeconds{0.25};
+        static constexpr double stepUpSeconds{3.0};
+    };
+}
@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    Offline sample library renderer. Decomposes every source once and renders
+    it at a range of transpositions, one WAV file per transposition.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "SampleRenderer.h"
+
+namespace {
+void printUsage()
+{
+    std::cout << "Usage: SampleRenderer [options] source files..." << std::endl
+              << "  --out=<folder>      output folder, created if missing (default: rendered)" << std::endl
+              << "  --from=<semitones>  lowest transposition (default: -24)" << std::endl
+              << "  --to=<semitones>    highest transposition (default: 24)" << std::endl
+              << "  --engine=<name>     sines engine: " << dsp::SinesShiftEngine::getTypeNames().joinIntoString(", ")
+              << " (default: Signalsmith)" << std::endl
+              << "  --fft=<size>        STN FFT size: 512, 1024, 2048 or 4096 (default: 2048)" << std::endl
+              << "  --threads=<count>   worker threads (default: one per CPU core)" << std::endl
+              << "  --cache=<folder>    stem cache folder (default: \"STN Stem Cache\" in the temp folder)" << std::endl
+              << "  --no-cache          always decompose, do not read or write cached stems" << std::endl;
+}
+
+/// Value of a "--name=value" or "--name value" option, or the fallback when it is missing.
+juce::String getOption(const juce::ArgumentList& args, const juce::String& name, const juce::String& fallback)
+{
+    return args.containsOption(name) ? args.getValueForOption(name) : fallback;
+}
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    const juce::ArgumentList args(argc, argv);
+    if (args.size() == 0 || args.containsOption("--help|-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    // Everything that is not an option or the value of one is a source file
+    juce::Array<juce::File> sources;
+    for (auto i = 0; i < args.size(); i++)
+    {
+        const auto& arg = args[i];
+        if (arg.isOption())
+        {
+            if (!arg.text.contains("=") && arg != "--no-cache") i++; // value given as the next argument
+            continue;
+        }
+        sources.add(arg.resolveAsFile());
+    }
+
+    const auto engineIndex = dsp::SinesShiftEngine::getTypeNames().indexOf(getOption(args, "--engine", "Signalsmith"), true);
+    const auto fftSize = getOption(args, "--fft", "2048").getIntValue();
+    if (sources.isEmpty() || engineIndex < 0 || !juce::isPowerOfTwo(fftSize) || fftSize < 512 || fftSize > 4096)
+    {
+        printUsage();
+        return 1;
+    }
+
+    SampleRenderer::Settings settings;
+    settings.fftSize = fftSize;
+    settings.sinesEngine = static_cast<dsp::SinesShiftEngine::Type>(engineIndex);
+
+    const auto from = juce::jlimit(-24, 24, getOption(args, "--from", "-24").getIntValue());
+    const auto to = juce::jlimit(from, 24, getOption(args, "--to", "24").getIntValue());
+    juce::Array<int> semitones;
+    for (auto semitone = from; semitone <= to; semitone++)
+        semitones.add(semitone);
+
+    const auto outputDirectory = juce::File::getCurrentWorkingDirectory().getChildFile(getOption(args, "--out", "rendered"));
+    if (const auto result = outputDirectory.createDirectory(); result.failed())
+    {
+        std::cerr << result.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    SampleRenderer renderer(settings, getOption(args, "--threads", "0").getIntValue());
+    if (!args.containsOption("--no-cache"))
+    {
+        const auto defaultCache = juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile("STN Stem Cache");
+        renderer.setCacheDirectory(args.containsOption("--cache") ? args.getFileForOption("--cache") : defaultCache);
+    }
+    auto failed = false;
+    for (const auto& source : sources)
+    {
+        const auto startMs = juce::Time::getMillisecondCounterHiRes();
+        const auto result = renderer.renderFile(source, outputDirectory, semitones);
+        if (result.failed())
+        {
+            std::cerr << result.getErrorMessage() << std::endl;
+            failed = true;
+            continue;
+        }
+        std::cout << source.getFileName() << ": " << semitones.size() << " transpositions in "
+                  << juce::String((juce::Time::getMillisecondCounterHiRes() - startMs) / 1000.0, 1) << " s" << std::endl;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+#include "SampleRenderer.h"
+
+namespace {
+/// Copies numSamples samples from pos on, zeros past the end of the source.
+void readPadded(const float *source, const int sourceLength, const int pos, float *dest, const int numSamples) {
+    const auto available = juce::jlimit(0, numSamples, sourceLength - pos);
+    juce::FloatVectorOperations::copy(dest, source + pos, available);
+    juce::FloatVectorOperations::clear(dest + available, numSamples - available);
+}
+
+/// Adds a block that comes out latency samples late, only the part inside the destination.
+void addAligned(float *dest, const int destLength, const float *block, const int pos, const int numSamples,
+                const int latency) {
+    const auto start = pos - latency;
+    const auto first = juce::jmax(0, -start);
+    const auto last = juce::jmin(numSamples, destLength - start);
+    if (last > first)
+        juce::FloatVectorOperations::add(dest + start + first, block + first, last - first);
+}
+} // namespace
+
+SampleRenderer::SampleRenderer(const Settings &newSettings, const int numThreads)
+    : settings(newSettings), threadPool(numThreads > 0 ? numThreads : juce::SystemStats::getNumCpus()) {
+    formatManager.registerBasicFormats();
+}
+
+void SampleRenderer::Stems::read(const Stem stem, const int channel, const int pos, float *dest,
+                                 const int numSamples) const {
+    // The buffers hide the enum values of the same name
+    const auto &buffer = stem == StemSource::sines ? sines : stem == StemSource::transients ? transients : noise;
+    readPadded(buffer.getReadPointer(channel), buffer.getNumSamples(), pos, dest, numSamples);
+}
+
+void SampleRenderer::setCacheDirectory(const juce::File &cacheDirectory) {
+    stemCache = cacheDirectory == juce::File() ? nullptr : std::make_unique<StemCache>(cacheDirectory);
+}
+
+SampleRenderer::Stems SampleRenderer::decompose(const juce::AudioBuffer<float> &source, const double sampleRate) {
+    Stems stems;
+    stems.sampleRate = sampleRate;
+    stems.sines.setSize(source.getNumChannels(), source.getNumSamples());
+    stems.transients.setSize(source.getNumChannels(), source.getNumSamples());
+    stems.noise.setSize(source.getNumChannels(), source.getNumSamples());
+
+    if (source.getNumChannels() == 1) {
+        decomposeChannel(source, 0, stems);
+        return stems;
+    }
+
+    std::vector<std::function<void()>> jobs;
+    for (auto channel = 0; channel < source.getNumChannels(); channel += maxStreams) {
+        const auto numChannels = juce::jmin(maxStreams, source.getNumChannels() - channel);
+        jobs.push_back([this, &source, channel, numChannels, &stems] {
+            decomposeChannels(source, channel, numChannels, stems);
+        });
+    }
+    runJobs(jobs);
+    return stems;
+}
+
+void SampleRenderer::decomposeChannel(const juce::AudioBuffer<float> &source, const int channel, Stems &stems) const {
+    auto processSpec = std::make_shared<juce::dsp::ProcessSpec>();
+    processSpec->sampleRate = stems.sampleRate;
+    processSpec->maximumBlockSize = blockSize;
+    processSpec->numChannels = 1;
+
+    dsp::DecomposeSTN decomposeSTN(processSpec);
+    decomposeSTN.prepare();
+    decomposeSTN.setWindowS(settings.fftSize);
+    decomposeSTN.setWindowTN(settings.fftSize / 4);
+    decomposeSTN.setOverlap(settings.overlap);
+    decomposeSTN.setThresholdSines(settings.boundsSines);
+    decomposeSTN.setThresholdTransients(settings.boundsTransients);
+
+    // Runs past the end of the source by the latency, stems are written latency samples earlier
+    const auto numSamples = source.getNumSamples();
+    const auto latency = decomposeSTN.getLatency();
+    juce::AudioBuffer<float> input(1, blockSize), abS(1, blockSize), abT(1, blockSize), abN(1, blockSize);
+    for (auto pos = 0; pos < numSamples + latency; pos += blockSize) {
+        const auto n = juce::jmin(blockSize, numSamples + latency - pos);
+        for (auto *ab : {&input, &abS, &abT, &abN}) {
+            ab->setSize(1, n, false, false, true);
+        }
+        readPadded(source.getReadPointer(channel), numSamples, pos, input.getWritePointer(0), n);
+
+        decomposeSTN.process(input, abS, abT, abN);
+
+        addAligned(stems.sines.getWritePointer(channel), numSamples, abS.getReadPointer(0), pos, n, latency);
+        addAligned(stems.transients.getWritePointer(channel), numSamples, abT.getReadPointer(0), pos, n, latency);
+        addAligned(stems.noise.getWritePointer(channel), numSamples, abN.getReadPointer(0), pos, n, latency);
+    }
+}
+
+void SampleRenderer::decomposeChannels(const juce::AudioBuffer<float> &source, const int firstChannel,
+                                       const int numChannels, Stems &stems) const {
+    auto processSpec = std::make_shared<juce::dsp::ProcessSpec>();
+    processSpec->sampleRate = stems.sampleRate;
+    processSpec->maximumBlockSize = blockSize;
+    processSpec->numChannels = 1;
+
+    const auto numStreams = numChannels <= 4 ? 4 : numChannels <= 8 ? 8 : 16;
+    dsp::MultiStreamSTN multiStreamSTN(processSpec, numStreams);
+    multiStreamSTN.setWindowS(settings.fftSize);
+    multiStreamSTN.setWindowTN(settings.fftSize / 4);
+    multiStreamSTN.setOverlap(settings.overlap);
+    multiStreamSTN.setThresholdSines(settings.boundsSines);
+    multiStreamSTN.setThresholdTransients(settings.boundsTransients);
+    multiStreamSTN.prepare();
+
+    // Same as decomposeChannel, for all channels at once. Streams past numChannels stay silent.
+    const auto numSamples = source.getNumSamples();
+    const auto latency = multiStreamSTN.getLatency();
+    juce::AudioBuffer<float> input(numStreams, blockSize), abS(numStreams, blockSize), abT(numStreams, blockSize),
+        abN(numStreams, blockSize);
+    for (auto pos = 0; pos < numSamples + latency; pos += blockSize) {
+        const auto n = juce::jmin(blockSize, numSamples + latency - pos);
+        for (auto *ab : {&input, &abS, &abT, &abN}) {
+            ab->setSize(numStreams, n, false, false, true);
+        }
+        for (auto stream = 0; stream < numStreams; stream++) {
+            if (stream < numChannels)
+                readPadded(source.getReadPointer(firstChannel + stream), numSamples, pos,
+                           input.getWritePointer(stream), n);
+            else
+                input.clear(stream, 0, n);
+        }
+
+        multiStreamSTN.process(input, abS, abT, abN);
+
+        for (auto stream = 0; stream < numChannels; stream++) {
+            const auto channel = firstChannel + stream;
+            addAligned(stems.sines.getWritePointer(channel), numSamples, abS.getReadPointer(stream), pos, n, latency);
+            addAligned(stems.transients.getWritePointer(channel), numSamples, abT.getReadPointer(stream), pos, n,
+                       latency);
+            addAligned(stems.noise.getWritePointer(channel), numSamples, abN.getReadPointer(stream), pos, n, latency);
+        }
+    }
+}
+
+juce::AudioBuffer<float> SampleRenderer::render(const StemSource &stems, const int semitones) const {
+    const auto numChannels = stems.getNumChannels();
+    const auto numSamples = stems.getNumSamples();
+    const auto ratio = std::powf(2.f, semitones / 12.f);
+
+    auto processSpec = std::make_shared<juce::dsp::ProcessSpec>();
+    processSpec->sampleRate = stems.getSampleRate();
+    processSpec->maximumBlockSize = blockSize;
+    processSpec->numChannels = 1;
+    const auto stretchBlockSamples = static_cast<int>(stems.getSampleRate() * 0.001 * settings.stretchBlockMs);
+
+    juce::AudioBuffer<float> output(numChannels, numSamples);
+    Vec1D sinesIn(blockSize), sinesOut(blockSize);
+    juce::AudioBuffer<float> noise(1, blockSize);
+    for (auto channel = 0; channel < numChannels; channel++) {
+        auto *out = output.getWritePointer(channel);
+        stems.read(StemSource::transients, channel, 0, out, numSamples);
+
+        auto sinesEngine = dsp::SinesShiftEngine::create(settings.sinesEngine);
+        sinesEngine->configure(stretchBlockSamples, stretchBlockSamples / 4, blockSize);
+        sinesEngine->setPitchShiftRatio(ratio);
+
+        dsp::NoiseMorphing noiseMorphing(processSpec);
+        noiseMorphing.setSpectralNoise(true);
+        noiseMorphing.setSeed(static_cast<std::uint64_t>(channel + 1));
+        noiseMorphing.setFFTSize(settings.noiseFFTSize);
+        noiseMorphing.setPitchShiftRatio(ratio);
+
+        // Like the plugin, noise is passed through unmorphed when it is not shifted
+        const auto morphNoise = semitones != 0;
+        if (!morphNoise) {
+            for (auto pos = 0; pos < numSamples; pos += blockSize) {
+                const auto n = juce::jmin(blockSize, numSamples - pos);
+                stems.read(StemSource::noise, channel, pos, sinesIn.data(), n);
+                juce::FloatVectorOperations::add(out + pos, sinesIn.data(), n);
+            }
+        }
+
+        // Runs past the end of the stems by the longer latency, both outputs are trimmed by their own latency. Engine
+        // latencies are the same at every ratio, see SinesShiftEngine::getLatency.
+        const auto sinesLatency = sinesEngine->getLatency();
+        const auto noiseLatency = morphNoise ? noiseMorphing.getLatency() : 0;
+        const auto length = numSamples + juce::jmax(sinesLatency, noiseLatency);
+        for (auto pos = 0; pos < length; pos += blockSize) {
+            const auto n = juce::jmin(blockSize, length - pos);
+
+            stems.read(StemSource::sines, channel, pos, sinesIn.data(), n);
+            sinesEngine->process(sinesIn.data(), sinesOut.data(), n);
+            addAligned(out, numSamples, sinesOut.data(), pos, n, sinesLatency);
+
+            if (morphNoise) {
+                noise.setSize(1, n, false, false, true);
+                stems.read(StemSource::noise, channel, pos, noise.getWritePointer(0), n);
+                noiseMorphing.process(noise);
+                addAligned(out, numSamples, noise.getReadPointer(0), pos, n, noiseLatency);
+            }
+        }
+    }
+    return output;
+}
+
+juce::Result SampleRenderer::renderFile(const juce::File &sourceFile, const juce::File &outputDirectory,
+                                        const juce::Array<int> &semitones) {
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(sourceFile));
+    if (reader == nullptr)
+        return juce::Result::fail("Can not read " + sourceFile.getFullPathName());
+
+    juce::AudioBuffer<float> source(static_cast<int>(reader->numChannels), static_cast<int>(reader->lengthInSamples));
+    reader->read(&source, 0, source.getNumSamples(), 0, true, true);
+
+    // Decomposed once, every transposition is rendered from the same stems
+    const auto stems = getStems(source, reader->sampleRate);
+
+    juce::StringArray errors;
+    juce::CriticalSection errorsLock;
+    std::vector<std::function<void()>> jobs;
+    for (const auto semitone : semitones) {
+        jobs.push_back([this, &stems, &sourceFile, &outputDirectory, &errors, &errorsLock, semitone] {
+            const auto file = outputDirectory.getChildFile(sourceFile.getFileNameWithoutExtension() + "_" +
+                                                           getTranspositionSuffix(semitone) + ".wav");
+            const auto result = writeFile(file, render(*stems, semitone), stems->getSampleRate());
+            if (result.failed()) {
+                const juce::ScopedLock lock(errorsLock);
+                errors.add(result.getErrorMessage());
+            }
+        });
+    }
+    runJobs(jobs);
+
+    return errors.isEmpty() ? juce::Result::ok() : juce::Result::fail(errors.joinIntoString("\n"));
+}
+
+std::unique_ptr<StemSource> SampleRenderer::getStems(const juce::AudioBuffer<float> &source, const double sampleRate) {
+    if (stemCache == nullptr)
+        return std::make_unique<Stems>(decompose(source, sampleRate));
+
+    StemCache::Key key;
+    key.contentHash = StemCache::hashSource(source, sampleRate);
+    key.fftSize = settings.fftSize;
+    key.overlap = settings.overlap;
+    key.boundsSines = settings.boundsSines;
+    key.boundsTransients = settings.boundsTransients;
+    if (auto cached = stemCache->open(key))
+        return cached;
+
+    auto stems = std::make_unique<Stems>(decompose(source, sampleRate));
+    if (const auto result = stemCache->write(key, *stems); result.failed()) {
+        DBG("Stem cache: " << result.getErrorMessage()); // renders still work without the cache
+        return stems;
+    }
+
+    // The first render mixes the quantised stems too, so it matches the renders reading them from the cache
+    if (auto cached = stemCache->open(key))
+        return cached;
+    return stems;
+}
+
+void SampleRenderer::runJobs(const std::vector<std::function<void()>> &jobs) {
+    if (jobs.empty())
+        return;
+
+    // Every job counts itself off, the last one wakes the caller
+    std::atomic<int> remaining{static_cast<int>(jobs.size())};
+    juce::WaitableEvent allDone;
+    for (const auto &job : jobs) {
+        threadPool.addJob([&job, &remaining, &allDone] {
+            job();
+            if (--remaining == 0)
+                allDone.signal();
+        });
+    }
+    allDone.wait();
+}
+
+juce::Result SampleRenderer::writeFile(const juce::File &file, const juce::AudioBuffer<float> &audio,
+                                       const double sampleRate) const {
+    file.deleteFile();
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream->openedOk())
+        return juce::Result::fail("Can not write " + file.getFullPathName());
+
+    juce::WavAudioFormat wavFormat;
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        wavFormat.createWriterFor(stream.get(), sampleRate, static_cast<unsigned int>(audio.getNumChannels()),
+                                  settings.bitDepth, {}, 0));
+    if (writer == nullptr)
+        return juce::Result::fail("Can not write " + file.getFullPathName());
+    stream.release(); // owned by the writer
+
+    if (!writer->writeFromAudioSampleBuffer(audio, 0, audio.getNumSamples()))
+        return juce::Result::fail("Can not write " + file.getFullPathName());
+    return juce::Result::ok();
+}
+
+juce::String SampleRenderer::getTranspositionSuffix(const int semitones) {
+    return (semitones > 0 ? "+" : "") + juce::String(semitones);
+}
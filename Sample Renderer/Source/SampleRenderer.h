@@ -0,0 +1,108 @@
+#pragma once
+#include "../../Pitch Shifter/Source/DSP/NM/NoiseMorphing.h"
+#include "../../Pitch Shifter/Source/DSP/PS/SinesShiftEngine.h"
+#include "../../Pitch Shifter/Source/DSP/STN/MultiStreamSTN.h"
+#include "../../Pitch Shifter/Source/DSP/STN/decomposeSTN.h"
+#include "StemCache.h"
+#include "StemSource.h"
+#include <JuceHeader.h>
+
+/// Renders a source at many transpositions offline, for building sampler instruments. Every source is decomposed once
+/// into S / T / N stems, then all transpositions are rendered in parallel from the stems: sines by a sines shifting
+/// engine, noise by noise morphing, transients unshifted, the same pipeline as the plugin. The outputs are trimmed for
+/// latency, so they line up with the source, and written as WAV files. With a stem cache, the stems of a source are
+/// stored after the first decomposition and read back from the cache on later runs.
+class SampleRenderer {
+  public:
+    struct Settings {
+        int fftSize{2048};               // STN round 1 FFT size, round 2 uses a quarter of it
+        int overlap{8};                  // STN frames per window
+        float boundsSines{0.75f};
+        float boundsTransients{0.8f};
+        int noiseFFTSize{2048};          // noise morphing FFT size, up to dsp::NoiseMorphing::maxFFTSize
+        dsp::SinesShiftEngine::Type sinesEngine{dsp::SinesShiftEngine::Type::signalsmith};
+        double stretchBlockMs{50.};      // sines engine block, the interval is a quarter of it
+        int bitDepth{24};
+    };
+
+    /// Decomposed source, one channel per source channel, aligned with the source (no latency).
+    struct Stems : public StemSource {
+        int getNumChannels() const override { return sines.getNumChannels(); }
+        int getNumSamples() const override { return sines.getNumSamples(); }
+        double getSampleRate() const override { return sampleRate; }
+
+        void read(const Stem stem, const int channel, const int pos, float *dest,
+                  const int numSamples) const override;
+
+        juce::AudioBuffer<float> sines;
+        juce::AudioBuffer<float> transients;
+        juce::AudioBuffer<float> noise;
+        double sampleRate{44100.};
+    };
+
+    /// - Parameters:
+    ///   - newSettings: Decomposition and shifting settings, shared by all renders.
+    ///   - numThreads: Number of worker threads, 0 for one per CPU core.
+    SampleRenderer(const Settings &newSettings, const int numThreads = 0);
+
+    /// Decomposes every channel of a source. Mono sources run on a DecomposeSTN, more channels on MultiStreamSTN in
+    /// groups of up to 16, groups in parallel. Both give the same stems up to float rounding.
+    /// - Parameters:
+    ///   - source: Source audio.
+    ///   - sampleRate: Sample rate of the source.
+    Stems decompose(const juce::AudioBuffer<float> &source, const double sampleRate);
+
+    /// Stores stems in a cache directory and reuses them, see StemCache.
+    /// - Parameter cacheDirectory: Folder of the cache files, juce::File() to disable the cache.
+    void setCacheDirectory(const juce::File &cacheDirectory);
+
+    /// Renders one transposition from stems. Can be called from several threads at once.
+    /// - Parameters:
+    ///   - stems: Decomposed source, in memory or cached.
+    ///   - semitones: Transposition, -24 to 24.
+    /// - Returns: S + T + N with the sines and the noise shifted, as long as the source.
+    juce::AudioBuffer<float> render(const StemSource &stems, const int semitones) const;
+
+    /// Reads a source, decomposes it once (or reads its cached stems) and writes one file per transposition to outputDirectory, named after the
+    /// source with the transposition appended, e.g. "piano_C4_+7.wav". Transpositions are rendered in parallel.
+    /// - Parameters:
+    ///   - sourceFile: Audio file in any format known to juce::AudioFormatManager::registerBasicFormats.
+    ///   - outputDirectory: Existing directory for the rendered files.
+    ///   - semitones: Transpositions to render.
+    /// - Returns: Failure with a message when the source can not be read or an output can not be written.
+    juce::Result renderFile(const juce::File &sourceFile, const juce::File &outputDirectory,
+                            const juce::Array<int> &semitones);
+
+    static constexpr int blockSize{512}; // samples per process call, like a host block
+    static constexpr int maxStreams{16}; // channels decomposed by one MultiStreamSTN
+
+  private:
+    /// Decomposes one channel into the same channel of stems.
+    void decomposeChannel(const juce::AudioBuffer<float> &source, const int channel, Stems &stems) const;
+
+    /// Decomposes a group of channels in lockstep into the same channels of stems.
+    /// - Parameters:
+    ///   - source: Source audio.
+    ///   - firstChannel: First channel of the group.
+    ///   - numChannels: Number of channels, up to maxStreams. Padded with silent streams to 4, 8 or 16.
+    ///   - stems: Destination.
+    void decomposeChannels(const juce::AudioBuffer<float> &source, const int firstChannel, const int numChannels,
+                           Stems &stems) const;
+
+    /// Stems of a source, from the cache when it holds them, else decomposed and cached. Cached stems are always read
+    /// back from the cache file, only renders without a cache use the float stems.
+    std::unique_ptr<StemSource> getStems(const juce::AudioBuffer<float> &source, const double sampleRate);
+
+    /// Runs jobs on the thread pool and waits for all of them.
+    void runJobs(const std::vector<std::function<void()>> &jobs);
+
+    juce::Result writeFile(const juce::File &file, const juce::AudioBuffer<float> &audio,
+                           const double sampleRate) const;
+
+    static juce::String getTranspositionSuffix(const int semitones);
+
+    Settings settings;
+    juce::ThreadPool threadPool;
+    std::unique_ptr<StemCache> stemCache;
+    juce::AudioFormatManager formatManager;
+};
@@ -0,0 +1,171 @@
+#include "StemCache.h"
+
+namespace {
+constexpr juce::uint64 fnvOffsetBasis{14695981039346656037ull};
+constexpr juce::uint64 fnvPrime{1099511628211ull};
+
+juce::uint64 fnv1a(juce::uint64 hash, const void *data, const size_t numBytes) {
+    const auto *bytes = static_cast<const juce::uint8 *>(data);
+    for (size_t i = 0; i < numBytes; i++) {
+        hash ^= bytes[i];
+        hash *= fnvPrime;
+    }
+    return hash;
+}
+
+float readFloat(const char *data) {
+    const auto bits = juce::ByteOrder::littleEndianInt(data);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double readDouble(const char *data) {
+    const auto bits = juce::ByteOrder::littleEndianInt64(data);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+} // namespace
+
+juce::String StemCache::Key::getFileName() const {
+    return juce::String::toHexString(static_cast<juce::int64>(contentHash)).paddedLeft('0', 16) + "_" +
+           juce::String(fftSize) + "_" + juce::String(overlap) + "_" + juce::String(boundsSines, 3) + "_" +
+           juce::String(boundsTransients, 3) + ".stn";
+}
+
+StemCache::StemCache(const juce::File &cacheDirectory) : directory(cacheDirectory) {
+}
+
+juce::uint64 StemCache::hashSource(const juce::AudioBuffer<float> &source, const double sampleRate) {
+    const auto numChannels = static_cast<juce::int32>(source.getNumChannels());
+    auto hash = fnv1a(fnvOffsetBasis, &dspVersion, sizeof(dspVersion));
+    hash = fnv1a(hash, &numChannels, sizeof(numChannels));
+    hash = fnv1a(hash, &sampleRate, sizeof(sampleRate));
+    for (auto channel = 0; channel < numChannels; channel++) {
+        hash = fnv1a(hash, source.getReadPointer(channel), sizeof(float) * static_cast<size_t>(source.getNumSamples()));
+    }
+    return hash;
+}
+
+std::unique_ptr<StemCache::Reader> StemCache::open(const Key &key) const {
+    const auto file = directory.getChildFile(key.getFileName());
+    if (!file.existsAsFile())
+        return nullptr;
+
+    auto mappedFile = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+    const auto *data = static_cast<const char *>(mappedFile->getData());
+    if (data == nullptr || mappedFile->getSize() < headerSize)
+        return nullptr;
+
+    // A file of another format or DSP version or key (hash collision, edited file) is ignored and overwritten later
+    const auto numChannels = static_cast<int>(juce::ByteOrder::littleEndianInt(data + 32));
+    const auto numSamples = juce::ByteOrder::littleEndianInt64(data + 40);
+    const auto valid = std::memcmp(data, "STNC", 4) == 0 && juce::ByteOrder::littleEndianInt(data + 4) == version &&
+                       juce::ByteOrder::littleEndianInt64(data + 8) == key.contentHash &&
+                       static_cast<int>(juce::ByteOrder::littleEndianInt(data + 16)) == key.fftSize &&
+                       static_cast<int>(juce::ByteOrder::littleEndianInt(data + 20)) == key.overlap &&
+                       readFloat(data + 24) == key.boundsSines && readFloat(data + 28) == key.boundsTransients &&
+                       static_cast<int>(juce::ByteOrder::littleEndianInt(data + 36)) == blockSize && numChannels > 0 &&
+                       numSamples >= 0 && numSamples <= std::numeric_limits<int>::max() &&
+                       juce::ByteOrder::littleEndianInt(data + 56) == dspVersion;
+    if (!valid)
+        return nullptr;
+
+    const auto numBlocks = (numSamples + blockSize - 1) / blockSize;
+    const auto expectedSize = headerSize + numBlocks * StemSource::numStems * numChannels * recordSize;
+    if (static_cast<juce::int64>(mappedFile->getSize()) < expectedSize)
+        return nullptr;
+
+    return std::unique_ptr<Reader>(
+        new Reader(std::move(mappedFile), numChannels, static_cast<int>(numSamples), readDouble(data + 48)));
+}
+
+juce::Result StemCache::write(const Key &key, const StemSource &stems) const {
+    if (const auto result = directory.createDirectory(); result.failed())
+        return result;
+
+    const auto file = directory.getChildFile(key.getFileName());
+    juce::TemporaryFile temporaryFile(file);
+    {
+        juce::FileOutputStream out(temporaryFile.getFile());
+        if (!out.openedOk())
+            return juce::Result::fail("Can not write " + file.getFullPathName());
+
+        // ===== Header =====
+        out.write("STNC", 4);
+        out.writeInt(static_cast<int>(version));
+        out.writeInt64(static_cast<juce::int64>(key.contentHash));
+        out.writeInt(key.fftSize);
+        out.writeInt(key.overlap);
+        out.writeFloat(key.boundsSines);
+        out.writeFloat(key.boundsTransients);
+        out.writeInt(stems.getNumChannels());
+        out.writeInt(blockSize);
+        out.writeInt64(stems.getNumSamples());
+        out.writeDouble(stems.getSampleRate());
+        out.writeInt(static_cast<int>(dspVersion));
+        out.writeRepeatedByte(0, headerSize - 60);
+
+        // ===== Records =====
+        std::vector<float> block(blockSize);
+        std::vector<juce::int16> values(blockSize);
+        for (auto pos = 0; pos < stems.getNumSamples(); pos += blockSize) {
+            for (auto stem = 0; stem < StemSource::numStems; stem++) {
+                for (auto channel = 0; channel < stems.getNumChannels(); channel++) {
+                    stems.read(static_cast<StemSource::Stem>(stem), channel, pos, block.data(), blockSize);
+
+                    const auto range = juce::FloatVectorOperations::findMinAndMax(block.data(), blockSize);
+                    const auto peak = juce::jmax(-range.getStart(), range.getEnd());
+                    const auto scale = peak / 32767.f;
+                    const auto inverseScale = peak > 0.f ? 1.f / scale : 0.f;
+                    for (auto i = 0; i < blockSize; i++) {
+                        const auto value = static_cast<juce::int16>(std::lrint(block[i] * inverseScale));
+                        values[i] = static_cast<juce::int16>(juce::ByteOrder::swapIfBigEndian(static_cast<juce::uint16>(value)));
+                    }
+                    out.writeFloat(scale);
+                    out.write(values.data(), values.size() * sizeof(juce::int16));
+                }
+            }
+        }
+
+        out.flush();
+        if (out.getStatus().failed())
+            return out.getStatus();
+    }
+
+    if (!temporaryFile.overwriteTargetFileWithTemporary())
+        return juce::Result::fail("Can not write " + file.getFullPathName());
+    return juce::Result::ok();
+}
+
+StemCache::Reader::Reader(std::unique_ptr<juce::MemoryMappedFile> mappedFile, const int newNumChannels,
+                          const int newNumSamples, const double newSampleRate)
+    : file(std::move(mappedFile)), numChannels(newNumChannels), numSamples(newNumSamples), sampleRate(newSampleRate) {
+}
+
+const char *StemCache::Reader::getRecord(const int block, const Stem stem, const int channel) const {
+    const auto index = (static_cast<size_t>(block) * numStems + stem) * numChannels + channel;
+    return static_cast<const char *>(file->getData()) + headerSize + index * recordSize;
+}
+
+void StemCache::Reader::read(const Stem stem, const int channel, const int pos, float *dest,
+                             const int numSamplesToRead) const {
+    jassert(pos >= 0 && channel < numChannels);
+    auto done = 0;
+    while (done < numSamplesToRead && pos + done < numSamples) {
+        const auto samplePos = pos + done;
+        const auto block = samplePos / blockSize;
+        const auto offset = samplePos % blockSize;
+        const auto count = juce::jmin(numSamplesToRead - done, blockSize - offset, numSamples - samplePos);
+
+        const auto *record = getRecord(block, stem, channel);
+        const auto scale = readFloat(record);
+        const auto *values = record + sizeof(float) + offset * sizeof(juce::int16);
+        for (auto i = 0; i < count; i++) {
+            dest[done + i] = scale * static_cast<juce::int16>(juce::ByteOrder::littleEndianShort(values + i * 2));
+        }
+        done += count;
+    }
+    juce::FloatVectorOperations::clear(dest + done, numSamplesToRead - done); // past the end
+}
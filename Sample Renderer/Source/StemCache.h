@@ -0,0 +1,79 @@
+#pragma once
+#include "StemSource.h"
+#include <JuceHeader.h>
+
+/// On-disk cache of decomposed stems, so rendering the same source again skips DecomposeSTN. A file is keyed by a hash
+/// of the source audio and the decomposition settings, the only inputs the decomposition depends on, besides the
+/// decomposition code itself, which dspVersion stands for.
+///
+/// File layout, little endian: a 64 byte header (magic "STNC", format version, key, channels, samples, sample rate,
+/// DSP version), then the stems in blocks of blockSize samples. Every block holds one record per stem and channel, in
+/// StemSource::Stem order. A record is a float scale followed by blockSize 16 bit values, sample = value * scale, with
+/// the scale set by the block peak. Stems take half the space of float samples, the quantisation error stays 96 dB
+/// below the block peak. Blocks are stored in time order, so a render streams through the file front to back.
+class StemCache {
+  public:
+    /// Everything the stems depend on.
+    struct Key {
+        juce::uint64 contentHash{0}; // see hashSource
+        int fftSize{2048};
+        int overlap{8};
+        float boundsSines{0.75f};
+        float boundsTransients{0.8f};
+
+        /// Name of the cache file.
+        juce::String getFileName() const;
+    };
+
+    /// Cached stems, memory mapped. Records are decoded as they are read.
+    class Reader : public StemSource {
+      public:
+        int getNumChannels() const override { return numChannels; }
+        int getNumSamples() const override { return numSamples; }
+        double getSampleRate() const override { return sampleRate; }
+
+        void read(const Stem stem, const int channel, const int pos, float *dest,
+                  const int numSamples) const override;
+
+      private:
+        friend class StemCache;
+        Reader(std::unique_ptr<juce::MemoryMappedFile> mappedFile, int numChannels, int numSamples, double sampleRate);
+
+        const char *getRecord(const int block, const Stem stem, const int channel) const;
+
+        std::unique_ptr<juce::MemoryMappedFile> file;
+        int numChannels;
+        int numSamples;
+        double sampleRate;
+    };
+
+    /// - Parameter cacheDirectory: Folder of the cache files, created when the first file is written.
+    explicit StemCache(const juce::File &cacheDirectory);
+
+    /// 64 bit FNV-1a hash of the DSP version, channel count, sample rate and samples of a source.
+    static juce::uint64 hashSource(const juce::AudioBuffer<float> &source, const double sampleRate);
+
+    /// Maps the cached stems of a key.
+    /// - Parameter key: Source hash and decomposition settings.
+    /// - Returns: nullptr when nothing valid is cached for the key.
+    std::unique_ptr<Reader> open(const Key &key) const;
+
+    /// Stores stems, replacing the file of the key atomically.
+    /// - Parameters:
+    ///   - key: Source hash and decomposition settings.
+    ///   - stems: Decomposed source.
+    juce::Result write(const Key &key, const StemSource &stems) const;
+
+    static constexpr int blockSize{512};
+
+    /// Version of the stems, bump it whenever DecomposeSTN or SampleRenderer::decompose change their output. Stems of
+    /// another version are decomposed again.
+    static constexpr juce::uint32 dspVersion{1};
+
+  private:
+    static constexpr juce::uint32 version{2}; // file format
+    static constexpr int headerSize{64};
+    static constexpr int recordSize{static_cast<int>(sizeof(float)) + blockSize * static_cast<int>(sizeof(juce::int16))};
+
+    juce::File directory;
+};
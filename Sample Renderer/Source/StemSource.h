@@ -0,0 +1,24 @@
+#pragma once
+#include <JuceHeader.h>
+
+/// Read access to decomposed S / T / N stems, aligned with the source. Renders read the stems block by block, so
+/// stems can be held in memory or streamed from a cache file. Reads can happen from several threads at once.
+class StemSource {
+  public:
+    enum Stem { sines, transients, noise, numStems };
+
+    virtual ~StemSource() = default;
+
+    virtual int getNumChannels() const = 0;
+    virtual int getNumSamples() const = 0;
+    virtual double getSampleRate() const = 0;
+
+    /// Copies a block of one stem.
+    /// - Parameters:
+    ///   - stem: Stem to read.
+    ///   - channel: Source channel.
+    ///   - pos: Position of the first sample, zeros are read past the end of the stems.
+    ///   - dest: Destination.
+    ///   - numSamples: Number of samples.
+    virtual void read(const Stem stem, const int channel, const int pos, float *dest, const int numSamples) const = 0;
+};